@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace bench
+{
+
+    // Hardware counter for the calling thread and every thread it spawns after the counter is created. Opening it fails
+    // without perf access (e.g. perf_event_paranoid > 2 or inside a container), read() then returns nothing.
+    class PerfCounter
+    {
+    public:
+        enum class Event
+        {
+            CacheMisses,     // last level cache
+            L1dReadMisses,
+        };
+
+        explicit PerfCounter(Event event)
+        {
+#if defined(__linux__)
+            perf_event_attr attr{};
+            attr.size           = sizeof(attr);
+            attr.disabled       = 1;
+            attr.inherit        = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+
+            switch (event) {
+            case Event::CacheMisses:
+                attr.type   = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                break;
+            case Event::L1dReadMisses:
+                attr.type   = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                break;
+            }
+
+            m_fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+        }
+
+        ~PerfCounter()
+        {
+#if defined(__linux__)
+            if (m_fd >= 0) {
+                close(m_fd);
+            }
+#endif
+        }
+
+        PerfCounter(const PerfCounter&)            = delete;
+        PerfCounter& operator=(const PerfCounter&) = delete;
+
+        void start()
+        {
+#if defined(__linux__)
+            if (m_fd >= 0) {
+                ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        void stop()
+        {
+#if defined(__linux__)
+            if (m_fd >= 0) {
+                ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+#endif
+        }
+
+        std::optional<std::uint64_t> read() const
+        {
+#if defined(__linux__)
+            std::uint64_t value = 0;
+            if (m_fd >= 0 && ::read(m_fd, &value, sizeof(value)) == sizeof(value)) {
+                return value;
+            }
+#endif
+            return {};
+        }
+
+    private:
+        int m_fd = -1;
+    };
+
+    template <typename Fn>
+    double timeSeconds(Fn&& fn)
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+}
@@ -0,0 +1,97 @@
+#include "bench.hpp"
+
+#include "rtr/aabb.hpp"
+#include "rtr/bvh.hpp"
+#include "rtr/thread_pool.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Builds BVHs over random spheres of growing counts with 1, 2, 4, ... workers and reports the build time, the speedup
+// over one worker and the SAH cost of the result (the same for every worker count). The median split is listed for
+// reference.
+//
+// usage: bvh_bench [max primitives] [repetitions]
+int main(int argc, char** argv)
+{
+    const std::size_t maxPrimitives = argc > 1 ? std::stoull(argv[1]) : 1'000'000;
+    const int         repetitions   = argc > 2 ? std::stoi(argv[2]) : 3;
+
+    const auto makeBoxes = [](std::size_t count) {
+        std::mt19937                           rng{ 42 };
+        std::uniform_real_distribution<double> position{ -100.0, 100.0 };
+        std::uniform_real_distribution<double> radius{ 0.05, 0.5 };
+
+        std::vector<rtr::Aabb> boxes;
+        boxes.reserve(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            rtr::Vec3<double> center{ position(rng), position(rng), position(rng) };
+            auto              r = radius(rng);
+            boxes.emplace_back(center - rtr::Vec3<double>{ r, r, r }, center + rtr::Vec3<double>{ r, r, r });
+        }
+        return boxes;
+    };
+
+    const auto best = [&](auto&& build) {
+        double seconds = 0.0;
+        for (int rep = 0; rep < repetitions; ++rep) {
+            auto time = bench::timeSeconds(build);
+            seconds   = rep == 0 ? time : std::min(seconds, time);
+        }
+        return seconds;
+    };
+
+    std::vector<int> workerCounts;
+    for (int workers = 1; workers <= std::max(int(std::thread::hardware_concurrency()), 1); workers *= 2) {
+        workerCounts.push_back(workers);
+    }
+
+    fmt::println("best of {}", repetitions);
+    fmt::println(
+        "{:>11} {:>8} | {:>9} {:>8} | {:>10} {:>9}", "primitives", "split", "workers", "time(s)", "speedup", "SAH cost"
+    );
+
+    for (std::size_t count = 10'000; count <= maxPrimitives; count *= 10) {
+        auto boxes = makeBoxes(count);
+
+        rtr::BvhTree median;
+        auto medianTime = best([&] { median = rtr::bvh::build(boxes, { .m_split = rtr::bvh::Split::Median }); });
+        fmt::println(
+            "{:>11} {:>8} | {:>9} {:>8.3f} | {:>10} {:>9.2f}",
+            count,
+            "median",
+            1,
+            medianTime,
+            "",
+            rtr::bvh::sahCost(median.m_nodes)
+        );
+
+        double serialTime = 0.0;
+        for (auto workers : workerCounts) {
+            auto pool = std::make_unique<rtr::ThreadPool>(workers);
+
+            rtr::BvhTree tree;
+            auto time = best([&] { tree = rtr::bvh::build(boxes, { .m_pool = workers > 1 ? pool.get() : nullptr }); });
+            if (workers == 1) {
+                serialTime = time;
+            }
+
+            fmt::println(
+                "{:>11} {:>8} | {:>9} {:>8.3f} | {:>9.2f}x {:>9.2f}",
+                count,
+                "sah",
+                workers,
+                time,
+                serialTime / time,
+                rtr::bvh::sahCost(tree.m_nodes)
+            );
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#include "bench.hpp"
+
+#include "rtr/hittable.hpp"
+#include "rtr/scenes.hpp"
+#include "rtr/thread_pool.hpp"
+
+#include <fmt/core.h>
+
+#include <cstddef>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+// Generates scenes of growing sphere counts (see scenes::generated) and reports the time to generate them, to build
+// their BVH on all the hardware threads and to find the closest hit of rays from the default camera, one row per
+// count and distribution. Counts go from 1000 up to the maximum in steps of 10.
+//
+// usage: scaling_bench [max objects] [rays] [uniform|clustered|nested|all]
+int main(int argc, char** argv)
+{
+    using rtr::scenes::Distribution;
+
+    const auto maxObjects = argc > 1 ? std::size_t(std::stod(argv[1])) : std::size_t{ 1'000'000 };
+    const auto numRays    = argc > 2 ? std::size_t(std::stod(argv[2])) : std::size_t{ 1'000'000 };
+    const auto which      = argc > 3 ? std::string{ argv[3] } : std::string{ "all" };
+
+    std::vector<Distribution> distributions;
+    if (which == "all") {
+        distributions = { Distribution::Uniform, Distribution::Clustered, Distribution::Nested };
+    } else if (auto distribution = rtr::scenes::parseDistribution(which); distribution.has_value()) {
+        distributions = { *distribution };
+    } else {
+        fmt::println(stderr, "Unknown distribution '{}'", which);
+        return 1;
+    }
+
+    // from the default camera toward the volume the spheres are in
+    const rtr::Vec3<double> lookFrom{ 13.0, 2.0, 3.0 };
+    std::vector<rtr::Ray>   rays;
+    {
+        std::mt19937                           rng{ 42 };
+        std::uniform_real_distribution<double> dist{ 0.0, 1.0 };
+
+        rays.reserve(numRays);
+        for (std::size_t i = 0; i < numRays; ++i) {
+            rtr::Vec3<double> target{ -8.0 + 16.0 * dist(rng), 4.0 * dist(rng), -8.0 + 16.0 * dist(rng) };
+            rays.emplace_back(lookFrom, target - lookFrom);
+        }
+    }
+
+    rtr::ThreadPool pool;
+
+    fmt::println("{} rays, {} workers", numRays, pool.size());
+    fmt::println(
+        "{:>10} {:>10} | {:>9} {:>9} | {:>9} {:>9}", "objects", "layout", "make(s)", "build(s)", "trace(s)", "Mrays/s"
+    );
+
+    for (auto distribution : distributions) {
+        for (std::size_t count = 1000; count <= maxObjects; count *= 10) {
+            const rtr::scenes::GeneratorParam param{
+                .m_count        = count,
+                .m_distribution = distribution,
+                .m_materials    = {},
+            };
+
+            std::optional<rtr::HittableList> world;
+
+            auto makeTime  = bench::timeSeconds([&] { world = rtr::scenes::generated(7, param); });
+            auto buildTime = bench::timeSeconds([&] { world->build(nullptr, &pool); });
+
+            auto traceTime = bench::timeSeconds([&] {
+                for (const auto& ray : rays) {
+                    world->hit(ray, { 0.001, rtr::n::infinity });
+                }
+            });
+
+            fmt::println(
+                "{:>10} {:>10} | {:>9.3f} {:>9.3f} | {:>9.3f} {:>9.2f}",
+                count,
+                rtr::scenes::toString(distribution),
+                makeTime,
+                buildTime,
+                traceTime,
+                double(numRays) / traceTime / 1e6
+            );
+        }
+    }
+}
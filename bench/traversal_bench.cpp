@@ -0,0 +1,130 @@
+#include "bench.hpp"
+
+#include "rtr/progress.hpp"
+#include "rtr/ray_tracer.hpp"
+#include "rtr/scenes.hpp"
+#include "rtr/thread_pool.hpp"
+#include "rtr/traversal.hpp"
+
+#include <concurrencpp/runtime/runtime.h>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Renders the same scene with every traversal order and reports the render speed in camera rays per second along
+// with the cache misses of the whole render.
+//
+// usage: traversal_bench [height] [samples per pixel] [repetitions]
+int main(int argc, char** argv)
+{
+    using rtr::TraversalOrder;
+
+    const int height      = argc > 1 ? std::stoi(argv[1]) : 270;
+    const int samples     = argc > 2 ? std::stoi(argv[2]) : 8;
+    const int repetitions = argc > 3 ? std::stoi(argv[3]) : 3;
+
+    struct Config
+    {
+        TraversalOrder m_tileOrder;
+        TraversalOrder m_pixelOrder;
+        int            m_tileSize;
+    };
+
+    const auto configs = std::to_array<Config>({
+        { TraversalOrder::Scanline, TraversalOrder::Scanline, 16 },
+        { TraversalOrder::Morton, TraversalOrder::Morton, 16 },
+        { TraversalOrder::Hilbert, TraversalOrder::Hilbert, 16 },
+        { TraversalOrder::Hilbert, TraversalOrder::Hilbert, 32 },
+    });
+
+    concurrencpp::runtime   runtime;
+    rtr::ProgressBarManager progressBar{ runtime };    // never started, keeps the output clean
+
+    // inherited counters only follow threads created after them, so open them before the workers
+    bench::PerfCounter llc{ bench::PerfCounter::Event::CacheMisses };
+    bench::PerfCounter l1d{ bench::PerfCounter::Event::L1dReadMisses };
+
+    auto threadPool = std::make_shared<rtr::ThreadPool>();    // same workers for every render
+
+    const auto format = [](std::optional<std::uint64_t> count) {
+        return count ? fmt::format("{:.2f}M", double(*count) / 1e6) : std::string{ "n/a" };
+    };
+
+    std::vector<std::string> rows(configs.size());
+    for (std::size_t i = 0; i < configs.size(); ++i) {
+        const auto& [tileOrder, pixelOrder, tileSize] = configs[i];
+
+        double                       best = 0.0;
+        std::optional<std::uint64_t> llcMisses;
+        std::optional<std::uint64_t> l1Misses;
+
+        for (int rep = 0; rep < repetitions; ++rep) {
+            rtr::RayTracer rayTracer{
+                rtr::scenes::make("default", 42),
+                {
+                    .m_height        = height,
+                    .m_samplingRate  = samples,
+                    .m_maxDepth      = 10,
+                    .m_fov           = 20.0,
+                    .m_focusDistance = 10.0,
+                    .m_defocusAngle  = 0.6,
+                    .m_lookFrom      = { 13.0, 2.0, 3.0 },
+                    .m_lookAt        = { 0.0, 0.0, 0.0 },
+                    .m_tileSize      = tileSize,
+                    .m_tileOrder     = tileOrder,
+                    .m_pixelOrder    = pixelOrder,
+                    .m_threadPool    = threadPool,
+                },
+            };
+
+            llc.start();
+            l1d.start();
+            auto seconds = bench::timeSeconds([&] { rayTracer.run(progressBar); });
+            l1d.stop();
+            llc.stop();
+
+            // keep the counters of the fastest repetition
+            if (best == 0.0 || seconds < best) {
+                best      = seconds;
+                llcMisses = llc.read();
+                l1Misses  = l1d.read();
+            }
+        }
+
+        auto width = int(height * 16.0 / 9.0);    // default aspect ratio of TracerParam
+        auto rays  = double(width) * double(height) * double(samples);
+
+        rows[i] = fmt::format(
+            "{:>9} {:>9} {:>9} | {:>8.3f} {:>8.2f} | {:>10} {:>10}",
+            rtr::toString(tileOrder),
+            rtr::toString(pixelOrder),
+            tileSize,
+            best,
+            rays / best / 1e6,
+            format(llcMisses),
+            format(l1Misses)
+        );
+    }
+
+    fmt::println("");
+    fmt::println("{}p, {} spp, best of {}", height, samples, repetitions);
+    fmt::println(
+        "{:>9} {:>9} {:>9} | {:>8} {:>8} | {:>10} {:>10}",
+        "tiles",
+        "pixels",
+        "tile size",
+        "time(s)",
+        "Mrays/s",
+        "LLC miss",
+        "L1d miss"
+    );
+    for (const auto& row : rows) {
+        fmt::println("{}", row);
+    }
+}
@@ -1,18 +1,38 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
+
+#include "rtr/bvh_cache.hpp"
 #include "rtr/color.hpp"
+#include "rtr/cost.hpp"
+#include "rtr/daemon.hpp"
+#include "rtr/first_hits.hpp"
+#include "rtr/memory.hpp"
+#include "rtr/out_of_core.hpp"
+#include "rtr/ppm.hpp"
 #include "rtr/progress.hpp"
 #include "rtr/ray_tracer.hpp"
-#include "rtr/sphere.hpp"
+#include "rtr/render_job.hpp"
+#include "rtr/scenes.hpp"
+#include "rtr/texture.hpp"
+#include "rtr/texture_io.hpp"
+#include "rtr/traversal.hpp"
 #include "rtr/util.hpp"
 
 #include <chrono>
 #include <concurrencpp/runtime/runtime.h>
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
 #include <filesystem>
-#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
-#include <utility>
+#include <string_view>
 
 std::string formatName(std::string_view name, std::string_view extension)
 {
@@ -21,124 +41,613 @@ std::string formatName(std::string_view name, std::string_view extension)
     return std::format("{}_{:%F_%H-%M-%OS}.{}", name, time, extension);
 };
 
-void generatePpmImage(std::span<rtr::Color<double>> pixels, int width, int height, std::filesystem::path outPath)
+void generatePpmImage(const rtr::Image& image, std::filesystem::path outPath)
+{
+    rtr::PpmWriter writer{ outPath, image.width(), image.height() };
+    writer.write(image);
+}
+
+struct Options
+{
+    std::filesystem::path m_outFile     = formatName("out", "ppm");
+    bool                  m_stream      = false;
+    int                   m_bandHeight  = 16;
+    rtr::PixelFormat      m_pixelFormat = rtr::PixelFormat::Float32;
+    bool                  m_normals     = false;
+    rtr::Background       m_background  = rtr::Background::Sky;
+    std::string           m_scene       = "default";
+    std::uint64_t         m_seed        = std::uint64_t(std::time(nullptr));
+    std::filesystem::path m_texture;
+    std::size_t           m_textureCacheMb = 64;
+    int                   m_tileSize       = 16;
+    rtr::TraversalOrder   m_tileOrder      = rtr::TraversalOrder::Hilbert;
+    rtr::TraversalOrder   m_pixelOrder     = rtr::TraversalOrder::Hilbert;
+    int                   m_threads        = 0;
+    bool                  m_pinThreads     = false;
+    double                m_preview        = 0.0;    // seconds between snapshots, 0: render synchronously
+    rtr::ProgressStyle    m_progress       = rtr::defaultProgressStyle();
+    double                m_timeBudget     = 0.0;    // seconds, 0: a fixed number of samples per pixel
+    bool                  m_costMaps       = false;
+    std::string           m_daemon;                  // socket path, "-" for stdin
+    std::size_t           m_sceneCache     = 8;
+    std::filesystem::path m_geometry;    // out-of-core spheres added to the scene
+    std::size_t           m_geometryBudgetMb = 256;
+    std::filesystem::path m_bvhCache;    // directory of built BVHs reused across runs
+    std::size_t           m_memoryBudgetMb = 0;
+
+    rtr::scenes::GeneratorParam m_generator;    // spheres of --scene generated
+
+    std::optional<rtr::Tile> m_crop;     // pixel rectangle of the frame to render
+    std::filesystem::path    m_patch;    // full frame the crop window is patched into, instead of writing it alone
+
+    // camera ray hits of the view, replayed when the file exists and recorded into it otherwise
+    std::filesystem::path m_firstHits;
+};
+
+rtr::TraversalOrder parseOrder(std::string_view option, std::string_view value)
 {
-    constexpr int maxColor = 255;
+    auto order = rtr::parseTraversalOrder(value);
+    if (!order.has_value()) {
+        throw std::invalid_argument{ fmt::format("Unknown {} '{}'", option, value) };
+    }
+    return *order;
+}
 
-    std::ofstream outFile{ outPath, std::ios::out | std::ios::trunc };
-    if (!outFile.good()) {
-        throw std::runtime_error{ fmt::format("Problem opening file '{}'", outPath.string()) };
+// "x,y,width,height" in pixels of the frame
+rtr::Tile parseCrop(const std::string& value)
+{
+    rtr::Tile crop{ 0, 0, 0, 0 };
+    if (std::sscanf(value.c_str(), "%d,%d,%d,%d", &crop.m_x, &crop.m_y, &crop.m_width, &crop.m_height) != 4) {
+        throw std::invalid_argument{ fmt::format("Expected x,y,width,height but got '{}'", value) };
+    }
+    if (crop.m_width <= 0 || crop.m_height <= 0) {
+        throw std::invalid_argument{ fmt::format("The crop window '{}' is empty", value) };
     }
+    return crop;
+}
 
-    // prelude
-    std::string temp = fmt::format("P3\n{} {}\n{}\n", width, height, maxColor);
+Options parseArgs(int argc, char** argv)
+{
+    Options options;
 
-    for (int w = 0; const auto& pixel : pixels) {
-        auto corrected  = rtr::colorfn::correctGamma(pixel);
-        auto clamped    = rtr::colorfn::clamp(corrected, { 0.0, 0.999 });
-        auto color      = rtr::colorfn::cast<int>(clamped, { 0.0, 1.0 }, { 0, maxColor });
-        temp           += fmt::format("{} {} {}\n", color.x(), color.y(), color.z());
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
 
-        if (++w % width == 0) {
-            outFile << std::exchange(temp, {});
+        if (arg == "--stream") {
+            options.m_stream = true;
+        } else if (arg == "--band-height") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--band-height requires a value" };
+            }
+            options.m_bandHeight = std::max(1, std::stoi(argv[i]));
+        } else if (arg == "--format") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--format requires a value" };
+            }
+            auto format = rtr::parsePixelFormat(argv[i]);
+            if (!format.has_value()) {
+                throw std::invalid_argument{ fmt::format("Unknown pixel format '{}'", argv[i]) };
+            }
+            options.m_pixelFormat = *format;
+        } else if (arg == "--normals") {
+            options.m_normals = true;
+        } else if (arg == "--background") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--background requires a value" };
+            }
+            if (std::string_view value = argv[i]; value == "sky") {
+                options.m_background = rtr::Background::Sky;
+            } else if (value == "black") {
+                options.m_background = rtr::Background::Black;
+            } else {
+                throw std::invalid_argument{ fmt::format("Unknown background '{}'", value) };
+            }
+        } else if (arg == "--scene") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--scene requires a value" };
+            }
+            options.m_scene = argv[i];
+            if (!rtr::scenes::exists(options.m_scene)) {
+                throw std::invalid_argument{ fmt::format("Unknown scene '{}'", options.m_scene) };
+            }
+        } else if (arg == "--objects") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--objects requires a value" };
+            }
+            options.m_generator.m_count = std::size_t(std::max(0.0, std::stod(argv[i])));    // 1e6 works too
+        } else if (arg == "--distribution") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--distribution requires a value" };
+            }
+            auto distribution = rtr::scenes::parseDistribution(argv[i]);
+            if (!distribution.has_value()) {
+                throw std::invalid_argument{ fmt::format("Unknown distribution '{}'", argv[i]) };
+            }
+            options.m_generator.m_distribution = *distribution;
+        } else if (arg == "--materials") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--materials requires a value" };
+            }
+            options.m_generator.m_materials = rtr::scenes::parseMaterialMix(argv[i]);
+        } else if (arg == "--seed") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--seed requires a value" };
+            }
+            options.m_seed = std::stoull(argv[i]);
+        } else if (arg == "--texture") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--texture requires a value" };
+            }
+            options.m_texture = argv[i];
+        } else if (arg == "--texture-cache-mb") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--texture-cache-mb requires a value" };
+            }
+            options.m_textureCacheMb = std::size_t(std::max(1, std::stoi(argv[i])));
+        } else if (arg == "--tile-size") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--tile-size requires a value" };
+            }
+            options.m_tileSize = std::max(1, std::stoi(argv[i]));
+        } else if (arg == "--tile-order") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--tile-order requires a value" };
+            }
+            options.m_tileOrder = parseOrder("tile order", argv[i]);
+        } else if (arg == "--pixel-order") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--pixel-order requires a value" };
+            }
+            options.m_pixelOrder = parseOrder("pixel order", argv[i]);
+        } else if (arg == "--threads") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--threads requires a value" };
+            }
+            options.m_threads = std::max(0, std::stoi(argv[i]));
+        } else if (arg == "--pin") {
+            options.m_pinThreads = true;
+        } else if (arg == "--preview") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--preview requires a value" };
+            }
+            options.m_preview = std::max(0.0, std::stod(argv[i]));
+        } else if (arg == "--progress") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--progress requires a value" };
+            }
+            auto style = rtr::parseProgressStyle(argv[i]);
+            if (!style.has_value()) {
+                throw std::invalid_argument{ fmt::format("Unknown progress style '{}'", argv[i]) };
+            }
+            options.m_progress = *style;
+        } else if (arg == "--time-budget") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--time-budget requires a value" };
+            }
+            options.m_timeBudget = std::max(0.0, std::stod(argv[i]));
+        } else if (arg == "--cost-maps") {
+            options.m_costMaps = true;
+        } else if (arg == "--crop") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--crop requires a value" };
+            }
+            options.m_crop = parseCrop(argv[i]);
+        } else if (arg == "--patch") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--patch requires an image" };
+            }
+            options.m_patch = argv[i];
+        } else if (arg == "--first-hits") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--first-hits requires a file" };
+            }
+            options.m_firstHits = argv[i];
+        } else if (arg == "--daemon") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--daemon requires a socket path or '-'" };
+            }
+            options.m_daemon = argv[i];
+        } else if (arg == "--scene-cache") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--scene-cache requires a value" };
+            }
+            options.m_sceneCache = std::size_t(std::max(1, std::stoi(argv[i])));
+        } else if (arg == "--geometry") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--geometry requires a file" };
+            }
+            options.m_geometry = argv[i];
+        } else if (arg == "--geometry-budget-mb") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--geometry-budget-mb requires a value" };
+            }
+            options.m_geometryBudgetMb = std::size_t(std::max(1, std::stoi(argv[i])));
+        } else if (arg == "--bvh-cache") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--bvh-cache requires a directory" };
+            }
+            options.m_bvhCache = argv[i];
+        } else if (arg == "--memory-budget-mb") {
+            if (++i >= argc) {
+                throw std::invalid_argument{ "--memory-budget-mb requires a value" };
+            }
+            options.m_memoryBudgetMb = std::size_t(std::max(0, std::stoi(argv[i])));
+        } else if (arg.starts_with("--")) {
+            throw std::invalid_argument{ fmt::format("Unknown option '{}'", arg) };
+        } else {
+            if (std::filesystem::exists(arg)) {
+                fmt::println("File '{}' already exist, will overwrite", arg);
+            }
+
+            if (std::filesystem::is_directory(arg)) {
+                fmt::println(stderr, "File '{}' is a directory, reverting to default name...", arg);
+            } else {
+                options.m_outFile = arg;
+            }
         }
     }
+
+    if (!options.m_patch.empty() && (!options.m_crop.has_value() || options.m_stream)) {
+        throw std::invalid_argument{ "--patch requires --crop and can't be used with --stream" };
+    }
+    if (!options.m_firstHits.empty() && (options.m_timeBudget > 0 || !options.m_daemon.empty())) {
+        throw std::invalid_argument{ "--first-hits can't be used with --time-budget or --daemon" };
+    }
+
+    return options;
 }
 
-rtr::HittableList createScene()
+// False color images of the cost of every pixel next to the image, out_time.ppm, out_rays.ppm, ... for out.ppm. Each
+// one goes from 0 to the 99th percentile of its metric.
+void writeCostMaps(const rtr::cost::CostMaps& maps, const std::filesystem::path& outPath)
 {
-    using namespace rtr;
+    using rtr::cost::Metric;
 
-    static constexpr double glassRefractionIndex = 1.5;
+    for (auto metric : rtr::cost::s_metrics) {
+        auto name = fmt::format("{}_{}{}", outPath.stem().string(), toString(metric), outPath.extension().string());
+        auto path = outPath;
+        path.replace_filename(name);
 
-    HittableList scene;
+        auto maxValue = maps.percentile(metric, 0.99);
+        generatePpmImage(maps.heatmap(metric, maxValue), path);
+        fmt::println(
+            "Cost map '{}' written to '{}' (0 to {:.4g} per pixel)", toString(metric), path.string(), maxValue
+        );
+    }
 
-    auto& ground = scene.emplace<Sphere>(Vec{ 0.0, -1000.0, 0.0 }, 1000.0);
-    ground.setMaterial<Lambertian>(Color<>{ 0.5, 0.5, 0.5 });
+    auto rays = maps.total(Metric::Rays);
+    fmt::println(
+        "Cost: {:.2f}s of pixel time, {:.0f} rays, {:.1f} intersection tests per ray, {:.2f} path segments per sample",
+        maps.total(Metric::Time),
+        rays,
+        rays > 0 ? maps.total(Metric::Tests) / rays : 0.0,
+        maps.total(Metric::Depth)
+    );
+}
 
-    // small spheres
-    for (int a : rv::iota(-11, 11)) {
-        for (int b : rv::iota(-11, 11)) {
-            Vec center{ a + 0.9 * util::getRandomDouble(), 0.2, b + 0.9 * util::getRandomDouble() };
-            Vec offset{ 4.0, 0.2, 0.0 };
+// the first hits recorded by the render, for rendering the view again with other materials
+int saveFirstHits(const rtr::FirstHits& firstHits, const std::filesystem::path& path)
+{
+    try {
+        firstHits.save(path);
+    } catch (const std::exception& e) {
+        fmt::println(stderr, "Error: {}", e.what());
+        return 1;
+    }
+    fmt::println("First hits of {} samples written to '{}'", firstHits.size(), path.string());
+    return 0;
+}
 
-            if (vecfn::length(center - offset) <= 0.9) {
-                break;
-            }
+// bytes held by every subsystem at the end of the run and the most they held during it
+void printMemoryReport()
+{
+    const auto& accounting = rtr::memory::accounting();
 
-            auto& sphere = scene.emplace<Sphere>(center, 0.2);
+    fmt::println("{:<14} {:>12} {:>12}", "Memory (MiB)", "current", "peak");
+    for (auto subsystem : rtr::memory::s_subsystems) {
+        auto [current, peak] = accounting.usage(subsystem);
+        fmt::println(
+            "{:<14} {:>12.1f} {:>12.1f}",
+            rtr::memory::toString(subsystem),
+            rtr::memory::toMib(current),
+            rtr::memory::toMib(peak)
+        );
+    }
 
-            if (double chooseMaterial = util::getRandomDouble(); chooseMaterial < 0.8) {
-                // diffuse
-                auto albedo = vecfn::random(0.0, 1.0) * vecfn::random(0.0, 1.0);
-                sphere.setMaterial<Lambertian>(albedo);
-            } else if (chooseMaterial < 0.95) {
-                // metal
-                auto albedo = vecfn::random(0.5, 1.0);
-                auto fuzz   = util::getRandomDouble(0.0, 0.5);
-                sphere.setMaterial<Metal>(albedo, fuzz);
-            } else {
-                // glass
-                sphere.setMaterial<Dielectric>(glassRefractionIndex);
-            }
+    auto [current, peak] = accounting.total();
+    fmt::println("{:<14} {:>12.1f} {:>12.1f}", "total", rtr::memory::toMib(current), rtr::memory::toMib(peak));
+    if (accounting.budget() != 0) {
+        fmt::println("{:<14} {:>12.1f}", "budget", rtr::memory::toMib(accounting.budget()));
+    }
+}
+
+// render asynchronously on the runtime's thread pool, writing what is done so far to `outPath` every `interval`
+rtr::Image renderWithPreview(
+    const rtr::RayTracer&         rayTracer,
+    concurrencpp::runtime&        runtime,
+    std::chrono::duration<double> interval,
+    const std::filesystem::path&  outPath
+)
+{
+    auto job    = std::make_shared<rtr::RenderJob>();
+    auto result = rayTracer.submit(runtime.thread_pool_executor(), job);
+
+    while (result.wait_for(interval) == concurrencpp::result_status::idle) {
+        if (auto snapshot = job->snapshot(); snapshot.has_value()) {
+            generatePpmImage(*snapshot, outPath);
+            fmt::println("Preview written ({:.1f}% done)", job->progress() * 100.0);
         }
     }
 
-    // big spheres
-    auto& sphere1 = scene.emplace<Sphere>(Vec{ 0.0, 1.0, 0.0 }, 1.0);
-    sphere1.setMaterial<Dielectric>(glassRefractionIndex);
+    return result.get();
+}
+
+// serve render jobs from stdin ("-") or a UNIX socket, the options give the defaults of every job
+int runDaemon(const Options& options, const rtr::TracerParam& param)
+{
+    rtr::RenderRequest defaults{
+        .m_scene   = {
+            .m_name      = options.m_scene,
+            .m_seed      = options.m_seed,
+            .m_texture   = options.m_texture,
+            .m_generator = options.m_generator,
+        },
+        .m_param   = param,
+        .m_outFile = {},
+    };
 
-    auto& sphere2 = scene.emplace<Sphere>(Vec{ -4.0, 1.0, 0.0 }, 1.0);
-    sphere2.setMaterial<Lambertian>(Color<>{ 0.4, 0.2, 0.1 });
+    concurrencpp::runtime runtime;
+    rtr::RenderDaemon     daemon{ runtime.thread_pool_executor(), std::move(defaults), options.m_sceneCache };
 
-    auto& sphere3 = scene.emplace<Sphere>(Vec{ 4.0, 1.0, 0.0 }, 1.0);
-    sphere3.setMaterial<Metal>(Color<>{ 0.7, 0.6, 0.5 }, 0.0);
+    try {
+        if (options.m_daemon == "-") {
+            daemon.serveStream(std::cin, std::cout);
+        } else {
+            fmt::println(stderr, "Listening on '{}'", options.m_daemon);
+            daemon.serveSocket(options.m_daemon);
+        }
+    } catch (const std::exception& e) {
+        fmt::println(stderr, "Error: {}", e.what());
+        return 1;
+    }
 
-    return scene;
+    return 0;
 }
 
 int main(int argc, char** argv)
 {
-    std::filesystem::path outFile = formatName("out", "ppm");
-    if (argc > 1) {
-        if (std::filesystem::exists(argv[1])) {
-            fmt::println("File '{}' already exist, will overwrite", argv[1]);
+    Options options;
+    try {
+        options = parseArgs(argc, argv);
+    } catch (const std::exception& e) {
+        fmt::println(stderr, "Error: {}", e.what());
+        fmt::println(
+            stderr,
+            "Usage: {} [--stream] [--band-height <rows>] [--format float32|half|rgbe] [--normals]"
+            " [--background sky|black] [--scene default|lights|generated] [--objects <count>]"
+            " [--distribution uniform|clustered|nested] [--materials <diffuse,metal,glass[,light]>]"
+            " [--seed <n>] [--texture <image>]"
+            " [--texture-cache-mb <size>] [--tile-size <px>] [--tile-order scanline|morton|hilbert]"
+            " [--pixel-order scanline|morton|hilbert]"
+            " [--threads <count>] [--pin] [--preview <seconds>] [--progress bars|json] [--time-budget <seconds>]"
+            " [--cost-maps]"
+            " [--crop <x,y,width,height>] [--patch <image.ppm>] [--first-hits <file>]"
+            " [--daemon <socket>|-] [--scene-cache <count>] [--geometry <file>] [--geometry-budget-mb <size>]"
+            " [--bvh-cache <dir>] [--memory-budget-mb <size>] [output.ppm]",
+            argv[0]
+        );
+        return 1;
+    }
+
+    rtr::TracerParam param{
+        .m_aspectRatio   = 16.0 / 9.0,
+        .m_height        = 1080,
+        .m_samplingRate  = 100,
+        .m_maxDepth      = 25,
+        .m_fov           = 20.0,
+        .m_focusDistance = 10.0,
+        .m_defocusAngle  = 0.6,
+        .m_lookFrom      = { 13.0, 2.0, 3.0 },
+        .m_lookAt        = { 0.0, 0.0, 0.0 },
+        .m_pixelFormat   = options.m_pixelFormat,
+        .m_normalShading = options.m_normals,
+        .m_background    = options.m_background,
+        .m_tileSize      = options.m_tileSize,
+        .m_tileOrder     = options.m_tileOrder,
+        .m_pixelOrder    = options.m_pixelOrder,
+        .m_threads       = options.m_threads,
+        .m_pinThreads    = options.m_pinThreads,
+        .m_timeBudget    = options.m_timeBudget,
+        .m_costMaps      = options.m_costMaps,
+        .m_crop          = options.m_crop,
+    };
+
+    // scenes fail to load once they go over the budget
+    rtr::memory::accounting().setBudget(options.m_memoryBudgetMb * 1024 * 1024);
+
+    if (!options.m_daemon.empty()) {
+        auto status = runDaemon(options, param);
+        printMemoryReport();
+        return status;
+    }
+
+    std::shared_ptr<const rtr::Texture> texture;
+    if (!options.m_texture.empty()) {
+        try {
+            auto cache = std::make_shared<rtr::TileCache>(options.m_textureCacheMb * 1024 * 1024);
+            texture    = std::make_shared<rtr::ImageTexture>(rtr::loadMipPyramid(options.m_texture), cache);
+        } catch (const std::exception& e) {
+            fmt::println(stderr, "Error: {}", e.what());
+            return 1;
         }
+    }
 
-        if (std::filesystem::is_directory(argv[1])) {
-            fmt::println(stderr, "File '{}' is a directory, reverting to default name...", argv[1]);
-        } else {
-            outFile = argv[1];
+    std::optional<rtr::HittableList> world;
+    try {
+        world = rtr::scenes::make(options.m_scene, options.m_seed, std::move(texture), options.m_generator);
+    } catch (const std::exception& e) {
+        fmt::println(stderr, "Error: {}", e.what());
+        return 1;
+    }
+
+    const rtr::ooc::OutOfCoreGeometry* geometry = nullptr;
+    if (!options.m_geometry.empty()) {
+        try {
+            auto budget = options.m_geometryBudgetMb * 1024 * 1024;
+            auto object = std::make_unique<rtr::ooc::OutOfCoreGeometry>(options.m_geometry, budget);
+            geometry    = object.get();
+            world->add(std::move(object));
+        } catch (const std::exception& e) {
+            fmt::println(stderr, "Error: {}", e.what());
+            return 1;
         }
+        fmt::println("Geometry: {} spheres in {} chunks", geometry->numSpheres(), geometry->numChunks());
     }
 
+    // the workers of the render build the BVH first
+    param.m_threadPool = std::make_shared<rtr::ThreadPool>(param.m_threads, param.m_pinThreads);
+
+    try {
+        std::optional<rtr::BvhCache> cache;
+        if (!options.m_bvhCache.empty()) {
+            cache.emplace(options.m_bvhCache);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        world->build(cache ? &*cache : nullptr, param.m_threadPool.get());
+        auto duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - now);
+
+        auto sahCost = rtr::bvh::sahCost(world->bvh().m_nodes);
+        fmt::println("BVH: {:.3f}s to build, SAH cost {:.2f}", duration.count(), sahCost);
+        if (cache) {
+            fmt::println("BVH cache: {} loaded, {} built", cache->hits(), cache->misses());
+        }
+    } catch (const std::exception& e) {
+        fmt::println(stderr, "Error: {}", e.what());
+        return 1;
+    }
+
+    // the camera rays of a replay must be those of the recording, the scene seed fixes them
+    bool recordFirstHits = false;
+    if (!options.m_firstHits.empty()) {
+        param.m_seed      = options.m_seed;
+        param.m_firstHits = std::make_shared<rtr::FirstHits>();
+        recordFirstHits   = !std::filesystem::exists(options.m_firstHits);
+    }
+
+    std::optional<rtr::RayTracer> tracer;
+    try {
+        if (param.m_firstHits) {
+            if (!recordFirstHits) {
+                *param.m_firstHits = rtr::FirstHits::load(options.m_firstHits);
+            }
+            auto action = recordFirstHits ? "recording" : "replaying";
+            fmt::println("First hits: {} '{}'", action, options.m_firstHits.string());
+        }
+
+        auto& rayTracer = tracer.emplace(std::move(*world), param);
+        auto  region    = rayTracer.region();
+
+        // the framebuffer is allocated once the render started, fail before that
+        if (!options.m_stream) {
+            auto pixels = std::size_t(region.m_width) * std::size_t(region.m_height);
+            auto bytes  = pixels * rtr::pixelSize(param.m_pixelFormat);
+            rtr::memory::accounting().checkBudget(rtr::memory::Subsystem::Framebuffer, bytes);
+        }
+
+        // the same for an image that doesn't match the frame
+        if (!options.m_patch.empty()) {
+            auto [frameWidth, frameHeight] = rayTracer.dimension();
+            auto [file, header]            = rtr::openPpm(options.m_patch);
+            if (header.m_width != frameWidth || header.m_height != frameHeight) {
+                throw std::invalid_argument{ fmt::format(
+                    "Can't patch '{}', it's {}x{} and the frame is {}x{}",
+                    options.m_patch.string(),
+                    header.m_width,
+                    header.m_height,
+                    frameWidth,
+                    frameHeight
+                ) };
+            }
+        }
+    } catch (const std::exception& e) {
+        fmt::println(stderr, "Error: {}", e.what());
+        return 1;
+    }
+    auto& rayTracer = *tracer;
+
     concurrencpp::runtime   runtime;
-    rtr::ProgressBarManager progressBar{ runtime };
+    rtr::ProgressBarManager progressBar{ runtime, options.m_progress };
     progressBar.start(*runtime.timer_queue());
 
-    rtr::RayTracer rayTracer{
-        createScene(),
-        {
-            .m_aspectRatio   = 16.0 / 9.0,
-            .m_height        = 1080,
-            .m_samplingRate  = 100,
-            .m_maxDepth      = 25,
-            .m_fov           = 20.0,
-            .m_focusDistance = 10.0,
-            .m_defocusAngle  = 0.6,
-            .m_lookFrom      = { 13.0, 2.0, 3.0 },
-            .m_lookAt        = { 0.0, 0.0, 0.0 },
-        },
-    };
+    using Seconds = std::chrono::duration<double>;
+
+    if (options.m_stream) {
+        if (options.m_costMaps) {
+            fmt::println(stderr, "Cost maps are not recorded when streaming");
+        }
+
+        auto region = rayTracer.region();
+
+        auto           now = std::chrono::steady_clock::now();
+        rtr::PpmWriter writer{ options.m_outFile, region.m_width, region.m_height };
+        rayTracer.stream(progressBar, [&](auto pixels) { writer.write(pixels); }, options.m_bandHeight);
+        auto duration = std::chrono::steady_clock::now() - now;
+
+        auto durationSec = std::chrono::duration_cast<Seconds>(duration);
+        fmt::println("RayTracer takes {:.2f}s to render (streamed)", durationSec.count());
+        printMemoryReport();
+        return recordFirstHits ? saveFirstHits(*param.m_firstHits, options.m_firstHits) : 0;
+    }
+
+    // snapshots go to the output file, which may be the image to patch
+    const bool preview = options.m_preview > 0 && options.m_timeBudget == 0 && !options.m_costMaps
+                      && options.m_patch.empty();
 
     auto       now      = std::chrono::steady_clock::now();
-    rtr::Image image    = rayTracer.run(progressBar);
+    rtr::Image image    = preview
+                            ? renderWithPreview(rayTracer, runtime, Seconds{ options.m_preview }, options.m_outFile)
+                            : rayTracer.run(progressBar);
     auto       duration = std::chrono::steady_clock::now() - now;
 
-    using Seconds    = std::chrono::duration<double>;
     auto durationSec = std::chrono::duration_cast<Seconds>(duration);
 
     fmt::println("RayTracer takes {:.2f}s to render", durationSec.count());
+    fmt::println("Framebuffer: {} ({} bytes)", rtr::toString(image.format()), image.bytes());
+
+    if (geometry != nullptr) {
+        auto& cache = geometry->cache();
+        fmt::println(
+            "Geometry cache: {} hits, {} misses, {} deferred, {} loaded in the background, {} of {} bytes resident",
+            cache.hits(),
+            cache.misses(),
+            cache.deferred(),
+            cache.loads(),
+            cache.bytes(),
+            cache.budget()
+        );
+    }
+
+    printMemoryReport();
+
+    if (options.m_patch.empty()) {
+        generatePpmImage(image, options.m_outFile);
+    } else {
+        auto region = rayTracer.region();
+        rtr::patchPpm(options.m_patch, options.m_outFile, image, region.m_x, region.m_y);
+        fmt::println(
+            "Patched {}x{} pixels at ({}, {}) of '{}'",
+            region.m_width,
+            region.m_height,
+            region.m_x,
+            region.m_y,
+            options.m_patch.string()
+        );
+    }
+
+    if (const auto& maps = rayTracer.costMaps(); maps.has_value()) {
+        writeCostMaps(*maps, options.m_outFile);
+    }
 
-    generatePpmImage(image.m_pixels, image.m_width, image.m_height, outFile);
+    return recordFirstHits ? saveFirstHits(*param.m_firstHits, options.m_firstHits) : 0;
 }
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "rtr/common.hpp"
+#include "rtr/interval.hpp"
+#include "rtr/ray.hpp"
+#include "rtr/vec.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace rtr
+{
+
+    // axis-aligned bounding box, a default constructed box is empty and merging anything into it gives that thing
+    class Aabb
+    {
+    public:
+        Aabb() = default;
+
+        Aabb(const Vec3<double>& a, const Vec3<double>& b)
+            : m_min{ std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()) }
+            , m_max{ std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()) }
+        {
+        }
+
+        static Aabb merge(const Aabb& lhs, const Aabb& rhs)
+        {
+            Aabb box;
+            box.m_min = { std::min(lhs.m_min.x(), rhs.m_min.x()),
+                          std::min(lhs.m_min.y(), rhs.m_min.y()),
+                          std::min(lhs.m_min.z(), rhs.m_min.z()) };
+            box.m_max = { std::max(lhs.m_max.x(), rhs.m_max.x()),
+                          std::max(lhs.m_max.y(), rhs.m_max.y()),
+                          std::max(lhs.m_max.z(), rhs.m_max.z()) };
+            return box;
+        }
+
+        const Vec3<double>& min() const { return m_min; }
+        const Vec3<double>& max() const { return m_max; }
+
+        bool empty() const { return m_min.x() > m_max.x() || m_min.y() > m_max.y() || m_min.z() > m_max.z(); }
+
+        Vec3<double> centroid() const { return 0.5 * (m_min + m_max); }
+        Vec3<double> extent() const { return m_max - m_min; }
+
+        double surfaceArea() const
+        {
+            if (empty()) {
+                return 0.0;
+            }
+            auto e = extent();
+            return 2.0 * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+        }
+
+        std::size_t longestAxis() const
+        {
+            auto e = extent();
+            return e.x() > e.y() ? (e.x() > e.z() ? 0 : 2) : (e.y() > e.z() ? 1 : 2);
+        }
+
+        // Slab test. The sign bits of the ray pick the near and far plane of every axis, so there is no min/max per
+        // axis. A ray parallel to an axis and starting on one of its planes gives 0 * inf = NaN, the argument order of
+        // std::max/min makes such an axis not narrow the range instead of failing the test. A parallel axis of -0.0
+        // has an inverse of -inf, the sign bits (not `< 0`) mark it negative so that its planes stay in order.
+        bool hit(const Ray& ray, Interval<double> tRange) const
+        {
+            const auto& origin = ray.origin();
+            const auto& inv    = ray.invDirection();
+
+            auto tMin = tRange.min();
+            auto tMax = tRange.max();
+            for (std::size_t axis = 0; axis < 3; ++axis) {
+                const auto& near = ray.negative(axis) ? m_max : m_min;
+                const auto& far  = ray.negative(axis) ? m_min : m_max;
+
+                tMin = std::max(tMin, (near[axis] - origin[axis]) * inv[axis]);
+                tMax = std::min(tMax, (far[axis] - origin[axis]) * inv[axis]);
+                if (tMax < tMin) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        Vec3<double> m_min = { +n::infinity, +n::infinity, +n::infinity };
+        Vec3<double> m_max = { -n::infinity, -n::infinity, -n::infinity };
+    };
+
+}
@@ -0,0 +1,644 @@
+#pragma once
+
+#include "rtr/aabb.hpp"
+#include "rtr/interval.hpp"
+#include "rtr/memory.hpp"
+#include "rtr/ray.hpp"
+#include "rtr/thread_pool.hpp"
+#include "rtr/vec.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <functional>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace rtr
+{
+
+    // Node of a binary bounding volume hierarchy stored depth first: the first child of an inner node follows it, the
+    // second one is at m_offset. The primitives of a leaf are m_order[m_offset, m_offset + m_count) of its BvhTree.
+    struct BvhNode
+    {
+        Aabb          m_bounds;
+        std::uint32_t m_offset = 0;
+        std::uint32_t m_count  = 0;    // 0 for inner nodes
+        std::uint8_t  m_axis   = 0;    // split axis of inner nodes, the first child holds the lower centroids
+
+        bool leaf() const { return m_count > 0; }
+    };
+
+    struct BvhTree
+    {
+        std::vector<BvhNode>       m_nodes;    // empty when there are no primitives
+        std::vector<std::uint32_t> m_order;    // primitive indices in leaf order
+    };
+
+    // Read-only hierarchy, built in memory or mapped from a file (see BvhCache). The nodes refer to each other by
+    // index, so the same bytes work wherever they are.
+    struct BvhRef
+    {
+        std::span<const BvhNode>       m_nodes;
+        std::span<const std::uint32_t> m_order;
+        std::shared_ptr<const void>    m_storage;    // keeps the spans alive
+
+        // the tree is charged to the BVH's memory accounting for as long as it's referenced
+        static BvhRef own(BvhTree tree)
+        {
+            struct Owned
+            {
+                BvhTree        m_tree;
+                memory::Charge m_charge{ memory::Subsystem::Bvh };
+            };
+
+            auto storage = std::make_shared<Owned>(std::move(tree));
+            storage->m_charge.add(
+                storage->m_tree.m_nodes.capacity() * sizeof(BvhNode)
+                + storage->m_tree.m_order.capacity() * sizeof(std::uint32_t)
+            );
+            return { storage->m_tree.m_nodes, storage->m_tree.m_order, storage };
+        }
+    };
+
+    namespace bvh
+    {
+        inline constexpr std::size_t s_maxLeafSize = 4;
+        inline constexpr std::size_t s_maxDepth    = 64;
+
+        // cost of a traversal step relative to testing one primitive, the SAH cost model
+        inline constexpr double s_traversalCost = 1.0;
+
+        enum class Split
+        {
+            Sah,       // binned surface area heuristic, the faster trees
+            Median,    // object median along the longest axis, every leaf as full as the leaf size allows
+        };
+
+        struct BuildOptions
+        {
+            std::size_t m_maxLeafSize = s_maxLeafSize;
+            Split       m_split       = Split::Sah;
+            ThreadPool* m_pool        = nullptr;    // large inputs are built with these workers
+        };
+
+        // Expected cost of tracing a ray through the tree: every node is weighted by the chance of a ray through the
+        // root also going through it (ratio of surface areas), leaves cost their primitives, inner nodes a traversal.
+        inline double sahCost(std::span<const BvhNode> nodes)
+        {
+            auto rootArea = nodes.empty() ? 0.0 : nodes.front().m_bounds.surfaceArea();
+            if (rootArea <= 0.0) {
+                return 0.0;
+            }
+
+            double cost = 0.0;
+            for (const auto& node : nodes) {
+                auto weight  = node.m_bounds.surfaceArea() / rootArea;
+                cost        += weight * (node.leaf() ? double(node.m_count) : s_traversalCost);
+            }
+            return cost;
+        }
+
+        namespace detail
+        {
+            inline constexpr std::size_t s_numBins = 16;
+
+            // ranges below this are built by one worker, above it every worker bins and partitions a part of them
+            inline constexpr std::size_t s_parallelGrain = std::size_t{ 1 } << 14;
+
+            // Past this depth the median split takes over, the rest of a subtree is then at most log2(primitives) deep
+            // and the whole tree stays within the traversal stack (s_maxDepth).
+            inline constexpr std::size_t s_sahDepth = 32;
+
+            struct Range
+            {
+                std::size_t m_first;
+                std::size_t m_last;
+                Aabb        m_bounds;
+                Aabb        m_centroids;    // bounds of the primitive centroids
+                std::size_t m_depth;
+
+                std::size_t size() const { return m_last - m_first; }
+            };
+
+            // what a range needs to know about its primitives
+            struct Bounds
+            {
+                Aabb m_boxes;
+                Aabb m_centroids;
+
+                void add(const Aabb& box, const Vec3<double>& centroid)
+                {
+                    m_boxes     = Aabb::merge(m_boxes, box);
+                    m_centroids = Aabb::merge(m_centroids, { centroid, centroid });
+                }
+
+                void add(const Bounds& other)
+                {
+                    m_boxes     = Aabb::merge(m_boxes, other.m_boxes);
+                    m_centroids = Aabb::merge(m_centroids, other.m_centroids);
+                }
+            };
+
+            struct Bin
+            {
+                Aabb        m_bounds;
+                std::size_t m_count = 0;
+
+                void add(const Aabb& box)
+                {
+                    m_bounds = Aabb::merge(m_bounds, box);
+                    ++m_count;
+                }
+
+                void add(const Bin& other)
+                {
+                    m_bounds  = Aabb::merge(m_bounds, other.m_bounds);
+                    m_count  += other.m_count;
+                }
+            };
+
+            using Bins = std::array<Bin, s_numBins>;
+
+            // Maps centroids to equally spaced bins along the longest axis of the centroid bounds of a range. Binning
+            // the other axes too gives slightly better trees for three times the work.
+            struct Binning
+            {
+                std::size_t m_axis;
+                double      m_min;
+                double      m_scale;    // 0 when all centroids are the same, nothing to split then
+
+                explicit Binning(const Aabb& centroids)
+                    : m_axis{ centroids.longestAxis() }
+                    , m_min{ centroids.min()[m_axis] }
+                {
+                    auto extent = centroids.extent()[m_axis];
+                    m_scale     = extent > 0.0 ? double(s_numBins) / extent : 0.0;
+                }
+
+                std::size_t binOf(const Vec3<double>& centroid) const
+                {
+                    auto bin = std::size_t((centroid[m_axis] - m_min) * m_scale);
+                    return std::min(bin, s_numBins - 1);
+                }
+            };
+
+            struct SplitPlan
+            {
+                std::size_t m_axis;
+                std::size_t m_bin;    // first bin of the right side
+                double      m_cost;
+                std::size_t m_numLeft;
+            };
+
+            class Builder
+            {
+            public:
+                Builder(std::span<const Aabb> boxes, const BuildOptions& options)
+                    : m_boxes{ boxes }
+                    , m_maxLeafSize{ std::max(options.m_maxLeafSize, std::size_t{ 1 }) }
+                    , m_split{ options.m_split }
+                    , m_pool{ options.m_pool != nullptr && options.m_pool->size() > 1 ? options.m_pool : nullptr }
+                    , m_centroids(boxes.size())
+                    , m_order(boxes.size())
+                    , m_scratch(boxes.size())
+                {
+                    std::iota(m_order.begin(), m_order.end(), 0u);
+                }
+
+                BvhTree build()
+                {
+                    BvhTree tree;
+                    if (m_boxes.empty()) {
+                        return tree;
+                    }
+
+                    // the parallel phase needs enough work for every worker, a split needs three passes over a range
+                    if (!m_pool || m_split != Split::Sah || m_boxes.size() < 4 * s_parallelGrain) {
+                        for (std::size_t i = 0; i < m_boxes.size(); ++i) {
+                            m_centroids[i] = m_boxes[i].centroid();
+                        }
+                        tree.m_nodes.reserve(2 * m_boxes.size() / m_maxLeafSize + 1);
+                        emit(rangeOf(0, m_boxes.size(), 0), tree.m_nodes);
+                        tree.m_order = std::move(m_order);
+                        return tree;
+                    }
+
+                    return buildParallel();
+                }
+
+            private:
+                // marks a child of the top of the tree as a subtree built by a single worker
+                static constexpr std::uint32_t s_subtree = std::uint32_t{ 1 } << 31;
+
+                struct TopNode
+                {
+                    BvhNode                      m_node;
+                    std::array<std::uint32_t, 2> m_children;
+                };
+
+                // The ranges too large for one worker are split with all of them (parallel binning, partitioning and
+                // reductions), the ranges below that become tasks for the workers. The pieces are stitched into the
+                // depth first layout at the end.
+                BvhTree buildParallel()
+                {
+                    const auto numWorkers = std::size_t(m_pool->size());
+                    m_grain               = std::max(s_parallelGrain, m_boxes.size() / (4 * numWorkers));
+
+                    m_pool->parallel([&](int worker) {
+                        forSlice(worker, [&](std::size_t i) { m_centroids[i] = m_boxes[i].centroid(); });
+                    });
+
+                    std::vector<Bounds> partials(numWorkers);
+                    m_pool->parallel([&](int worker) {
+                        auto& partial = partials[std::size_t(worker)];
+                        forSlice(worker, [&](std::size_t i) { partial.add(m_boxes[i], m_centroids[i]); });
+                    });
+                    Bounds root;
+                    for (const auto& partial : partials) {
+                        root.add(partial);
+                    }
+
+                    auto rootRef = place({ 0, m_boxes.size(), root.m_boxes, root.m_centroids, 0 });
+
+                    // largest first, so that the last ones to finish are small
+                    std::vector<std::size_t> taskOrder(m_subtrees.size());
+                    std::iota(taskOrder.begin(), taskOrder.end(), std::size_t{ 0 });
+                    rr::sort(taskOrder, std::greater{}, [&](auto task) { return m_subtrees[task].size(); });
+
+                    std::vector<std::vector<BvhNode>> built(m_subtrees.size());
+                    std::atomic<std::size_t>          next = 0;
+                    m_pool->parallel([&](int) {
+                        for (auto i = next.fetch_add(1); i < taskOrder.size(); i = next.fetch_add(1)) {
+                            auto task = taskOrder[i];
+                            built[task].reserve(2 * m_subtrees[task].size() / m_maxLeafSize + 1);
+                            emit(m_subtrees[task], built[task]);
+                        }
+                    });
+
+                    BvhTree tree;
+                    tree.m_nodes.reserve(2 * m_boxes.size() / m_maxLeafSize + 1);
+                    stitch(rootRef, built, tree.m_nodes);
+                    tree.m_order = std::move(m_order);
+                    return tree;
+                }
+
+                std::uint32_t place(const Range& range)
+                {
+                    std::optional<SplitPlan> plan;
+                    if (range.size() > m_grain && range.m_depth < s_sahDepth) {
+                        Binning binning{ range.m_centroids };
+                        plan = findSplit(range, binning, binParallel(range, binning));
+                    }
+                    if (!plan.has_value()) {
+                        m_subtrees.push_back(range);
+                        return std::uint32_t(m_subtrees.size() - 1) | s_subtree;
+                    }
+
+                    auto [left, right] = partitionParallel(range, *plan);
+
+                    auto index = std::uint32_t(m_top.size());
+                    m_top.push_back({ { range.m_bounds, 0, 0, std::uint8_t(plan->m_axis) }, {} });
+
+                    auto first  = place(left);
+                    auto second = place(right);
+
+                    m_top[index].m_children = { first, second };
+                    return index;
+                }
+
+                std::uint32_t stitch(
+                    std::uint32_t ref, std::span<const std::vector<BvhNode>> built, std::vector<BvhNode>& nodes
+                ) const
+                {
+                    auto index = std::uint32_t(nodes.size());
+
+                    if ((ref & s_subtree) != 0) {
+                        for (auto node : built[ref & ~s_subtree]) {
+                            if (!node.leaf()) {
+                                node.m_offset += index;
+                            }
+                            nodes.push_back(node);
+                        }
+                        return index;
+                    }
+
+                    const auto& top = m_top[ref];
+                    nodes.push_back(top.m_node);
+                    stitch(top.m_children[0], built, nodes);
+                    nodes[index].m_offset = stitch(top.m_children[1], built, nodes);
+                    return index;
+                }
+
+                // Builds a range depth first into `nodes`, second children are indices into `nodes`. Workers call it on
+                // disjoint ranges, each with a vector of its own.
+                std::uint32_t emit(const Range& range, std::vector<BvhNode>& nodes)
+                {
+                    auto index = std::uint32_t(nodes.size());
+                    nodes.emplace_back();
+
+                    auto leaf = [&] {
+                        nodes[index] = { range.m_bounds, std::uint32_t(range.m_first), std::uint32_t(range.size()), 0 };
+                        return index;
+                    };
+
+                    if (range.size() == 1) {
+                        return leaf();
+                    }
+
+                    std::optional<SplitPlan> plan;
+                    if (m_split == Split::Sah && range.m_depth < s_sahDepth) {
+                        Binning binning{ range.m_centroids };
+                        plan = findSplit(range, binning, binSerial(range, binning));
+                    }
+
+                    std::pair<Range, Range> children;
+                    std::size_t             axis = 0;
+                    if (plan.has_value()) {
+                        if (range.size() <= m_maxLeafSize && double(range.size()) <= plan->m_cost) {
+                            return leaf();
+                        }
+                        children = partitionSerial(range, *plan);
+                        axis     = plan->m_axis;
+                    } else {
+                        if (range.size() <= m_maxLeafSize) {
+                            return leaf();
+                        }
+                        axis     = range.m_centroids.longestAxis();
+                        children = medianSplit(range, axis);
+                    }
+
+                    emit(children.first, nodes);
+                    auto second = emit(children.second, nodes);
+
+                    nodes[index] = { range.m_bounds, second, 0, std::uint8_t(axis) };
+                    return index;
+                }
+
+                Range rangeOf(std::size_t first, std::size_t last, std::size_t depth) const
+                {
+                    Bounds bounds;
+                    for (auto i : std::span{ m_order }.subspan(first, last - first)) {
+                        bounds.add(m_boxes[i], m_centroids[i]);
+                    }
+                    return { first, last, bounds.m_boxes, bounds.m_centroids, depth };
+                }
+
+                // the cheapest boundary between bins with primitives on both sides
+                static std::optional<SplitPlan> findSplit(const Range& range, const Binning& binning, const Bins& bins)
+                {
+                    auto area = range.m_bounds.surfaceArea();
+                    if (area <= 0.0 || binning.m_scale == 0.0) {
+                        return {};
+                    }
+
+                    std::array<double, s_numBins> rightCosts{};    // area * count of the bins from here to the end
+                    Bin                           right;
+                    for (auto bin = s_numBins - 1; bin > 0; --bin) {
+                        right.add(bins[bin]);
+                        rightCosts[bin] = right.m_count > 0 ? right.m_bounds.surfaceArea() * double(right.m_count)
+                                                            : 0.0;
+                    }
+
+                    std::optional<SplitPlan> best;
+                    Bin                      left;
+                    auto                     numRight = right.m_count + bins[0].m_count;
+                    for (std::size_t bin = 1; bin < s_numBins; ++bin) {
+                        left.add(bins[bin - 1]);
+                        numRight -= bins[bin - 1].m_count;
+                        if (left.m_count == 0 || numRight == 0) {
+                            continue;
+                        }
+
+                        auto cost = s_traversalCost
+                                  + (left.m_bounds.surfaceArea() * double(left.m_count) + rightCosts[bin]) / area;
+                        if (!best.has_value() || cost < best->m_cost) {
+                            best = SplitPlan{ binning.m_axis, bin, cost, left.m_count };
+                        }
+                    }
+                    return best;
+                }
+
+                Bins binSerial(const Range& range, const Binning& binning) const
+                {
+                    Bins bins;
+                    for (auto i : std::span{ m_order }.subspan(range.m_first, range.size())) {
+                        bins[binning.binOf(m_centroids[i])].add(m_boxes[i]);
+                    }
+                    return bins;
+                }
+
+                Bins binParallel(const Range& range, const Binning& binning)
+                {
+                    std::vector<Bins> partials(std::size_t(m_pool->size()));
+                    m_pool->parallel([&](int worker) {
+                        auto& bins = partials[std::size_t(worker)];
+                        forSlice(range, worker, [&](std::size_t i) {
+                            bins[binning.binOf(m_centroids[i])].add(m_boxes[i]);
+                        });
+                    });
+
+                    Bins bins;
+                    for (const auto& partial : partials) {
+                        for (std::size_t bin = 0; bin < s_numBins; ++bin) {
+                            bins[bin].add(partial[bin]);
+                        }
+                    }
+                    return bins;
+                }
+
+                // Both partitions are stable, so the tree doesn't depend on the number of workers (nor do the files of
+                // BvhCache). The primitives go through m_scratch, the ranges of concurrent calls don't overlap.
+                std::pair<Range, Range> partitionSerial(const Range& range, const SplitPlan& plan)
+                {
+                    Binning binning{ range.m_centroids };
+                    auto    left  = range.m_first;
+                    auto    right = range.m_first + plan.m_numLeft;
+
+                    std::array<Bounds, 2> bounds;
+                    for (auto i : std::span{ m_order }.subspan(range.m_first, range.size())) {
+                        auto isLeft = binning.binOf(m_centroids[i]) < plan.m_bin;
+                        bounds[isLeft ? 0 : 1].add(m_boxes[i], m_centroids[i]);
+                        m_scratch[isLeft ? left++ : right++] = i;
+                    }
+                    copyBack(range.m_first, range.m_last);
+
+                    return childrenOf(range, plan, bounds);
+                }
+
+                std::pair<Range, Range> partitionParallel(const Range& range, const SplitPlan& plan)
+                {
+                    Binning    binning{ range.m_centroids };
+                    const auto isLeft = [&](std::uint32_t i) {
+                        return binning.binOf(m_centroids[i]) < plan.m_bin;
+                    };
+
+                    const auto               numWorkers = std::size_t(m_pool->size());
+                    std::vector<std::size_t> leftCounts(numWorkers);
+                    m_pool->parallel([&](int worker) {
+                        auto& count = leftCounts[std::size_t(worker)];
+                        forSlice(range, worker, [&](std::size_t i) { count += isLeft(std::uint32_t(i)); });
+                    });
+
+                    // every worker scatters its slice behind the ones of the workers before it
+                    std::vector<std::size_t> leftStarts(numWorkers);
+                    std::vector<std::size_t> rightStarts(numWorkers);
+                    auto                     leftStart  = range.m_first;
+                    auto                     rightStart = range.m_first + plan.m_numLeft;
+                    for (std::size_t worker = 0; worker < numWorkers; ++worker) {
+                        auto [first, last]   = slice(range.m_first, range.m_last, worker);
+                        leftStarts[worker]   = leftStart;
+                        rightStarts[worker]  = rightStart;
+                        leftStart           += leftCounts[worker];
+                        rightStart          += (last - first) - leftCounts[worker];
+                    }
+
+                    std::vector<std::array<Bounds, 2>> partials(numWorkers);
+                    m_pool->parallel([&](int worker) {
+                        auto& bounds = partials[std::size_t(worker)];
+                        auto  left   = leftStarts[std::size_t(worker)];
+                        auto  right  = rightStarts[std::size_t(worker)];
+                        forSlice(range, worker, [&](std::size_t i) {
+                            auto toLeft = isLeft(std::uint32_t(i));
+                            bounds[toLeft ? 0 : 1].add(m_boxes[i], m_centroids[i]);
+                            m_scratch[toLeft ? left++ : right++] = std::uint32_t(i);
+                        });
+                    });
+                    m_pool->parallel([&](int worker) {
+                        auto [first, last] = slice(range.m_first, range.m_last, std::size_t(worker));
+                        copyBack(first, last);
+                    });
+
+                    std::array<Bounds, 2> bounds;
+                    for (const auto& partial : partials) {
+                        bounds[0].add(partial[0]);
+                        bounds[1].add(partial[1]);
+                    }
+                    return childrenOf(range, plan, bounds);
+                }
+
+                void copyBack(std::size_t first, std::size_t last)
+                {
+                    rr::copy(std::span{ m_scratch }.subspan(first, last - first), m_order.begin() + long(first));
+                }
+
+                static std::pair<Range, Range> childrenOf(
+                    const Range& range, const SplitPlan& plan, const std::array<Bounds, 2>& bounds
+                )
+                {
+                    auto mid   = range.m_first + plan.m_numLeft;
+                    auto depth = range.m_depth + 1;
+                    return {
+                        { range.m_first, mid, bounds[0].m_boxes, bounds[0].m_centroids, depth },
+                        { mid, range.m_last, bounds[1].m_boxes, bounds[1].m_centroids, depth },
+                    };
+                }
+
+                std::pair<Range, Range> medianSplit(const Range& range, std::size_t axis)
+                {
+                    auto begin = m_order.begin();
+                    auto mid   = range.m_first + range.size() / 2;
+                    auto depth = range.m_depth + 1;
+                    std::nth_element(
+                        begin + long(range.m_first),
+                        begin + long(mid),
+                        begin + long(range.m_last),
+                        [&](auto lhs, auto rhs) { return m_centroids[lhs][axis] < m_centroids[rhs][axis]; }
+                    );
+                    return { rangeOf(range.m_first, mid, depth), rangeOf(mid, range.m_last, depth) };
+                }
+
+                // the part of [first, last) that a worker handles
+                std::pair<std::size_t, std::size_t> slice(std::size_t first, std::size_t last, std::size_t worker) const
+                {
+                    auto numWorkers = std::size_t(m_pool->size());
+                    auto size       = last - first;
+                    return { first + size * worker / numWorkers, first + size * (worker + 1) / numWorkers };
+                }
+
+                // `fn(primitive)` for the primitives in a worker's slice of a range or of all of them
+                template <typename Fn>
+                void forSlice(const Range& range, int worker, Fn&& fn) const
+                {
+                    auto [first, last] = slice(range.m_first, range.m_last, std::size_t(worker));
+                    for (auto i : std::span{ m_order }.subspan(first, last - first)) {
+                        fn(std::size_t(i));
+                    }
+                }
+
+                template <typename Fn>
+                void forSlice(int worker, Fn&& fn) const
+                {
+                    auto [first, last] = slice(0, m_boxes.size(), std::size_t(worker));
+                    for (auto i = first; i < last; ++i) {
+                        fn(i);
+                    }
+                }
+
+                std::span<const Aabb>      m_boxes;
+                std::size_t                m_maxLeafSize;
+                Split                      m_split;
+                ThreadPool*                m_pool;
+                std::size_t                m_grain = 0;
+                std::vector<Vec3<double>>  m_centroids;
+                std::vector<std::uint32_t> m_order;
+                std::vector<std::uint32_t> m_scratch;
+                std::vector<TopNode>       m_top;
+                std::vector<Range>         m_subtrees;
+            };
+        }
+
+        // Build a hierarchy over the boxes of some primitives, leaves hold at most `maxLeafSize` of them. With a pool,
+        // large inputs are built in parallel; the result is the same whatever the number of workers.
+        inline BvhTree build(std::span<const Aabb> boxes, const BuildOptions& options = {})
+        {
+            return detail::Builder{ boxes, options }.build();
+        }
+
+        // Visit the leaves whose bounds the ray crosses within [tMin, tMax], the nearer child first. `leaf(node, tMax)`
+        // may lower tMax to prune the rest of the tree (closest hit) and returns true to stop right away (any hit).
+        // Returns whether it was stopped.
+        template <typename Leaf>
+        bool traverse(std::span<const BvhNode> nodes, const Ray& ray, double tMin, double& tMax, Leaf&& leaf)
+        {
+            if (nodes.empty()) {
+                return false;
+            }
+
+            std::array<std::uint32_t, s_maxDepth> stack;
+            std::size_t                           top     = 0;
+            std::uint32_t                         current = 0;
+
+            while (true) {
+                const auto& node = nodes[current];
+                if (node.m_bounds.hit(ray, { tMin, tMax })) {
+                    if (!node.leaf()) {
+                        auto first  = current + 1;
+                        auto second = node.m_offset;
+                        if (ray.negative(node.m_axis)) {
+                            std::swap(first, second);
+                        }
+                        stack[top++] = second;
+                        current      = first;
+                        continue;
+                    }
+                    if (leaf(node, tMax)) {
+                        return true;
+                    }
+                }
+
+                if (top == 0) {
+                    return false;
+                }
+                current = stack[--top];
+            }
+        }
+    }
+
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "rtr/aabb.hpp"
+#include "rtr/bvh.hpp"
+#include "rtr/mapped_file.hpp"
+#include "rtr/util.hpp"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#if defined(__unix__)
+    #include <unistd.h>
+#endif
+
+namespace rtr
+{
+
+    // Built hierarchies stored in a directory, one file per hierarchy named after the hash of the boxes it was built
+    // over. A file is the nodes and the primitive order exactly as they are in memory, so loading it is mapping it.
+    // The header tags the layout of BvhNode on the build that wrote it (vector storage depends on the instruction
+    // set, see simd.hpp); a file with another tag is rebuilt and overwritten.
+    class BvhCache
+    {
+    public:
+        static constexpr std::size_t s_defaultMinPrimitives = 4096;    // building smaller lists is faster than a file
+
+        explicit BvhCache(std::filesystem::path directory, std::size_t minPrimitives = s_defaultMinPrimitives)
+            : m_directory{ std::move(directory) }
+            , m_minPrimitives{ minPrimitives }
+        {
+            std::filesystem::create_directories(m_directory);
+        }
+
+        // the hierarchy of bvh::build(boxes, options), loaded if it was stored before
+        BvhRef get(std::span<const Aabb> boxes, const bvh::BuildOptions& options = {})
+        {
+            if (boxes.size() < m_minPrimitives) {
+                return BvhRef::own(bvh::build(boxes, options));
+            }
+
+            auto key  = keyOf(boxes, options);
+            auto path = m_directory / fmt::format("{:016x}.bvh", key);
+            if (auto loaded = load(path, key, boxes.size()); loaded.has_value()) {
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return std::move(*loaded);
+            }
+
+            auto tree = bvh::build(boxes, options);
+            store(path, key, tree);
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+            return BvhRef::own(std::move(tree));
+        }
+
+        const std::filesystem::path& directory() const { return m_directory; }
+        std::size_t                  hits() const { return m_hits.load(std::memory_order_relaxed); }
+        std::size_t                  misses() const { return m_misses.load(std::memory_order_relaxed); }
+
+    private:
+        static_assert(std::is_trivially_copyable_v<BvhNode>);
+
+        struct Header
+        {
+            std::array<char, 8>  m_magic;
+            std::uint32_t        m_version;
+            std::uint32_t        m_byteOrder;    // s_byteOrder as written
+            std::array<char, 16> m_isa;
+            std::uint32_t        m_nodeSize;
+            std::uint32_t        m_nodeAlignment;
+            std::uint64_t        m_key;
+            std::uint64_t        m_numPrimitives;
+            std::uint64_t        m_numNodes;
+            std::uint64_t        m_fileSize;
+        };
+
+        static_assert(std::has_unique_object_representations_v<Header>);    // no padding, compared with memcmp
+
+        static constexpr std::array<char, 8> s_magic     = { 'R', 'T', 'R', 'B', 'V', 'H', '\0', '\0' };
+        static constexpr std::uint32_t       s_version   = 2;    // part of the key, bump it when bvh::build changes
+        static constexpr std::uint32_t       s_byteOrder = 0x0102'0304;
+
+        // past the header, aligned for the nodes (the mapping itself starts on a page)
+        static constexpr std::size_t s_nodesOffset = (sizeof(Header) + 63) / 64 * 64;
+        static_assert(s_nodesOffset % alignof(BvhNode) == 0);
+
+        static constexpr std::array<char, 16> isaTag()
+        {
+#if defined(__AVX__)
+            return { 'a', 'v', 'x' };
+#elif defined(__SSE2__)
+            return { 's', 's', 'e', '2' };
+#else
+            return { 'g', 'e', 'n', 'e', 'r', 'i', 'c' };
+#endif
+        }
+
+        static Header headerOf(std::uint64_t key, std::size_t numPrimitives, std::size_t numNodes)
+        {
+            return {
+                .m_magic         = s_magic,
+                .m_version       = s_version,
+                .m_byteOrder     = s_byteOrder,
+                .m_isa           = isaTag(),
+                .m_nodeSize      = std::uint32_t(sizeof(BvhNode)),
+                .m_nodeAlignment = std::uint32_t(alignof(BvhNode)),
+                .m_key           = key,
+                .m_numPrimitives = numPrimitives,
+                .m_numNodes      = numNodes,
+                .m_fileSize      = s_nodesOffset + numNodes * sizeof(BvhNode) + numPrimitives * sizeof(std::uint32_t),
+            };
+        }
+
+        // the workers don't change the result, see bvh::build
+        static std::uint64_t keyOf(std::span<const Aabb> boxes, const bvh::BuildOptions& options)
+        {
+            auto settings = fmt::format("{}\n{}\n{}\n", s_version, options.m_maxLeafSize, int(options.m_split));
+            auto hash     = util::hashBytes(settings);
+            for (const auto& box : boxes) {
+                const std::array<double, 6> bounds{
+                    box.min().x(), box.min().y(), box.min().z(), box.max().x(), box.max().y(), box.max().z(),
+                };
+                hash = util::hashBytes({ reinterpret_cast<const char*>(bounds.data()), sizeof(bounds) }, hash);
+            }
+            return hash;
+        }
+
+        // a file that is missing, stale or damaged is not an error, the hierarchy is built again
+        static std::optional<BvhRef> load(
+            const std::filesystem::path& path, std::uint64_t key, std::size_t numPrimitives
+        )
+        {
+            if (!std::filesystem::exists(path)) {
+                return {};
+            }
+
+            std::shared_ptr<const MappedFile> file;
+            try {
+                file = std::make_shared<const MappedFile>(path);
+            } catch (const std::exception&) {
+                return {};
+            }
+
+            auto   bytes = file->bytes();
+            Header header{};
+            if (bytes.size() < sizeof(Header)) {
+                return {};
+            }
+            std::memcpy(&header, bytes.data(), sizeof(Header));
+
+            if (header.m_numNodes > bytes.size() / sizeof(BvhNode)) {
+                return {};
+            }
+            auto expected = headerOf(key, numPrimitives, header.m_numNodes);
+            if (std::memcmp(&header, &expected, sizeof(Header)) != 0 || header.m_fileSize != bytes.size()) {
+                return {};
+            }
+
+            const auto* nodeData  = reinterpret_cast<const BvhNode*>(bytes.data() + s_nodesOffset);
+            const auto* orderData = reinterpret_cast<const std::uint32_t*>(nodeData + header.m_numNodes);
+
+            BvhRef ref{ { nodeData, header.m_numNodes }, { orderData, numPrimitives }, file };
+            if (!valid(ref)) {
+                return {};
+            }
+            return ref;
+        }
+
+        // traversal trusts the indices, check them once
+        static bool valid(const BvhRef& ref)
+        {
+            const auto numNodes = ref.m_nodes.size();
+            for (std::size_t i = 0; i < numNodes; ++i) {
+                const auto& node = ref.m_nodes[i];
+                auto        ok   = node.leaf() ? std::size_t(node.m_offset) + node.m_count <= ref.m_order.size()
+                                               : node.m_offset > i + 1 && node.m_offset < numNodes && node.m_axis < 3;
+                if (!ok) {
+                    return false;
+                }
+            }
+            for (auto index : ref.m_order) {
+                if (index >= ref.m_order.size()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Written to a temporary file renamed into place, a concurrent reader sees the old file or the whole new one.
+        // The cache is only an optimization, a failure is reported and the render goes on.
+        static void store(const std::filesystem::path& path, std::uint64_t key, const BvhTree& tree)
+        {
+            auto temporary  = path;
+            temporary      += fmt::format(".{}-{}.tmp", processId(), s_nextTemporary.fetch_add(1));
+
+            try {
+                {
+                    std::ofstream out{ temporary, std::ios::binary | std::ios::trunc };
+
+                    auto header = headerOf(key, tree.m_order.size(), tree.m_nodes.size());
+
+                    std::array<char, s_nodesOffset> head{};
+                    std::memcpy(head.data(), &header, sizeof(Header));
+                    out.write(head.data(), std::streamsize(head.size()));
+                    out.write(
+                        reinterpret_cast<const char*>(tree.m_nodes.data()),
+                        std::streamsize(tree.m_nodes.size() * sizeof(BvhNode))
+                    );
+                    out.write(
+                        reinterpret_cast<const char*>(tree.m_order.data()),
+                        std::streamsize(tree.m_order.size() * sizeof(std::uint32_t))
+                    );
+
+                    if (!out.good()) {
+                        throw std::runtime_error{ fmt::format("Problem writing file '{}'", temporary.string()) };
+                    }
+                }
+                std::filesystem::rename(temporary, path);
+            } catch (const std::exception& e) {
+                fmt::println(stderr, "Warning: BVH not cached: {}", e.what());
+                std::error_code ignored;
+                std::filesystem::remove(temporary, ignored);
+            }
+        }
+
+        static long processId()
+        {
+#if defined(__unix__)
+            return long(::getpid());
+#else
+            return 0;
+#endif
+        }
+
+        static inline std::atomic<std::uint64_t> s_nextTemporary = 0;
+
+        std::filesystem::path    m_directory;
+        std::size_t              m_minPrimitives;
+        std::atomic<std::size_t> m_hits   = 0;
+        std::atomic<std::size_t> m_misses = 0;
+    };
+
+}
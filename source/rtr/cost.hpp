@@ -0,0 +1,175 @@
+#pragma once
+
+#include "rtr/color.hpp"
+#include "rtr/image.hpp"
+#include "rtr/memory.hpp"
+#include "rtr/util.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Diagnostics of where a render spends its time. The calling thread counts the work it does as it goes, the tracer
+// reads the difference around every pixel into cost maps (see TracerParam::m_costMaps) which are written out as
+// false color images next to the beauty image.
+namespace rtr::cost
+{
+    struct Counters
+    {
+        std::uint64_t m_rays     = 0;    // path segments and shadow rays
+        std::uint64_t m_segments = 0;    // path segments only, one per bounce plus the camera ray
+        std::uint64_t m_tests    = 0;    // ray-object intersection tests in the leaves of the BVHs
+    };
+
+    inline Counters& counters()
+    {
+        thread_local Counters threadCounters;
+        return threadCounters;
+    }
+
+    enum class Metric
+    {
+        Time,     // seconds spent on the pixel
+        Rays,     // rays traced for the pixel
+        Tests,    // intersection tests for the pixel
+        Depth,    // average number of path segments per sample
+    };
+
+    inline constexpr std::array s_metrics = { Metric::Time, Metric::Rays, Metric::Tests, Metric::Depth };
+
+    inline std::string_view toString(Metric metric)
+    {
+        switch (metric) {
+        case Metric::Time: return "time";
+        case Metric::Rays: return "rays";
+        case Metric::Tests: return "tests";
+        case Metric::Depth: return "depth";
+        }
+        return "unknown";
+    }
+
+    // Perceptually ordered map from black through purple and orange to pale yellow (close to matplotlib's inferno)
+    // of t in [0, 1], in linear space.
+    inline Color<double> falseColor(double t)
+    {
+        // gamma encoded
+        static constexpr std::array<std::array<double, 3>, 5> stops = { {
+            { 0.000, 0.000, 0.015 },
+            { 0.341, 0.063, 0.431 },
+            { 0.737, 0.216, 0.329 },
+            { 0.976, 0.557, 0.035 },
+            { 0.988, 1.000, 0.643 },
+        } };
+
+        auto position = std::clamp(t, 0.0, 1.0) * double(stops.size() - 1);
+        auto index    = std::min(std::size_t(position), stops.size() - 2);
+        auto fraction = position - double(index);
+
+        Color<double> color;
+        for (std::size_t c = 0; c < 3; ++c) {
+            auto gamma = stops[index][c] + fraction * (stops[index + 1][c] - stops[index][c]);
+            color[c]   = util::gammaToLinear(gamma);
+        }
+        return color;
+    }
+
+    // Cost of every pixel of a render, accumulated over the passes that rendered it.
+    class CostMaps
+    {
+    public:
+        CostMaps(int width, int height)
+            : m_width{ width }
+            , m_height{ height }
+        {
+            for (auto& values : m_values) {
+                values.assign(std::size_t(width) * std::size_t(height), 0.0f);
+            }
+            m_samples.assign(std::size_t(width) * std::size_t(height), 0.0f);
+        }
+
+        int width() const { return m_width; }
+        int height() const { return m_height; }
+
+        // `work` is what the counters went up by while taking `samples` samples of the pixel
+        void record(int col, int row, double seconds, const Counters& work, int samples)
+        {
+            auto idx = index(col, row);
+
+            m_values[std::size_t(Metric::Time)][idx]  += float(seconds);
+            m_values[std::size_t(Metric::Rays)][idx]  += float(work.m_rays);
+            m_values[std::size_t(Metric::Tests)][idx] += float(work.m_tests);
+            m_values[std::size_t(Metric::Depth)][idx] += float(work.m_segments);
+            m_samples[idx]                            += float(samples);
+        }
+
+        double at(Metric metric, int col, int row) const
+        {
+            auto idx   = index(col, row);
+            auto value = double(m_values[std::size_t(metric)][idx]);
+            if (metric == Metric::Depth) {
+                return m_samples[idx] > 0.0f ? value / double(m_samples[idx]) : 0.0;
+            }
+            return value;
+        }
+
+        // sum over the pixels, the mean for the depth
+        double total(Metric metric) const
+        {
+            double sum = 0.0;
+            for (int row = 0; row < m_height; ++row) {
+                for (int col = 0; col < m_width; ++col) {
+                    sum += at(metric, col, row);
+                }
+            }
+            return metric == Metric::Depth ? sum / std::max(double(m_samples.size()), 1.0) : sum;
+        }
+
+        // value that a fraction `q` of the pixels doesn't exceed
+        double percentile(Metric metric, double q) const
+        {
+            std::vector<double> values;
+            values.reserve(m_samples.size());
+            for (int row = 0; row < m_height; ++row) {
+                for (int col = 0; col < m_width; ++col) {
+                    values.push_back(at(metric, col, row));
+                }
+            }
+            if (values.empty()) {
+                return 0.0;
+            }
+
+            auto nth = values.begin() + std::ptrdiff_t(std::clamp(q, 0.0, 1.0) * double(values.size() - 1));
+            std::nth_element(values.begin(), nth, values.end());
+            return *nth;
+        }
+
+        // False color image of a metric from 0 to `maxValue`, larger values saturate. The 99th percentile makes a
+        // good maximum, the few pixels above it would otherwise squeeze every other one into the dark end.
+        Image heatmap(Metric metric, double maxValue) const
+        {
+            Image image{ m_width, m_height };
+            for (int row = 0; row < m_height; ++row) {
+                for (int col = 0; col < m_width; ++col) {
+                    auto value = at(metric, col, row);
+                    image.set(col, row, falseColor(maxValue > 0.0 ? value / maxValue : 0.0));
+                }
+            }
+            return image;
+        }
+
+    private:
+        using Values = std::vector<float, memory::Allocator<float, memory::Subsystem::Framebuffer>>;
+
+        std::size_t index(int col, int row) const { return std::size_t(row) * std::size_t(m_width) + std::size_t(col); }
+
+        int                                  m_width;
+        int                                  m_height;
+        std::array<Values, s_metrics.size()> m_values;
+        Values                               m_samples;
+    };
+
+}
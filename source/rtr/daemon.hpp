@@ -0,0 +1,491 @@
+#pragma once
+
+#include "rtr/image.hpp"
+#include "rtr/ppm.hpp"
+#include "rtr/ray_tracer.hpp"
+#include "rtr/scene.hpp"
+#include "rtr/scenes.hpp"
+#include "rtr/texture.hpp"
+#include "rtr/texture_io.hpp"
+#include "rtr/traversal.hpp"
+#include "rtr/util.hpp"
+
+#include <concurrencpp/concurrencpp.h>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__)
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+namespace rtr
+{
+
+    // what to build a scene from
+    struct SceneRef
+    {
+        std::string            m_name = "default";
+        std::uint64_t          m_seed = 0;
+        std::filesystem::path  m_texture;
+        scenes::GeneratorParam m_generator;    // "generated" only
+
+        // hash of everything the built scene depends on, the texture by its contents rather than its path
+        std::uint64_t contentHash() const
+        {
+            auto hash = util::hashBytes(fmt::format("{}\n{}\n", m_name, m_seed));
+            if (m_name == "generated") {
+                const auto& [count, distribution, mix] = m_generator;
+
+                auto generator = fmt::format(
+                    "{}\n{}\n{},{},{},{}\n",
+                    count,
+                    scenes::toString(distribution),
+                    mix.m_diffuse,
+                    mix.m_metal,
+                    mix.m_glass,
+                    mix.m_light
+                );
+                hash = util::hashBytes(generator, hash);
+            }
+            if (!m_texture.empty()) {
+                std::ifstream file{ m_texture, std::ios::binary };
+                if (!file.good()) {
+                    throw std::runtime_error{ fmt::format("Problem opening texture '{}'", m_texture.string()) };
+                }
+                std::string contents{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+                hash = util::hashBytes(contents, hash);
+            }
+            return hash;
+        }
+    };
+
+    // Built scenes kept alive between jobs, keyed by SceneRef::contentHash() and evicted least recently used first.
+    // Textures of all the scenes share one tile cache.
+    class SceneCache
+    {
+    public:
+        struct Entry
+        {
+            std::shared_ptr<const Scene> m_scene;
+            std::uint64_t                m_hash;
+            bool                         m_cached;    // false: built by this call
+        };
+
+        explicit SceneCache(std::size_t capacity = 8, std::size_t textureBudget = TileCache::s_defaultBudget)
+            : m_capacity{ std::max(capacity, std::size_t{ 1 }) }
+            , m_tileCache{ std::make_shared<TileCache>(textureBudget) }
+        {
+        }
+
+        Entry get(const SceneRef& ref)
+        {
+            auto hash = ref.contentHash();
+
+            // A scene is built outside of the lock so that jobs for other scenes go on meanwhile. Its entry holds the
+            // build's future from the start, a job asking for a scene being built waits for it instead of building it
+            // a second time.
+            std::promise<std::shared_ptr<const Scene>> build;
+            std::optional<Future>                      cached;
+            {
+                std::scoped_lock lock{ m_mutex };
+                if (auto found = m_index.find(hash); found != m_index.end()) {
+                    m_lru.splice(m_lru.begin(), m_lru, found->second);
+                    cached = found->second->second;
+                } else {
+                    m_lru.emplace_front(hash, build.get_future().share());
+                    m_index.emplace(hash, m_lru.begin());
+                    if (m_lru.size() > m_capacity) {
+                        m_index.erase(m_lru.back().first);
+                        m_lru.pop_back();
+                    }
+                }
+            }
+
+            if (cached.has_value()) {
+                return { cached->get(), hash, true };
+            }
+
+            try {
+                std::shared_ptr<const Texture> texture;
+                if (!ref.m_texture.empty()) {
+                    texture = std::make_shared<ImageTexture>(loadMipPyramid(ref.m_texture), m_tileCache);
+                }
+                auto scene = std::make_shared<const Scene>(
+                    scenes::make(ref.m_name, ref.m_seed, std::move(texture), ref.m_generator)
+                );
+
+                build.set_value(scene);
+                return { std::move(scene), hash, false };
+            } catch (...) {
+                // the waiting jobs fail as well, the next one asking for the scene tries again
+                {
+                    std::scoped_lock lock{ m_mutex };
+                    if (auto found = m_index.find(hash); found != m_index.end() && !ready(found->second->second)) {
+                        m_lru.erase(found->second);
+                        m_index.erase(found);
+                    }
+                }
+                build.set_exception(std::current_exception());
+                throw;
+            }
+        }
+
+        std::size_t size()
+        {
+            std::scoped_lock lock{ m_mutex };
+            return m_lru.size();
+        }
+
+    private:
+        using Future = std::shared_future<std::shared_ptr<const Scene>>;
+        using Item   = std::pair<std::uint64_t, Future>;
+
+        static bool ready(const Future& future)
+        {
+            return future.wait_for(std::chrono::seconds{ 0 }) == std::future_status::ready;
+        }
+
+        std::mutex                                                   m_mutex;
+        std::list<Item>                                              m_lru;
+        std::unordered_map<std::uint64_t, std::list<Item>::iterator> m_index;
+        std::size_t                                                  m_capacity;
+        std::shared_ptr<TileCache>                                   m_tileCache;
+    };
+
+    struct RenderRequest
+    {
+        SceneRef              m_scene;
+        TracerParam           m_param;
+        std::filesystem::path m_outFile;
+    };
+
+    // Parse a job line of space separated key=value pairs on top of `defaults`, e.g.
+    //     out=frame_001.ppm scene=default seed=7 from=13,2,3 at=0,0,0 spp=32
+    inline RenderRequest parseRenderRequest(std::string_view line, RenderRequest defaults)
+    {
+        const auto toVec = [](const std::string& value) {
+            Vec3<double> vec;
+            if (std::sscanf(value.c_str(), "%lf,%lf,%lf", &vec.x(), &vec.y(), &vec.z()) != 3) {
+                throw std::invalid_argument{ fmt::format("Expected x,y,z but got '{}'", value) };
+            }
+            return vec;
+        };
+        const auto toOrder = [](const std::string& value) {
+            auto order = parseTraversalOrder(value);
+            if (!order.has_value()) {
+                throw std::invalid_argument{ fmt::format("Unknown traversal order '{}'", value) };
+            }
+            return *order;
+        };
+
+        auto  request = std::move(defaults);
+        auto& param   = request.m_param;
+
+        for (auto token : line | rv::split(' ')) {
+            std::string_view field{ token.begin(), token.end() };
+            if (field.empty()) {
+                continue;
+            }
+
+            auto equal = field.find('=');
+            if (equal == std::string_view::npos) {
+                throw std::invalid_argument{ fmt::format("Expected key=value but got '{}'", field) };
+            }
+
+            auto        key = field.substr(0, equal);
+            std::string value{ field.substr(equal + 1) };
+
+            if (key == "out") {
+                request.m_outFile = value;
+            } else if (key == "scene") {
+                if (!scenes::exists(value)) {
+                    throw std::invalid_argument{ fmt::format("Unknown scene '{}'", value) };
+                }
+                request.m_scene.m_name = value;
+            } else if (key == "seed") {
+                request.m_scene.m_seed = std::stoull(value);
+            } else if (key == "texture") {
+                request.m_scene.m_texture = value;
+            } else if (key == "objects") {
+                request.m_scene.m_generator.m_count = std::size_t(std::max(0.0, std::stod(value)));
+            } else if (key == "distribution") {
+                auto distribution = scenes::parseDistribution(value);
+                if (!distribution.has_value()) {
+                    throw std::invalid_argument{ fmt::format("Unknown distribution '{}'", value) };
+                }
+                request.m_scene.m_generator.m_distribution = *distribution;
+            } else if (key == "materials") {
+                request.m_scene.m_generator.m_materials = scenes::parseMaterialMix(value);
+            } else if (key == "height") {
+                param.m_height = std::max(1, std::stoi(value));
+            } else if (key == "spp") {
+                param.m_samplingRate = std::max(1, std::stoi(value));
+            } else if (key == "depth") {
+                param.m_maxDepth = std::max(1, std::stoi(value));
+            } else if (key == "fov") {
+                param.m_fov = std::stod(value);
+            } else if (key == "focus") {
+                param.m_focusDistance = std::stod(value);
+            } else if (key == "defocus") {
+                param.m_defocusAngle = std::stod(value);
+            } else if (key == "from") {
+                param.m_lookFrom = toVec(value);
+            } else if (key == "at") {
+                param.m_lookAt = toVec(value);
+            } else if (key == "format") {
+                auto format = parsePixelFormat(value);
+                if (!format.has_value()) {
+                    throw std::invalid_argument{ fmt::format("Unknown pixel format '{}'", value) };
+                }
+                param.m_pixelFormat = *format;
+            } else if (key == "background") {
+                if (value != "sky" && value != "black") {
+                    throw std::invalid_argument{ fmt::format("Unknown background '{}'", value) };
+                }
+                param.m_background = value == "sky" ? Background::Sky : Background::Black;
+            } else if (key == "normals") {
+                param.m_normalShading = value == "1" || value == "true";
+            } else if (key == "tile-size") {
+                param.m_tileSize = std::max(1, std::stoi(value));
+            } else if (key == "tile-order") {
+                param.m_tileOrder = toOrder(value);
+            } else if (key == "pixel-order") {
+                param.m_pixelOrder = toOrder(value);
+            } else {
+                throw std::invalid_argument{ fmt::format("Unknown key '{}'", key) };
+            }
+        }
+
+        if (request.m_outFile.empty()) {
+            throw std::invalid_argument{ "Missing out=<path>" };
+        }
+        return request;
+    }
+
+    // Long running render server. Jobs are read one per line (see parseRenderRequest), built scenes stay in a cache
+    // between jobs and every render runs on the same executor, where concurrent jobs share the workers fairly.
+    //
+    // Replies, one line each:
+    //     queued <id> scene=<hash> cached|built
+    //     done <id> <output path> <seconds>s
+    //     error <id> <message>
+    class RenderDaemon
+    {
+    public:
+        using ReadLine = std::function<std::optional<std::string>()>;
+        using Reply    = std::function<void(std::string_view)>;
+
+        RenderDaemon(
+            std::shared_ptr<concurrencpp::executor> executor, RenderRequest defaults, std::size_t sceneCapacity
+        )
+            : m_executor{ std::move(executor) }
+            , m_defaults{ std::move(defaults) }
+            , m_scenes{ sceneCapacity }
+        {
+        }
+
+        // Serve jobs until the input ends or a "quit" line, then wait for the jobs of this input to finish. A
+        // "shutdown" line also stops serveSocket() from accepting new connections.
+        void serve(const ReadLine& readLine, const Reply& reply)
+        {
+            auto replyMutex  = std::make_shared<std::mutex>();
+            auto lockedReply = [replyMutex, reply](std::string_view line) {
+                std::scoped_lock lock{ *replyMutex };
+                reply(line);
+            };
+
+            std::vector<concurrencpp::result<void>> jobs;
+
+            while (auto line = readLine()) {
+                auto first = line->find_first_not_of(" \t\r");
+                auto last  = line->find_last_not_of(" \t\r");
+                auto job   = first == std::string::npos ? std::string_view{}
+                                                        : std::string_view{ *line }.substr(first, last - first + 1);
+
+                if (job.empty() || job.starts_with('#')) {
+                    continue;
+                }
+                if (job == "quit") {
+                    break;
+                }
+                if (job == "shutdown") {
+                    m_shutdown = true;
+                    break;
+                }
+
+                auto id = m_nextId.fetch_add(1, std::memory_order_relaxed);
+                try {
+                    auto request = parseRenderRequest(job, m_defaults);
+                    auto scene   = m_scenes.get(request.m_scene);
+                    auto origin  = scene.m_cached ? "cached" : "built";
+                    lockedReply(fmt::format("queued {} scene={:016x} {}", id, scene.m_hash, origin));
+
+                    jobs.push_back(runJob(id, std::move(request), std::move(scene.m_scene), lockedReply));
+                } catch (const std::exception& e) {
+                    lockedReply(fmt::format("error {} {}", id, e.what()));
+                }
+
+                std::erase_if(jobs, [](auto& result) { return result.status() != concurrencpp::result_status::idle; });
+            }
+
+            for (auto& result : jobs) {
+                result.wait();
+            }
+        }
+
+        void serveStream(std::istream& input, std::ostream& output)
+        {
+            serve(
+                [&]() -> std::optional<std::string> {
+                    std::string line;
+                    if (!std::getline(input, line)) {
+                        return {};
+                    }
+                    return line;
+                },
+                [&](std::string_view line) { output << line << std::endl; }
+            );
+        }
+
+        // listen on a UNIX domain socket, every connection is served on its own thread
+        void serveSocket(const std::filesystem::path& path)
+        {
+#if defined(__unix__)
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (path.string().size() >= sizeof(address.sun_path)) {
+                throw std::invalid_argument{ fmt::format("Socket path '{}' is too long", path.string()) };
+            }
+            std::ranges::copy(path.string(), address.sun_path);
+
+            int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listener < 0) {
+                throw std::runtime_error{ "Problem creating the socket" };
+            }
+
+            std::filesystem::remove(path);
+            if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+                || ::listen(listener, 16) != 0) {
+                ::close(listener);
+                throw std::runtime_error{ fmt::format("Problem listening on '{}'", path.string()) };
+            }
+
+            // a connection's thread is joined on the next accept after it ended, or at the end
+            struct Connection
+            {
+                std::atomic<bool> m_done = false;
+                std::jthread      m_thread;
+            };
+
+            std::list<Connection> connections;
+            while (!m_shutdown) {
+                int connection = ::accept(listener, nullptr, nullptr);
+                if (connection < 0) {
+                    break;
+                }
+
+                std::erase_if(connections, [](const Connection& entry) { return entry.m_done.load(); });
+
+                auto& entry    = connections.emplace_back();
+                entry.m_thread = std::jthread{ [this, connection, listener, &done = entry.m_done] {
+                    serve(FdLineReader{ connection }, [connection](std::string_view line) {
+                        auto text = fmt::format("{}\n", line);
+                        [[maybe_unused]] auto written = ::write(connection, text.data(), text.size());
+                    });
+                    ::close(connection);
+
+                    if (m_shutdown) {
+                        ::shutdown(listener, SHUT_RDWR);    // wakes up accept()
+                    }
+                    done = true;
+                } };
+            }
+
+            connections.clear();
+            ::close(listener);
+            std::filesystem::remove(path);
+#else
+            throw std::runtime_error{ fmt::format("UNIX domain sockets are not supported here ('{}')", path.string()) };
+#endif
+        }
+
+    private:
+#if defined(__unix__)
+        struct FdLineReader
+        {
+            int         m_fd;
+            std::string m_buffer = {};
+
+            std::optional<std::string> operator()()
+            {
+                while (true) {
+                    if (auto newline = m_buffer.find('\n'); newline != std::string::npos) {
+                        auto line = m_buffer.substr(0, newline);
+                        m_buffer.erase(0, newline + 1);
+                        return line;
+                    }
+
+                    char buffer[4096];
+                    auto count = ::read(m_fd, buffer, sizeof(buffer));
+                    if (count <= 0) {
+                        return m_buffer.empty() ? std::nullopt : std::optional{ std::exchange(m_buffer, {}) };
+                    }
+                    m_buffer.append(buffer, std::size_t(count));
+                }
+            }
+        };
+#endif
+
+        concurrencpp::result<void> runJob(
+            std::size_t                  id,
+            RenderRequest                request,
+            std::shared_ptr<const Scene> scene,
+            Reply                        reply
+        )
+        {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                RayTracer tracer{ std::move(scene), request.m_param };
+                auto      image = co_await tracer.submit(m_executor);
+
+                PpmWriter writer{ request.m_outFile, image.width(), image.height() };
+                writer.write(image);
+
+                auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                reply(fmt::format("done {} {} {:.3f}s", id, request.m_outFile.string(), seconds));
+            } catch (const std::exception& e) {
+                reply(fmt::format("error {} {}", id, e.what()));
+            }
+        }
+
+        std::shared_ptr<concurrencpp::executor> m_executor;
+        RenderRequest                           m_defaults;
+        SceneCache                              m_scenes;
+        std::atomic<std::size_t>                m_nextId   = 0;
+        std::atomic<bool>                       m_shutdown = false;
+    };
+
+}
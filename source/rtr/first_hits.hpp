@@ -0,0 +1,198 @@
+#pragma once
+
+#include "rtr/hittable.hpp"
+#include "rtr/memory.hpp"
+#include "rtr/util.hpp"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace rtr
+{
+
+    // The objects a camera ray can hit (what HitResult::m_object points to), numbered depth first through the nested
+    // lists. The numbers only depend on how the world was put together, not on where it lives in memory, so they
+    // name the same objects in a world built again with other materials.
+    class ObjectTable
+    {
+    public:
+        ObjectTable() = default;
+
+        explicit ObjectTable(const HittableList& world) { addFrom(world); }
+
+        std::size_t     size() const { return m_objects.size(); }
+        const Hittable& at(std::uint32_t index) const { return *m_objects[index]; }
+
+        std::optional<std::uint32_t> indexOf(const Hittable* object) const
+        {
+            if (auto found = m_indices.find(object); found != m_indices.end()) {
+                return found->second;
+            }
+            return std::nullopt;
+        }
+
+        // hash of the bounds of every object in order, changes with the geometry but not with the materials
+        std::uint64_t geometryHash() const
+        {
+            auto hash = util::hashBytes(fmt::format("{}\n", m_objects.size()));
+            for (const auto* object : m_objects) {
+                auto                        box = object->boundingBox();
+                const std::array<double, 6> bounds{
+                    box.min().x(), box.min().y(), box.min().z(), box.max().x(), box.max().y(), box.max().z(),
+                };
+                hash = util::hashBytes({ reinterpret_cast<const char*>(bounds.data()), sizeof(bounds) }, hash);
+            }
+            return hash;
+        }
+
+    private:
+        void addFrom(const HittableList& list)
+        {
+            for (const auto& object : list.objects()) {
+                if (const auto* nested = dynamic_cast<const HittableList*>(object.get()); nested != nullptr) {
+                    addFrom(*nested);
+                } else {
+                    m_indices.emplace(object.get(), std::uint32_t(m_objects.size()));
+                    m_objects.push_back(object.get());
+                }
+            }
+        }
+
+        std::vector<const Hittable*>                       m_objects;
+        std::unordered_map<const Hittable*, std::uint32_t> m_indices;
+    };
+
+    // The object hit by the camera ray of every sample of a render, for rendering the same view again after changing
+    // materials only (see TracerParam::m_firstHits). With a fixed seed a sample gets the same camera ray in both
+    // renders, so the second one intersects it with that single object instead of the whole scene. Only the object
+    // is kept: the hit record is computed again from it, with the texture coordinates a new material may need, and
+    // a sample costs 4 bytes.
+    class FirstHits
+    {
+    public:
+        static constexpr std::uint32_t s_miss   = UINT32_MAX;        // the camera ray left the scene
+        static constexpr std::uint32_t s_traced = UINT32_MAX - 1;    // not recorded, traced as usual
+
+        FirstHits() = default;
+
+        bool          empty() const { return m_objects.empty(); }
+        std::size_t   size() const { return m_objects.size(); }
+        std::uint64_t key() const { return m_key; }
+
+        // room for the samples of a width x height region, none recorded yet
+        void reset(std::uint64_t key, int width, int height, int samplesPerPixel)
+        {
+            m_key             = key;
+            m_width           = width;
+            m_samplesPerPixel = samplesPerPixel;
+            m_objects.assign(std::size_t(width) * std::size_t(height) * std::size_t(samplesPerPixel), s_traced);
+        }
+
+        // the samples of a pixel of the region
+        std::span<std::uint32_t> pixel(int col, int row)
+        {
+            auto first = (std::size_t(row) * std::size_t(m_width) + std::size_t(col)) * std::size_t(m_samplesPerPixel);
+            return { m_objects.data() + first, std::size_t(m_samplesPerPixel) };
+        }
+
+        void save(const std::filesystem::path& path) const
+        {
+            std::ofstream out{ path, std::ios::binary | std::ios::trunc };
+
+            auto header = headerOf(m_key, m_width, m_samplesPerPixel, m_objects.size());
+            out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+            out.write(
+                reinterpret_cast<const char*>(m_objects.data()),
+                std::streamsize(m_objects.size() * sizeof(std::uint32_t))
+            );
+
+            if (!out.good()) {
+                throw std::runtime_error{ fmt::format("Problem writing file '{}'", path.string()) };
+            }
+        }
+
+        static FirstHits load(const std::filesystem::path& path)
+        {
+            std::ifstream in{ path, std::ios::binary };
+            if (!in.good()) {
+                throw std::runtime_error{ fmt::format("Problem opening file '{}'", path.string()) };
+            }
+
+            Header header{};
+            in.read(reinterpret_cast<char*>(&header), sizeof(Header));
+
+            auto expected = headerOf(header.m_key, header.m_width, header.m_samplesPerPixel, header.m_numSamples);
+            if (!in.good() || std::memcmp(&header, &expected, sizeof(Header)) != 0) {
+                throw std::runtime_error{ fmt::format("'{}' is not a first hits file of this build", path.string()) };
+            }
+            if (std::filesystem::file_size(path) != sizeof(Header) + header.m_numSamples * sizeof(std::uint32_t)) {
+                throw std::runtime_error{ fmt::format("'{}' is truncated or too long", path.string()) };
+            }
+
+            FirstHits hits;
+            hits.m_key             = header.m_key;
+            hits.m_width           = header.m_width;
+            hits.m_samplesPerPixel = header.m_samplesPerPixel;
+            hits.m_objects.resize(header.m_numSamples);
+            in.read(
+                reinterpret_cast<char*>(hits.m_objects.data()),
+                std::streamsize(header.m_numSamples * sizeof(std::uint32_t))
+            );
+
+            if (!in.good()) {
+                throw std::runtime_error{ fmt::format("Problem reading file '{}'", path.string()) };
+            }
+            return hits;
+        }
+
+    private:
+        struct Header
+        {
+            std::array<char, 8> m_magic;
+            std::uint32_t       m_version;
+            std::uint32_t       m_byteOrder;    // s_byteOrder as written
+            std::uint64_t       m_key;
+            std::int32_t        m_width;
+            std::int32_t        m_samplesPerPixel;
+            std::uint64_t       m_numSamples;
+        };
+
+        static_assert(std::has_unique_object_representations_v<Header>);    // no padding, compared with memcmp
+
+        static constexpr std::array<char, 8> s_magic     = { 'R', 'T', 'R', 'H', 'I', 'T', 'S', '\0' };
+        static constexpr std::uint32_t       s_version   = 1;
+        static constexpr std::uint32_t       s_byteOrder = 0x0102'0304;
+
+        static Header headerOf(std::uint64_t key, int width, int samplesPerPixel, std::size_t numSamples)
+        {
+            return {
+                .m_magic           = s_magic,
+                .m_version         = s_version,
+                .m_byteOrder       = s_byteOrder,
+                .m_key             = key,
+                .m_width           = width,
+                .m_samplesPerPixel = samplesPerPixel,
+                .m_numSamples      = numSamples,
+            };
+        }
+
+        using Objects = std::vector<std::uint32_t, memory::Allocator<std::uint32_t, memory::Subsystem::Framebuffer>>;
+
+        std::uint64_t m_key             = 0;
+        int           m_width           = 0;
+        int           m_samplesPerPixel = 0;
+        Objects       m_objects;
+    };
+
+}
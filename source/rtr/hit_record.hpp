@@ -11,6 +11,14 @@ namespace rtr
     {
         Ray           m_ray;
         Color<double> m_attenuation;
+        double        m_pdf = 0.0;    // solid angle pdf of the scattered direction, 0 for specular (delta) scattering
+    };
+
+    // bsdf * cos(theta) toward a given direction, together with the pdf of scatter() picking that direction
+    struct BsdfEval
+    {
+        Color<double> m_value;
+        double        m_pdf;
     };
 
     struct HitRecord
@@ -19,6 +27,9 @@ namespace rtr
         Vec3<double> m_normal;
         double       m_t;
         bool         m_frontFace;
+        double       m_u           = 0.0;    // surface (texture) coordinates, only filled in for textured materials
+        double       m_v           = 0.0;
+        double       m_uvFootprint = 0.0;    // width of the ray cone at the hit point in uv units
 
         static HitRecord from(const Ray& ray, const Vec3<double>& outNormal, Vec3<double> point, double t)
         {
@@ -35,11 +46,19 @@ namespace rtr
     };
 
     class Material;
+    class Hittable;
+
+    struct LightSample
+    {
+        Vec3<double> m_direction;    // unit vector
+        double       m_pdf;          // solid angle
+    };
 
     struct HitResult
     {
         HitRecord       m_record;
         const Material* m_material;
+        const Hittable* m_object;
     };
 
 }
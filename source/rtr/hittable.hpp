@@ -1,11 +1,22 @@
 #pragma once
 
+#include "rtr/aabb.hpp"
+#include "rtr/bvh.hpp"
+#include "rtr/bvh_cache.hpp"
+#include "rtr/cost.hpp"
 #include "rtr/interval.hpp"
 #include "rtr/material.hpp"
+#include "rtr/memory.hpp"
 #include "rtr/ray.hpp"
 #include "rtr/hit_record.hpp"
+#include "rtr/wide_bvh.hpp"
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <span>
+#include <vector>
 
 namespace rtr
 {
@@ -16,6 +27,7 @@ namespace rtr
         Hittable()
             : m_material{ std::make_unique<Lambertian>(Color<>{ 0.1, 0.1, 0.11 }) }
         {
+            m_materialCharge.add(sizeof(Lambertian));
         }
 
         Hittable(Hittable&&)                 = default;
@@ -26,11 +38,22 @@ namespace rtr
 
         virtual std::optional<HitResult> hit(const Ray& ray, Interval<double> tRange) const = 0;
 
+        // any-hit query for visibility rays: returns at the first hit inside tRange, no HitRecord is built
+        virtual bool occluded(const Ray& ray, Interval<double> tRange) const = 0;
+
+        virtual Aabb boundingBox() const = 0;
+
+        // Light sampling, used for objects with an emissive material. `sampleToward` picks a direction from `origin`
+        // toward this object, `pdfToward` is the solid angle pdf of it choosing a direction that hits this object.
+        virtual std::optional<LightSample> sampleToward(const Vec3<double>& /* origin */) const { return {}; }
+        virtual double                     pdfToward(const Vec3<double>& /* origin */) const { return 0.0; }
+
         template <std::derived_from<Material> T, typename... Args>
             requires std::constructible_from<T, Args...>
         Material& setMaterial(Args&&... args)
         {
             m_material = std::make_unique<T>(std::forward<Args>(args)...);
+            m_materialCharge.reset(sizeof(T));
             return *m_material;
         }
 
@@ -38,15 +61,25 @@ namespace rtr
 
     protected:
         std::unique_ptr<Material> m_material = nullptr;
+        memory::Charge            m_materialCharge{ memory::Subsystem::Materials };    // size of the material's type
     };
 
+    // A list of objects, itself an object so that lists can be nested. Once built, a list has a BVH over its children
+    // and a nested list is a single child with a BVH of its own: the top level of the scene holds the objects and
+    // sub-scenes, the bottom levels hold what's inside them. Changing a list drops its BVH, building the outer list
+    // again keeps the ones of nested lists that weren't changed. An unbuilt list is scanned linearly.
+    //
+    // Rays go through the wide version of the BVH (see WideBvhNode), the binary one is what the cache stores.
     class HittableList : public Hittable
     {
     public:
         HittableList() = default;
 
-        Hittable& add(std::unique_ptr<Hittable> object)
+        template <std::derived_from<Hittable> T>
+        Hittable& add(std::unique_ptr<T> object)
         {
+            invalidate();
+            m_objectCharge.add(sizeof(T) + sizeof(object));
             m_objects.push_back(std::move(object));
             return *m_objects.back();
         }
@@ -55,29 +88,134 @@ namespace rtr
             requires std::constructible_from<T, Args...>
         Hittable& emplace(Args&&... args)
         {
+            invalidate();
+            m_objectCharge.add(sizeof(T) + sizeof(std::unique_ptr<T>));
             m_objects.push_back(std::make_unique<T>(std::forward<Args>(args)...));
             return *m_objects.back();
         }
 
-        void clear() { m_objects.clear(); }
+        void clear()
+        {
+            invalidate();
+            m_objects.clear();
+            m_objectCharge.reset(0);
+        }
+
+        std::span<const std::unique_ptr<Hittable>> objects() const { return m_objects; }
+        const BvhRef&                              bvh() const { return m_tree; }
+
+        // Build the BVH of this list and of the nested lists that don't have one yet. Call it again after moving a
+        // child, only this level is rebuilt then. With a cache, large lists load their BVH from it when their
+        // geometry didn't change since it was stored. With a pool, large lists are built on its workers.
+        void build(BvhCache* cache = nullptr, ThreadPool* pool = nullptr)
+        {
+            std::vector<Aabb> boxes;
+            boxes.reserve(m_objects.size());
+            for (auto& object : m_objects) {
+                if (auto* nested = dynamic_cast<HittableList*>(object.get()); nested != nullptr && !nested->built()) {
+                    nested->build(cache, pool);
+                }
+                boxes.push_back(object->boundingBox());
+            }
+
+            const bvh::BuildOptions options{ .m_pool = pool };
+
+            m_tree  = cache != nullptr ? cache->get(boxes, options) : BvhRef::own(bvh::build(boxes, options));
+            m_wide  = bvh::widen<bvh::s_width>(m_tree.m_nodes);
+            m_built = true;
+            m_bvhCharge.reset(m_wide.capacity() * sizeof(m_wide[0]));
+        }
+
+        bool built() const { return m_built; }
 
         std::optional<HitResult> hit(const Ray& ray, Interval<double> tRange) const override
         {
             std::optional<HitResult> currentHit{};
 
-            double tClosest = tRange.max();
-            for (const auto& object : m_objects) {
-                if (auto hit = object->hit(ray, { tRange.min(), tClosest }); hit.has_value()) {
+            double     tClosest = tRange.max();
+            const auto hitAny   = [&](const Hittable& object) {
+                if (auto hit = object.hit(ray, { tRange.min(), tClosest }); hit.has_value()) {
                     tClosest   = hit->m_record.m_t;
                     currentHit = std::move(hit);
                 }
+            };
+
+            auto& work = cost::counters();
+            if (!m_built) {
+                work.m_tests += m_objects.size();
+                for (const auto& object : m_objects) {
+                    hitAny(*object);
+                }
+                return currentHit;
             }
 
+            bvh::traverse(wideNodes(), ray, tRange.min(), tClosest, [&](auto first, auto count, double&) {
+                work.m_tests += count;
+                for (auto index : leafObjects(first, count)) {
+                    hitAny(*m_objects[index]);
+                }
+                return false;
+            });
+
             return currentHit;
         }
 
+        bool occluded(const Ray& ray, Interval<double> tRange) const override
+        {
+            auto& work = cost::counters();
+            if (!m_built) {
+                return rr::any_of(m_objects, [&](const auto& object) {
+                    ++work.m_tests;
+                    return object->occluded(ray, tRange);
+                });
+            }
+
+            const auto occludedBy = [&](std::uint32_t index) {
+                ++work.m_tests;
+                return m_objects[index]->occluded(ray, tRange);
+            };
+
+            auto tMax = tRange.max();
+            return bvh::traverse(wideNodes(), ray, tRange.min(), tMax, [&](auto first, auto count, double&) {
+                return rr::any_of(leafObjects(first, count), occludedBy);
+            });
+        }
+
+        Aabb boundingBox() const override
+        {
+            if (m_built) {
+                return m_tree.m_nodes.empty() ? Aabb{} : m_tree.m_nodes.front().m_bounds;
+            }
+
+            Aabb box;
+            for (const auto& object : m_objects) {
+                box = Aabb::merge(box, object->boundingBox());
+            }
+            return box;
+        }
+
     private:
+        std::span<const WideBvhNode<bvh::s_width>> wideNodes() const { return m_wide; }
+
+        std::span<const std::uint32_t> leafObjects(std::uint32_t first, std::uint32_t count) const
+        {
+            return m_tree.m_order.subspan(first, count);
+        }
+
+        void invalidate()
+        {
+            m_tree  = {};
+            m_wide  = {};
+            m_built = false;
+            m_bvhCharge.reset(0);
+        }
+
         std::vector<std::unique_ptr<Hittable>> m_objects;
+        BvhRef                                 m_tree;
+        std::vector<WideBvhNode<bvh::s_width>> m_wide;
+        bool                                   m_built = false;
+        memory::Charge                         m_objectCharge{ memory::Subsystem::Objects };    // the children
+        memory::Charge                         m_bvhCharge{ memory::Subsystem::Bvh };           // the wide nodes
     };
 
 }
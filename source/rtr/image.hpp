@@ -0,0 +1,333 @@
+#pragma once
+
+#include "rtr/color.hpp"
+#include "rtr/memory.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace rtr
+{
+
+    enum class PixelFormat
+    {
+        Float32,    // 12 bytes per pixel
+        Half,       //  6 bytes per pixel
+        Rgbe,       //  4 bytes per pixel, shared exponent
+    };
+
+    // clang-format off
+    template <typename T>
+    concept Pixel = std::regular<T> && requires(const T pixel, const Color<double>& color) {
+        { T::encode(color) } -> std::same_as<T>;
+        { pixel.decode() }   -> std::same_as<Color<double>>;
+    };
+    // clang-format on
+
+    struct PixelF32
+    {
+        float m_r;
+        float m_g;
+        float m_b;
+
+        static PixelF32 encode(const Color<double>& color)
+        {
+            return { float(color.x()), float(color.y()), float(color.z()) };
+        }
+
+        Color<double> decode() const { return { double(m_r), double(m_g), double(m_b) }; }
+
+        bool operator==(const PixelF32&) const = default;
+    };
+
+    struct PixelHalf
+    {
+        std::uint16_t m_r;
+        std::uint16_t m_g;
+        std::uint16_t m_b;
+
+        static PixelHalf encode(const Color<double>& color)
+        {
+            return { toHalf(float(color.x())), toHalf(float(color.y())), toHalf(float(color.z())) };
+        }
+
+        Color<double> decode() const { return { fromHalf(m_r), fromHalf(m_g), fromHalf(m_b) }; }
+
+        bool operator==(const PixelHalf&) const = default;
+
+        // IEEE 754 binary16, round to nearest even
+        static std::uint16_t toHalf(float value)
+        {
+            const auto bits = std::bit_cast<std::uint32_t>(value);
+            const auto sign = std::uint16_t((bits >> 16) & 0x8000);
+            const auto exp  = int((bits >> 23) & 0xff) - 127 + 15;
+            auto       mant = bits & 0x7f'ffff;
+
+            if (exp >= 0x1f) {
+                // overflow, inf or nan
+                bool isNan = ((bits >> 23) & 0xff) == 0xff && mant != 0;
+                return std::uint16_t(sign | 0x7c00 | (isNan ? 0x200 : 0));
+            }
+
+            if (exp <= 0) {
+                if (exp < -10) {
+                    return sign;    // too small, flush to signed zero
+                }
+                // subnormal half
+                mant              |= 0x80'0000;
+                const auto shift   = std::uint32_t(14 - exp);
+                auto       half    = mant >> shift;
+                const auto rest    = mant & ((1u << shift) - 1);
+                const auto halfway = 1u << (shift - 1);
+                if (rest > halfway || (rest == halfway && (half & 1))) {
+                    ++half;
+                }
+                return std::uint16_t(sign | half);
+            }
+
+            auto       half = std::uint32_t(exp << 10) | (mant >> 13);
+            const auto rest = mant & 0x1fff;
+            if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+                ++half;    // may carry into the exponent, which is the correct rounding behavior
+            }
+            return std::uint16_t(sign | half);
+        }
+
+        static double fromHalf(std::uint16_t half)
+        {
+            const auto sign = (half & 0x8000) ? -1.0 : 1.0;
+            const auto exp  = (half >> 10) & 0x1f;
+            const auto mant = half & 0x3ff;
+
+            if (exp == 0) {
+                return sign * std::ldexp(double(mant), -24);
+            }
+            if (exp == 0x1f) {
+                return mant == 0 ? sign * n::infinity : std::numeric_limits<double>::quiet_NaN();
+            }
+            return sign * std::ldexp(double(mant | 0x400), exp - 25);
+        }
+    };
+
+    // Greg Ward's shared-exponent format, as used by the Radiance .hdr files
+    struct PixelRgbe
+    {
+        std::uint8_t m_r;
+        std::uint8_t m_g;
+        std::uint8_t m_b;
+        std::uint8_t m_e;
+
+        static PixelRgbe encode(const Color<double>& color)
+        {
+            const auto max = std::max({ color.x(), color.y(), color.z() });
+            if (max < 1e-32) {
+                return { 0, 0, 0, 0 };
+            }
+
+            int        exp   = 0;
+            const auto scale = std::frexp(max, &exp) * 256.0 / max;
+            return {
+                std::uint8_t(std::max(color.x(), 0.0) * scale),
+                std::uint8_t(std::max(color.y(), 0.0) * scale),
+                std::uint8_t(std::max(color.z(), 0.0) * scale),
+                std::uint8_t(exp + 128),
+            };
+        }
+
+        Color<double> decode() const
+        {
+            if (m_e == 0) {
+                return { 0.0, 0.0, 0.0 };
+            }
+
+            const auto scale = std::ldexp(1.0, int(m_e) - (128 + 8));
+            return { (m_r + 0.5) * scale, (m_g + 0.5) * scale, (m_b + 0.5) * scale };
+        }
+
+        bool operator==(const PixelRgbe&) const = default;
+    };
+
+    inline std::string_view toString(PixelFormat format)
+    {
+        switch (format) {
+        case PixelFormat::Float32: return "float32";
+        case PixelFormat::Half: return "half";
+        case PixelFormat::Rgbe: return "rgbe";
+        }
+        return "unknown";
+    }
+
+    inline std::optional<PixelFormat> parsePixelFormat(std::string_view name)
+    {
+        for (auto format : { PixelFormat::Float32, PixelFormat::Half, PixelFormat::Rgbe }) {
+            if (toString(format) == name) {
+                return format;
+            }
+        }
+        return {};
+    }
+
+    inline std::size_t pixelSize(PixelFormat format)
+    {
+        switch (format) {
+        case PixelFormat::Float32: return sizeof(PixelF32);
+        case PixelFormat::Half: return sizeof(PixelHalf);
+        case PixelFormat::Rgbe: return sizeof(PixelRgbe);
+        }
+        return sizeof(PixelF32);
+    }
+
+    // Leaves trivially constructible elements uninitialized, the pages of a large buffer are then only mapped once they
+    // are first written, by whichever thread (and so NUMA node) writes them. Charged to the framebuffer's accounting.
+    template <typename T>
+    struct DefaultInitAllocator : memory::Allocator<T, memory::Subsystem::Framebuffer>
+    {
+        template <typename U>
+        struct rebind
+        {
+            using other = DefaultInitAllocator<U>;
+        };
+
+        DefaultInitAllocator() = default;
+
+        template <typename U>
+        DefaultInitAllocator(const DefaultInitAllocator<U>& /* other */) noexcept
+        {
+        }
+
+        template <typename U>
+        void construct(U* ptr)
+        {
+            ::new (static_cast<void*>(ptr)) U;
+        }
+
+        template <typename U, typename... Args>
+        void construct(U* ptr, Args&&... args)
+        {
+            std::construct_at(ptr, std::forward<Args>(args)...);
+        }
+    };
+
+    template <Pixel P>
+    using PixelBuffer = std::vector<P, DefaultInitAllocator<P>>;
+
+    // Framebuffer stored in a compact pixel format. Values are accumulated in double precision by the renderer and
+    // only quantized when a finished row is stored.
+    class Image
+    {
+    public:
+        using Storage = std::variant<PixelBuffer<PixelF32>, PixelBuffer<PixelHalf>, PixelBuffer<PixelRgbe>>;
+
+        struct Uninitialized
+        {
+        };
+
+        Image(int width, int height, PixelFormat format = PixelFormat::Float32)
+            : Image{ width, height, format, Uninitialized{} }
+        {
+            clearRows(0, height);
+        }
+
+        // the pixels are left uninitialized, every row must be cleared or written before it is read
+        Image(int width, int height, PixelFormat format, Uninitialized)
+            : m_pixels{ makeStorage(std::size_t(width) * std::size_t(height), format) }
+            , m_width{ width }
+            , m_height{ height }
+            , m_format{ format }
+        {
+        }
+
+        int         width() const { return m_width; }
+        int         height() const { return m_height; }
+        PixelFormat format() const { return m_format; }
+        std::size_t size() const { return std::size_t(m_width) * std::size_t(m_height); }
+
+        std::size_t bytes() const
+        {
+            return std::visit([](const auto& pixels) { return pixels.size() * sizeof(pixels[0]); }, m_pixels);
+        }
+
+        Color<double> get(int col, int row) const
+        {
+            auto idx = index(col, row);
+            return std::visit([idx](const auto& pixels) { return pixels[idx].decode(); }, m_pixels);
+        }
+
+        void set(int col, int row, const Color<double>& color)
+        {
+            auto idx = index(col, row);
+            std::visit(
+                [&]<Pixel P>(PixelBuffer<P>& pixels) { pixels[idx] = P::encode(color); },
+                m_pixels
+            );
+        }
+
+        // store `colors.size()` consecutive pixels starting at (col, row)
+        void setSpan(int col, int row, std::span<const Color<double>> colors)
+        {
+            auto first = index(col, row);
+            std::visit(
+                [&]<Pixel P>(PixelBuffer<P>& pixels) {
+                    for (std::size_t i = 0; i < colors.size(); ++i) {
+                        pixels[first + i] = P::encode(colors[i]);
+                    }
+                },
+                m_pixels
+            );
+        }
+
+        // set the rows [first, last) to black
+        void clearRows(int first, int last)
+        {
+            std::visit(
+                [&]<Pixel P>(PixelBuffer<P>& pixels) {
+                    auto begin = pixels.begin() + std::ptrdiff_t(index(0, first));
+                    auto end   = pixels.begin() + std::ptrdiff_t(index(0, last));
+                    std::fill(begin, end, P::encode({ 0.0, 0.0, 0.0 }));
+                },
+                m_pixels
+            );
+        }
+
+        // visit the underlying pixel storage, the callable receives a std::span<const P> for some Pixel type P
+        template <typename Fn>
+        decltype(auto) visit(Fn&& fn) const
+        {
+            return std::visit(
+                [&]<Pixel P>(const PixelBuffer<P>& pixels) { return fn(std::span<const P>{ pixels }); },
+                m_pixels
+            );
+        }
+
+    private:
+        static Storage makeStorage(std::size_t size, PixelFormat format)
+        {
+            switch (format) {
+            case PixelFormat::Float32: return PixelBuffer<PixelF32>(size);
+            case PixelFormat::Half: return PixelBuffer<PixelHalf>(size);
+            case PixelFormat::Rgbe: return PixelBuffer<PixelRgbe>(size);
+            }
+            return PixelBuffer<PixelF32>(size);
+        }
+
+        std::size_t index(int col, int row) const { return std::size_t(row) * std::size_t(m_width) + std::size_t(col); }
+
+        Storage     m_pixels;
+        int         m_width;
+        int         m_height;
+        PixelFormat m_format;
+    };
+
+}
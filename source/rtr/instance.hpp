@@ -0,0 +1,71 @@
+#pragma once
+
+#include "rtr/aabb.hpp"
+#include "rtr/hittable.hpp"
+#include "rtr/vec.hpp"
+
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace rtr
+{
+
+    // A shared sub-scene placed at an offset. The sub-scene keeps its own BVH (a bottom level), so it can be placed
+    // any number of times and reused by the scenes of later renders without building it again, and moving an instance
+    // only needs the list holding it to be built again. Build the sub-scene before sharing it.
+    //
+    // Emitters inside an instance light the scene when rays hit them but aren't sampled as lights (see LightList), a
+    // scene lit only by them renders noisier than with the same emitters placed directly.
+    class Instance final : public Hittable
+    {
+    public:
+        explicit Instance(std::shared_ptr<const HittableList> scene, Vec3<double> offset = { 0.0, 0.0, 0.0 })
+            : m_scene{ std::move(scene) }
+            , m_offset{ std::move(offset) }
+        {
+            if (!m_scene) {
+                throw std::invalid_argument{ "Instanced scene can't be null" };
+            }
+        }
+
+        const HittableList& scene() const { return *m_scene; }
+        const Vec3<double>& offset() const { return m_offset; }
+
+        void setOffset(const Vec3<double>& offset) { m_offset = offset; }
+
+        std::optional<HitResult> hit(const Ray& ray, Interval<double> tRange) const override
+        {
+            auto hit = m_scene->hit(toLocal(ray), tRange);
+            if (hit.has_value()) {
+                hit->m_record.m_point += m_offset;
+                hit->m_object          = this;    // not in the light list, see above
+            }
+            return hit;
+        }
+
+        bool occluded(const Ray& ray, Interval<double> tRange) const override
+        {
+            return m_scene->occluded(toLocal(ray), tRange);
+        }
+
+        Aabb boundingBox() const override
+        {
+            auto box = m_scene->boundingBox();
+            return box.empty() ? box : Aabb{ box.min() + m_offset, box.max() + m_offset };
+        }
+
+    private:
+        Ray toLocal(const Ray& ray) const
+        {
+            Ray local{ ray.origin() - m_offset, ray.direction() };
+            local.setCone(ray.coneWidthAt(0.0), ray.coneAngle());
+            return local;
+        }
+
+        std::shared_ptr<const HittableList> m_scene;
+        Vec3<double>                        m_offset;
+    };
+
+}
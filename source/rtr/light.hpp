@@ -0,0 +1,99 @@
+#pragma once
+
+#include "rtr/hit_record.hpp"
+#include "rtr/hittable.hpp"
+#include "rtr/instance.hpp"
+#include "rtr/util.hpp"
+
+#include <optional>
+#include <unordered_set>
+#include <vector>
+
+namespace rtr
+{
+
+    struct LightChoice
+    {
+        const Hittable* m_light;
+        LightSample     m_sample;    // pdf already includes the probability of picking m_light
+    };
+
+    // Every object with an emissive material in the scene, sampled uniformly. Emitters inside an instance aren't in
+    // the list (a hit reports the instance, not them) but still count for emission(): their light is only picked up
+    // by rays that happen to hit them.
+    class LightList
+    {
+    public:
+        LightList() = default;
+
+        static LightList collect(const HittableList& world)
+        {
+            LightList list;
+            list.addFrom(world);
+            return list;
+        }
+
+        bool        empty() const { return m_lights.empty(); }
+        std::size_t size() const { return m_lights.size(); }
+
+        // the scene has an emissive material somewhere, in the list or inside an instance
+        bool emission() const { return m_emission; }
+
+        std::optional<LightChoice> sample(const Vec3<double>& origin) const
+        {
+            if (m_lights.empty()) {
+                return {};
+            }
+
+            auto index = std::min(std::size_t(util::getRandomDouble() * double(m_lights.size())), m_lights.size() - 1);
+            auto light = m_lights[index];
+
+            auto sample = light->sampleToward(origin);
+            if (!sample.has_value()) {
+                return {};
+            }
+
+            sample->m_pdf /= double(m_lights.size());
+            return LightChoice{ light, *sample };
+        }
+
+        // Solid angle pdf of sample() choosing a direction toward `light`. Any object can be passed (the one a ray hit
+        // say), it is 0 for those sample() never picks: the ones not in the list, like an instance holding emitters.
+        double pdf(const Hittable& light, const Vec3<double>& origin) const
+        {
+            if (!m_members.contains(&light)) {
+                return 0.0;
+            }
+            return light.pdfToward(origin) / double(m_lights.size());
+        }
+
+    private:
+        void addFrom(const HittableList& list)
+        {
+            for (const auto& object : list.objects()) {
+                if (const auto* nested = dynamic_cast<const HittableList*>(object.get()); nested != nullptr) {
+                    addFrom(*nested);
+                } else if (const auto* instance = dynamic_cast<const Instance*>(object.get()); instance != nullptr) {
+                    m_emission = m_emission || LightList::collect(instance->scene()).emission();
+                } else if (const auto* material = object->getMaterial(); material && material->emissive()) {
+                    m_lights.push_back(object.get());
+                    m_members.insert(object.get());
+                    m_emission = true;
+                }
+            }
+        }
+
+        std::vector<const Hittable*>        m_lights;
+        std::unordered_set<const Hittable*> m_members;    // m_lights, for pdf()
+        bool                                m_emission = false;
+    };
+
+    // Veach's power heuristic (beta = 2) for combining two sampling strategies
+    inline double powerHeuristic(double pdf, double otherPdf)
+    {
+        auto a = pdf * pdf;
+        auto b = otherPdf * otherPdf;
+        return a + b > 0 ? a / (a + b) : 0.0;
+    }
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__unix__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace rtr
+{
+
+    // Read-only memory map of a whole file. Pages are read in by the kernel on first access and can be dropped
+    // again, so a file much larger than the memory can be mapped.
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::filesystem::path& path)
+        {
+#if defined(__unix__)
+            auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                throw std::runtime_error{ fmt::format("Problem opening file '{}'", path.string()) };
+            }
+
+            struct stat info = {};
+            if (::fstat(fd, &info) != 0) {
+                ::close(fd);
+                throw std::runtime_error{ fmt::format("Problem reading the size of '{}'", path.string()) };
+            }
+
+            m_size = std::size_t(info.st_size);
+            if (m_size > 0) {
+                m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            ::close(fd);    // the mapping keeps the file open
+
+            if (m_data == MAP_FAILED) {
+                m_data = nullptr;
+                throw std::runtime_error{ fmt::format("Problem mapping '{}'", path.string()) };
+            }
+#else
+            throw std::runtime_error{ fmt::format("Can't map '{}', not supported on this platform", path.string()) };
+#endif
+        }
+
+        MappedFile(const MappedFile&)            = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile()
+        {
+#if defined(__unix__)
+            if (m_data != nullptr) {
+                ::munmap(m_data, m_size);
+            }
+#endif
+        }
+
+        std::span<const std::byte> bytes() const { return { static_cast<const std::byte*>(m_data), m_size }; }
+        std::size_t                size() const { return m_size; }
+
+        // hints, start reading a range in the background or release its pages (they are read again if touched)
+        void willNeed(std::size_t offset, std::size_t length) const { advise(offset, length, Advice::WillNeed); }
+        void dontNeed(std::size_t offset, std::size_t length) const { advise(offset, length, Advice::DontNeed); }
+
+    private:
+        enum class Advice
+        {
+            WillNeed,
+            DontNeed,
+        };
+
+        void advise([[maybe_unused]] std::size_t offset, [[maybe_unused]] std::size_t length, Advice advice) const
+        {
+#if defined(__unix__)
+            // madvise wants a page aligned start
+            auto page  = std::size_t(::sysconf(_SC_PAGESIZE));
+            auto start = offset / page * page;
+            if (m_data != nullptr && start < m_size) {
+                auto end = std::min(offset + length, m_size);
+                ::madvise(
+                    static_cast<std::byte*>(m_data) + start,
+                    end - start,
+                    advice == Advice::WillNeed ? MADV_WILLNEED : MADV_DONTNEED
+                );
+            }
+#else
+            (void)advice;
+#endif
+        }
+
+        void*       m_data = nullptr;
+        std::size_t m_size = 0;
+    };
+
+}
@@ -3,11 +3,13 @@
 #include "rtr/color.hpp"
 #include "rtr/hit_record.hpp"
 #include "rtr/ray.hpp"
+#include "rtr/texture.hpp"
 #include "rtr/util.hpp"
 #include "rtr/vec.hpp"
 
 #include <algorithm>
 #include <cmath>
+#include <memory>
 #include <optional>
 
 namespace rtr
@@ -19,13 +21,35 @@ namespace rtr
         virtual ~Material() = default;
 
         virtual std::optional<ScatterResult> scatter(const Ray& ray, const HitRecord& record) const = 0;
+
+        // only materials that scatter with a non-zero pdf (non-specular) need to implement this
+        virtual std::optional<BsdfEval> evaluate(const HitRecord& /* record */, const Vec3<double>& /* direction */) const
+        {
+            return {};
+        }
+
+        virtual Color<double> emitted(const Ray& /* ray */, const HitRecord& /* record */) const { return { 0.0, 0.0, 0.0 }; }
+        virtual bool          emissive() const { return false; }
+
+        // whether the primitive has to fill in the texture coordinates of the hit record
+        virtual bool usesTextureCoords() const { return false; }
     };
 
+    inline Color<double> sampleTexture(const Texture& texture, const HitRecord& record)
+    {
+        return texture.value({ record.m_u, record.m_v, record.m_uvFootprint });
+    }
+
     class Lambertian final : public Material
     {
     public:
         Lambertian(Color<double> color)
-            : m_albedo{ std::move(color) }
+            : m_albedo{ std::make_shared<SolidColor>(std::move(color)) }
+        {
+        }
+
+        Lambertian(std::shared_ptr<const Texture> texture)
+            : m_albedo{ std::move(texture) }
         {
         }
 
@@ -37,28 +61,52 @@ namespace rtr
                 scatterDirection = record.m_normal;
             }
 
+            // cosine weighted, the albedo / pi * cos / pdf terms cancel out to just the albedo
+            auto cosine = vecfn::dot(record.m_normal, vecfn::normalized(scatterDirection));
+
             return ScatterResult{
                 .m_ray         = { record.m_point, scatterDirection },
-                .m_attenuation = m_albedo,
+                .m_attenuation = sampleTexture(*m_albedo, record),
+                .m_pdf         = std::max(cosine, 0.0) / n::pi,
             };
         }
 
+        std::optional<BsdfEval> evaluate(const HitRecord& record, const Vec3<double>& direction) const override
+        {
+            auto cosine = vecfn::dot(record.m_normal, direction);
+            if (cosine <= 0) {
+                return {};
+            }
+
+            return BsdfEval{
+                .m_value = sampleTexture(*m_albedo, record) * (cosine / n::pi),
+                .m_pdf   = cosine / n::pi,
+            };
+        }
+
+        bool usesTextureCoords() const override { return m_albedo->varying(); }
+
     private:
-        Color<double> m_albedo;
+        std::shared_ptr<const Texture> m_albedo;
     };
 
     class Metal final : public Material
     {
     public:
         Metal(Color<double> color, double fuzz)
-            : m_albedo{ std::move(color) }
+            : Metal{ std::make_shared<SolidColor>(std::move(color)), fuzz }
+        {
+        }
+
+        Metal(std::shared_ptr<const Texture> texture, double fuzz)
+            : m_albedo{ std::move(texture) }
             , m_fuzz{ std::clamp(fuzz, 0.0, 1.0) }
         {
         }
 
         std::optional<ScatterResult> scatter(const Ray& ray, const HitRecord& record) const override
         {
-            auto reflected = vecfn::reflect(vecfn::normalized(ray.direction()), record.m_normal);
+            auto reflected = vecfn::reflect(ray.unitDirection(), record.m_normal);
             Ray  scattered{ record.m_point, reflected + m_fuzz * vecfn::randomInUnitSphere() };
 
             if (vecfn::dot(scattered.direction(), record.m_normal) <= 0) {
@@ -67,12 +115,14 @@ namespace rtr
 
             return ScatterResult{
                 .m_ray         = std::move(scattered),
-                .m_attenuation = m_albedo,
+                .m_attenuation = sampleTexture(*m_albedo, record),
             };
         };
 
+        bool usesTextureCoords() const override { return m_albedo->varying(); }
+
     private:
-        Color<double> m_albedo;
+        std::shared_ptr<const Texture> m_albedo;
         double        m_fuzz;
     };
 
@@ -88,7 +138,7 @@ namespace rtr
         {
             double refractionRatio = record.m_frontFace ? (1.0 / m_refractiveIndex) : m_refractiveIndex;
 
-            auto unitDirection = vecfn::normalized(ray.direction());
+            const auto& unitDirection = ray.unitDirection();
 
             // total internal reflection
             double cosTheta = std::min(vecfn::dot(-unitDirection, record.m_normal), 1.0);
@@ -118,4 +168,28 @@ namespace rtr
         double m_refractiveIndex;
     };
 
+    class DiffuseLight final : public Material
+    {
+    public:
+        DiffuseLight(Color<double> color)
+            : m_emit{ std::move(color) }
+        {
+        }
+
+        std::optional<ScatterResult> scatter(const Ray& /* ray */, const HitRecord& /* record */) const override
+        {
+            return {};
+        }
+
+        Color<double> emitted(const Ray& /* ray */, const HitRecord& record) const override
+        {
+            return record.m_frontFace ? m_emit : Color<double>{ 0.0, 0.0, 0.0 };
+        }
+
+        bool emissive() const override { return true; }
+
+    private:
+        Color<double> m_emit;
+    };
+
 }
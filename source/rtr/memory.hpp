@@ -0,0 +1,278 @@
+#pragma once
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#if defined(__linux__)
+    #include <pthread.h>
+#endif
+
+// Memory accounting per subsystem: every subsystem has a counter of the bytes it currently holds and of the most it
+// ever held, for sizing the machines renders run on. The counters are fed by tracking allocators for containers and
+// by charges for memory whose size is only known where it's created (objects and materials behind base pointers).
+// Memory mapped files (cached BVHs, out-of-core geometry) are backed by the page cache and are not counted.
+namespace rtr::memory
+{
+    enum class Subsystem
+    {
+        Objects,    // scene objects and the lists holding them
+        Materials,
+        Bvh,
+        Textures,        // mip pyramids of image textures
+        TextureTiles,    // decoded tiles of the texture cache, bounded by its own budget
+        Framebuffer,
+        Progress,        // progress bar entries
+        ThreadStacks,    // reserved for the workers, only touched pages are resident
+    };
+
+    inline constexpr std::array s_subsystems = {
+        Subsystem::Objects,      Subsystem::Materials,   Subsystem::Bvh,      Subsystem::Textures,
+        Subsystem::TextureTiles, Subsystem::Framebuffer, Subsystem::Progress, Subsystem::ThreadStacks,
+    };
+
+    inline std::string_view toString(Subsystem subsystem)
+    {
+        switch (subsystem) {
+        case Subsystem::Objects: return "scene objects";
+        case Subsystem::Materials: return "materials";
+        case Subsystem::Bvh: return "bvh";
+        case Subsystem::Textures: return "textures";
+        case Subsystem::TextureTiles: return "texture tiles";
+        case Subsystem::Framebuffer: return "framebuffer";
+        case Subsystem::Progress: return "progress";
+        case Subsystem::ThreadStacks: return "thread stacks";
+        }
+        return "unknown";
+    }
+
+    // Subsystems filled while loading the scene, charging them fails once the budget is exceeded. The others grow
+    // while rendering and are only recorded, main checks the framebuffer against the budget before it starts.
+    inline bool budgeted(Subsystem subsystem)
+    {
+        return subsystem <= Subsystem::Textures;
+    }
+
+    inline double toMib(std::size_t bytes)
+    {
+        return double(bytes) / (1024.0 * 1024.0);
+    }
+
+    struct Usage
+    {
+        std::size_t m_current = 0;
+        std::size_t m_peak    = 0;
+    };
+
+    class BudgetExceeded : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    class Accounting
+    {
+    public:
+        // bytes over all the subsystems, 0: no budget
+        void        setBudget(std::size_t bytes) { m_budget.store(bytes, std::memory_order_relaxed); }
+        std::size_t budget() const { return m_budget.load(std::memory_order_relaxed); }
+
+        void charge(Subsystem subsystem, std::size_t bytes)
+        {
+            auto& counter = m_counters[std::size_t(subsystem)];
+            auto  current = counter.m_current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            auto  total   = m_total.m_current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+            if (auto limit = budget(); limit != 0 && total > limit && budgeted(subsystem)) {
+                counter.m_current.fetch_sub(bytes, std::memory_order_relaxed);
+                m_total.m_current.fetch_sub(bytes, std::memory_order_relaxed);
+                throw exceeded(subsystem, bytes, total - bytes);
+            }
+
+            raise(counter.m_peak, current);
+            raise(m_total.m_peak, total);
+        }
+
+        void release(Subsystem subsystem, std::size_t bytes) noexcept
+        {
+            m_counters[std::size_t(subsystem)].m_current.fetch_sub(bytes, std::memory_order_relaxed);
+            m_total.m_current.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+
+        // throws BudgetExceeded if `bytes` more for the subsystem would not fit in the budget, whether it's
+        // budgeted or not: for checking what a render will need before starting it
+        void checkBudget(Subsystem subsystem, std::size_t bytes) const
+        {
+            auto total = m_total.m_current.load(std::memory_order_relaxed);
+            if (auto limit = budget(); limit != 0 && total + bytes > limit) {
+                throw exceeded(subsystem, bytes, total);
+            }
+        }
+
+        Usage usage(Subsystem subsystem) const { return m_counters[std::size_t(subsystem)].usage(); }
+        Usage total() const { return m_total.usage(); }
+
+    private:
+        struct Counter
+        {
+            std::atomic<std::size_t> m_current = 0;
+            std::atomic<std::size_t> m_peak    = 0;
+
+            Usage usage() const
+            {
+                return { m_current.load(std::memory_order_relaxed), m_peak.load(std::memory_order_relaxed) };
+            }
+        };
+
+        static void raise(std::atomic<std::size_t>& peak, std::size_t value)
+        {
+            auto seen = peak.load(std::memory_order_relaxed);
+            while (seen < value && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) { }
+        }
+
+        BudgetExceeded exceeded(Subsystem subsystem, std::size_t bytes, std::size_t inUse) const
+        {
+            return BudgetExceeded{ fmt::format(
+                "Memory budget of {:.1f} MiB exceeded by {}: {} more bytes asked for, {:.1f} MiB already in use",
+                toMib(budget()),
+                toString(subsystem),
+                bytes,
+                toMib(inUse)
+            ) };
+        }
+
+        std::array<Counter, s_subsystems.size()> m_counters;
+        Counter                                   m_total;
+        std::atomic<std::size_t>                  m_budget = 0;
+    };
+
+    // the counters of the process
+    inline Accounting& accounting()
+    {
+        static Accounting accounting;
+        return accounting;
+    }
+
+    // std::allocator charging what it allocates to a subsystem
+    template <typename T, Subsystem S>
+    struct Allocator
+    {
+        using value_type = T;
+
+        template <typename U>
+        struct rebind
+        {
+            using other = Allocator<U, S>;
+        };
+
+        Allocator() = default;
+
+        template <typename U>
+        Allocator(const Allocator<U, S>& /* other */) noexcept
+        {
+        }
+
+        T* allocate(std::size_t n)
+        {
+            accounting().charge(S, n * sizeof(T));
+            try {
+                return std::allocator<T>{}.allocate(n);
+            } catch (...) {
+                accounting().release(S, n * sizeof(T));
+                throw;
+            }
+        }
+
+        void deallocate(T* ptr, std::size_t n) noexcept
+        {
+            std::allocator<T>{}.deallocate(ptr, n);
+            accounting().release(S, n * sizeof(T));
+        }
+
+        bool operator==(const Allocator&) const = default;
+    };
+
+    // Bytes charged to a subsystem for as long as the charge lives, moves with its owner.
+    class Charge
+    {
+    public:
+        explicit Charge(Subsystem subsystem)
+            : m_subsystem{ subsystem }
+        {
+        }
+
+        Charge(Charge&& other) noexcept
+            : m_subsystem{ other.m_subsystem }
+            , m_bytes{ std::exchange(other.m_bytes, 0) }
+        {
+        }
+
+        Charge& operator=(Charge&& other) noexcept
+        {
+            if (this != &other) {
+                release(m_bytes);
+                m_subsystem = other.m_subsystem;
+                m_bytes     = std::exchange(other.m_bytes, 0);
+            }
+            return *this;
+        }
+
+        Charge(const Charge&)            = delete;
+        Charge& operator=(const Charge&) = delete;
+
+        ~Charge() { release(m_bytes); }
+
+        std::size_t bytes() const { return m_bytes; }
+
+        void add(std::size_t bytes)
+        {
+            accounting().charge(m_subsystem, bytes);
+            m_bytes += bytes;
+        }
+
+        void release(std::size_t bytes) noexcept
+        {
+            bytes = std::min(bytes, m_bytes);
+            accounting().release(m_subsystem, bytes);
+            m_bytes -= bytes;
+        }
+
+        void reset(std::size_t bytes)
+        {
+            if (bytes > m_bytes) {
+                add(bytes - m_bytes);
+            } else {
+                release(m_bytes - bytes);
+            }
+        }
+
+    private:
+        Subsystem   m_subsystem;
+        std::size_t m_bytes = 0;
+    };
+
+    // size of the stack of a new thread, 0 where it's not known
+    inline std::size_t defaultStackSize()
+    {
+#if defined(__linux__)
+        pthread_attr_t attributes;
+        if (pthread_attr_init(&attributes) != 0) {
+            return 0;
+        }
+        std::size_t size = 0;
+        pthread_attr_getstacksize(&attributes, &size);
+        pthread_attr_destroy(&attributes);
+        return size;
+#else
+        return 0;
+#endif
+    }
+
+}
@@ -0,0 +1,710 @@
+#pragma once
+
+#include "rtr/aabb.hpp"
+#include "rtr/bvh.hpp"
+#include "rtr/color.hpp"
+#include "rtr/hit_record.hpp"
+#include "rtr/hittable.hpp"
+#include "rtr/mapped_file.hpp"
+#include "rtr/material.hpp"
+#include "rtr/residency.hpp"
+#include "rtr/sphere.hpp"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Geometry kept on disk, for scenes that don't fit in memory. A file holds spheres and their materials, grouped into
+// chunks of nearby spheres. Each chunk is a self-contained BVH subtree, and a small top-level BVH over the chunks
+// stays in memory. The file is memory-mapped and the chunks are decoded into an LRU cache with a byte budget when
+// rays reach them.
+namespace rtr::ooc
+{
+
+    enum class MaterialKind : std::uint32_t
+    {
+        Lambertian,
+        Metal,
+        Dielectric,
+    };
+
+    // only solid colors, emitters have to stay in memory so that lights can be sampled
+    struct MaterialRecord
+    {
+        MaterialKind         m_kind   = MaterialKind::Lambertian;
+        std::array<float, 3> m_albedo = { 0.5f, 0.5f, 0.5f };
+        float                m_param  = 0.0f;    // fuzz of Metal, refraction index of Dielectric
+    };
+
+    struct SphereRecord
+    {
+        std::array<float, 3> m_center;
+        float                m_radius;
+        std::uint32_t        m_material;
+    };
+
+    inline constexpr std::size_t s_defaultChunkSize = 4096;    // spheres
+
+    namespace detail
+    {
+        // Layout: Header | MaterialRecord[] | FileNode[] (top level) | ChunkEntry[] | chunks. Every chunk starts on a
+        // page and holds its FileNode[] followed by its SphereRecord[] in leaf order. All integers are little endian.
+        struct Header
+        {
+            std::array<char, 8> m_magic;
+            std::uint32_t       m_version;
+            std::uint32_t       m_numMaterials;
+            std::uint32_t       m_numTopNodes;
+            std::uint32_t       m_numChunks;
+            std::uint64_t       m_numSpheres;
+            std::uint64_t       m_fileSize;
+        };
+
+        struct FileNode
+        {
+            std::array<float, 3> m_min;
+            std::array<float, 3> m_max;
+            std::uint32_t        m_offset;    // leaves of the top level: chunk index
+            std::uint32_t        m_count;     // leaves of the top level: 1
+            std::uint32_t        m_axis;
+        };
+
+        struct ChunkEntry
+        {
+            std::uint64_t m_offset;
+            std::uint32_t m_numNodes;
+            std::uint32_t m_numSpheres;
+        };
+
+        static_assert(std::is_trivially_copyable_v<Header> && std::is_trivially_copyable_v<FileNode>);
+        static_assert(std::is_trivially_copyable_v<ChunkEntry> && std::is_trivially_copyable_v<MaterialRecord>);
+        static_assert(std::is_trivially_copyable_v<SphereRecord>);
+
+        inline constexpr std::array<char, 8> s_magic          = { 'R', 'T', 'R', 'G', 'E', 'O', 'M', '\0' };
+        inline constexpr std::uint32_t       s_version        = 1;
+        inline constexpr std::size_t         s_sectionAlign   = 16;
+        inline constexpr std::size_t         s_chunkAlignment = 4096;
+
+        inline std::size_t alignUp(std::size_t offset, std::size_t alignment)
+        {
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+
+        struct Sections
+        {
+            std::size_t m_materials;
+            std::size_t m_topNodes;
+            std::size_t m_chunkTable;
+            std::size_t m_firstChunk;
+        };
+
+        inline Sections sections(std::size_t numMaterials, std::size_t numTopNodes, std::size_t numChunks)
+        {
+            Sections s{};
+            s.m_materials  = alignUp(sizeof(Header), s_sectionAlign);
+            s.m_topNodes   = alignUp(s.m_materials + numMaterials * sizeof(MaterialRecord), s_sectionAlign);
+            s.m_chunkTable = alignUp(s.m_topNodes + numTopNodes * sizeof(FileNode), s_sectionAlign);
+            s.m_firstChunk = alignUp(s.m_chunkTable + numChunks * sizeof(ChunkEntry), s_chunkAlignment);
+            return s;
+        }
+
+        // rounded outward, the float box must still contain everything the double one did
+        inline FileNode encode(const BvhNode& node)
+        {
+            constexpr auto inf  = std::numeric_limits<float>::infinity();
+            const auto     down = [](double v) { return std::nextafter(float(v), -inf); };
+            const auto     up   = [](double v) { return std::nextafter(float(v), +inf); };
+
+            const auto& min = node.m_bounds.min();
+            const auto& max = node.m_bounds.max();
+            return {
+                .m_min    = { down(min.x()), down(min.y()), down(min.z()) },
+                .m_max    = { up(max.x()), up(max.y()), up(max.z()) },
+                .m_offset = node.m_offset,
+                .m_count  = node.m_count,
+                .m_axis   = node.m_axis,
+            };
+        }
+
+        inline BvhNode decode(const FileNode& node)
+        {
+            Vec3<double> min{ double(node.m_min[0]), double(node.m_min[1]), double(node.m_min[2]) };
+            Vec3<double> max{ double(node.m_max[0]), double(node.m_max[1]), double(node.m_max[2]) };
+            return { Aabb{ min, max }, node.m_offset, node.m_count, std::uint8_t(node.m_axis) };
+        }
+
+        // children of inner nodes come after them, leaves stay within `numItems` (spheres or chunks)
+        inline bool valid(const FileNode& node, std::size_t index, std::size_t numNodes, std::size_t numItems)
+        {
+            if (node.m_count > 0) {
+                return std::size_t(node.m_offset) + node.m_count <= numItems;
+            }
+            return node.m_offset > index + 1 && node.m_offset < numNodes && node.m_axis < 3;
+        }
+
+        inline Aabb boundsOf(const SphereRecord& sphere)
+        {
+            Vec3<double> center{ double(sphere.m_center[0]), double(sphere.m_center[1]), double(sphere.m_center[2]) };
+            Vec3<double> radius{ double(sphere.m_radius), double(sphere.m_radius), double(sphere.m_radius) };
+            return { center - radius, center + radius };
+        }
+
+        template <typename T>
+        void writeArray(std::ofstream& out, std::span<const T> values)
+        {
+            out.write(reinterpret_cast<const char*>(values.data()), std::streamsize(values.size_bytes()));
+        }
+
+        inline void pad(std::ofstream& out, std::size_t alignment)
+        {
+            static constexpr std::array<char, s_chunkAlignment> zeros{};
+            auto position = std::size_t(out.tellp());
+            out.write(zeros.data(), std::streamsize(alignUp(position, alignment) - position));
+        }
+
+        // the file may come from anywhere, every range is checked before it is copied out of the mapping
+        template <typename T>
+        std::vector<T> readArray(std::span<const std::byte> bytes, std::size_t offset, std::size_t count)
+        {
+            if (offset > bytes.size() || count > (bytes.size() - offset) / sizeof(T)) {
+                throw std::runtime_error{ "Out-of-core geometry file is truncated" };
+            }
+            std::vector<T> values(count);
+            std::memcpy(values.data(), bytes.data() + offset, count * sizeof(T));
+            return values;
+        }
+    }
+
+    // Write spheres to an out-of-core geometry file. Chunks hold at most `chunkSize` spheres, smaller chunks mean a
+    // finer residency granularity and a larger top level.
+    inline void write(
+        const std::filesystem::path&    path,
+        std::span<const SphereRecord>   spheres,
+        std::span<const MaterialRecord> materials,
+        std::size_t                     chunkSize = s_defaultChunkSize
+    )
+    {
+        using namespace detail;
+
+        if (chunkSize == 0) {
+            throw std::invalid_argument{ "Chunk size can't be 0" };
+        }
+        for (const auto& sphere : spheres) {
+            if (sphere.m_material >= materials.size()) {
+                throw std::invalid_argument{ fmt::format("Sphere uses unknown material {}", sphere.m_material) };
+            }
+        }
+
+        std::vector<Aabb> boxes;
+        boxes.reserve(spheres.size());
+        for (const auto& sphere : spheres) {
+            boxes.push_back(boundsOf(sphere));
+        }
+
+        // the leaves of a tree built with chunk sized leaves are the chunks, the median split fills them up
+        auto top = bvh::build(boxes, { .m_maxLeafSize = chunkSize, .m_split = bvh::Split::Median });
+
+        std::vector<FileNode>                                topNodes;
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> chunkRanges;    // first, count in top.m_order
+        for (const auto& node : top.m_nodes) {
+            auto encoded = encode(node);
+            if (node.leaf()) {
+                encoded.m_offset = std::uint32_t(chunkRanges.size());
+                encoded.m_count  = 1;
+                chunkRanges.emplace_back(node.m_offset, node.m_count);
+            }
+            topNodes.push_back(encoded);
+        }
+
+        const auto layout = sections(materials.size(), topNodes.size(), chunkRanges.size());
+
+        std::ofstream out{ path, std::ios::binary | std::ios::trunc };
+        if (!out.good()) {
+            throw std::runtime_error{ fmt::format("Problem opening file '{}'", path.string()) };
+        }
+
+        Header header{
+            .m_magic        = s_magic,
+            .m_version      = s_version,
+            .m_numMaterials = std::uint32_t(materials.size()),
+            .m_numTopNodes  = std::uint32_t(topNodes.size()),
+            .m_numChunks    = std::uint32_t(chunkRanges.size()),
+            .m_numSpheres   = spheres.size(),
+            .m_fileSize     = 0,
+        };
+
+        writeArray(out, std::span<const Header>{ &header, 1 });
+        pad(out, s_sectionAlign);
+        writeArray(out, materials);
+        pad(out, s_sectionAlign);
+        writeArray(out, std::span<const FileNode>{ topNodes });
+        pad(out, s_sectionAlign);
+
+        std::vector<ChunkEntry> chunkTable(chunkRanges.size());
+        writeArray(out, std::span<const ChunkEntry>{ chunkTable });    // filled in below
+
+        for (std::size_t i = 0; i < chunkRanges.size(); ++i) {
+            auto [first, count] = chunkRanges[i];
+
+            std::vector<SphereRecord> local;
+            std::vector<Aabb>         localBoxes;
+            for (auto index : std::span{ top.m_order }.subspan(first, count)) {
+                local.push_back(spheres[index]);
+                localBoxes.push_back(boxes[index]);
+            }
+
+            auto subtree = bvh::build(localBoxes);
+
+            std::vector<FileNode> nodes;
+            for (const auto& node : subtree.m_nodes) {
+                nodes.push_back(encode(node));
+            }
+            std::vector<SphereRecord> ordered;
+            for (auto index : subtree.m_order) {
+                ordered.push_back(local[index]);
+            }
+
+            pad(out, s_chunkAlignment);
+            chunkTable[i] = {
+                .m_offset     = std::uint64_t(out.tellp()),
+                .m_numNodes   = std::uint32_t(nodes.size()),
+                .m_numSpheres = std::uint32_t(ordered.size()),
+            };
+            writeArray(out, std::span<const FileNode>{ nodes });
+            writeArray(out, std::span<const SphereRecord>{ ordered });
+        }
+
+        header.m_fileSize = std::uint64_t(out.tellp());
+        out.seekp(std::streamoff(layout.m_chunkTable));
+        writeArray(out, std::span<const ChunkEntry>{ chunkTable });
+        out.seekp(0);
+        writeArray(out, std::span<const Header>{ &header, 1 });
+
+        if (!out.good()) {
+            throw std::runtime_error{ fmt::format("Problem writing file '{}'", path.string()) };
+        }
+    }
+
+    // a decoded chunk, spheres are in leaf order
+    struct Chunk
+    {
+        struct Sphere
+        {
+            Vec3<double>    m_center;
+            double          m_radius;
+            const Material* m_material;
+        };
+
+        std::vector<BvhNode> m_nodes;
+        std::vector<Sphere>  m_spheres;
+
+        std::size_t bytes() const
+        {
+            return sizeof(Chunk) + m_nodes.size() * sizeof(BvhNode) + m_spheres.size() * sizeof(Sphere);
+        }
+
+        // index of the closest sphere hit within (tMin, tMax), tMax is lowered to its distance
+        std::optional<std::uint32_t> closestHit(const Ray& ray, double tMin, double& tMax) const
+        {
+            std::optional<std::uint32_t> closest;
+            bvh::traverse(m_nodes, ray, tMin, tMax, [&](const BvhNode& leaf, double& tLeafMax) {
+                for (auto i = leaf.m_offset; i < leaf.m_offset + leaf.m_count; ++i) {
+                    const auto& sphere = m_spheres[i];
+                    auto        roots  = rtr::Sphere::intersect(ray, sphere.m_center, sphere.m_radius);
+                    if (!roots.has_value()) {
+                        continue;
+                    }
+                    auto root = roots->first > tMin ? roots->first : roots->second;
+                    if (root > tMin && root < tLeafMax) {
+                        tLeafMax = root;
+                        closest  = i;
+                    }
+                }
+                return false;
+            });
+            return closest;
+        }
+
+        bool anyHit(const Ray& ray, double tMin, double tMax) const
+        {
+            return bvh::traverse(m_nodes, ray, tMin, tMax, [&](const BvhNode& leaf, double&) {
+                for (auto i = leaf.m_offset; i < leaf.m_offset + leaf.m_count; ++i) {
+                    const auto& sphere = m_spheres[i];
+                    auto        roots  = rtr::Sphere::intersect(ray, sphere.m_center, sphere.m_radius);
+                    if (roots.has_value() && ((roots->first > tMin && roots->first < tMax)
+                                              || (roots->second > tMin && roots->second < tMax))) {
+                        return true;
+                    }
+                }
+                return false;
+            });
+        }
+    };
+
+    // Decoded chunks, least recently used ones are dropped past the byte budget. The budget is split over shards and
+    // a shard always keeps its newest chunk, so a budget below a chunk per shard is exceeded. Chunks requested without
+    // waiting are decoded by a loader thread of its own.
+    class ChunkCache
+    {
+    public:
+        using Decoder  = std::function<std::shared_ptr<const Chunk>(std::uint32_t)>;
+        using Prefetch = std::function<void(std::uint32_t)>;
+
+        ChunkCache(std::size_t budgetBytes, Decoder decode, Prefetch prefetch)
+            : m_id{ s_nextId.fetch_add(1, std::memory_order_relaxed) }
+            , m_shardBudget{ std::max(budgetBytes / s_numShards, std::size_t{ 1 }) }
+            , m_decode{ std::move(decode) }
+            , m_prefetch{ std::move(prefetch) }
+            , m_loader{ [this](std::stop_token stop) { loaderLoop(stop); } }
+        {
+        }
+
+        ChunkCache(const ChunkCache&)            = delete;
+        ChunkCache& operator=(const ChunkCache&) = delete;
+
+        // The chunk if it is resident. Otherwise it is decoded on the calling thread when `wait` is set, else it is
+        // queued for the loader and the result is null.
+        std::shared_ptr<const Chunk> get(std::uint32_t index, bool wait)
+        {
+            // consecutive lookups of a thread mostly hit the same chunk
+            struct LastChunk
+            {
+                std::uint64_t                m_cache = 0;
+                std::uint32_t                m_index = 0;
+                std::shared_ptr<const Chunk> m_chunk;
+            };
+            thread_local LastChunk last;
+
+            if (last.m_cache == m_id && last.m_index == index && last.m_chunk) {
+                return last.m_chunk;
+            }
+
+            auto chunk = lookup(index);
+            if (!chunk) {
+                if (!wait) {
+                    request(index);
+                    return nullptr;
+                }
+                chunk = insert(index, m_decode(index));
+                m_misses.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            last = { m_id, index, chunk };
+            return chunk;
+        }
+
+        std::size_t budget() const { return m_shardBudget * s_numShards; }
+        std::size_t hits() const { return m_hits.load(std::memory_order_relaxed); }
+        std::size_t misses() const { return m_misses.load(std::memory_order_relaxed); }
+        std::size_t deferred() const { return m_deferred.load(std::memory_order_relaxed); }
+        std::size_t loads() const { return m_loads.load(std::memory_order_relaxed); }
+
+        std::size_t bytes()
+        {
+            std::size_t total = 0;
+            for (auto& shard : m_shards) {
+                std::scoped_lock lock{ shard.m_mutex };
+                total += shard.m_bytes;
+            }
+            return total;
+        }
+
+    private:
+        static constexpr std::size_t s_numShards = 16;
+
+        static inline std::atomic<std::uint64_t> s_nextId = 1;
+
+        using Entry = std::pair<std::uint32_t, std::shared_ptr<const Chunk>>;
+
+        struct Shard
+        {
+            std::mutex                                                    m_mutex;
+            std::list<Entry>                                              m_lru;
+            std::unordered_map<std::uint32_t, std::list<Entry>::iterator> m_index;
+            std::size_t                                                   m_bytes = 0;
+        };
+
+        Shard& shardOf(std::uint32_t index) { return m_shards[index % s_numShards]; }
+
+        std::shared_ptr<const Chunk> lookup(std::uint32_t index)
+        {
+            auto&            shard = shardOf(index);
+            std::scoped_lock lock{ shard.m_mutex };
+            if (auto found = shard.m_index.find(index); found != shard.m_index.end()) {
+                shard.m_lru.splice(shard.m_lru.begin(), shard.m_lru, found->second);
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return found->second->second;
+            }
+            return nullptr;
+        }
+
+        std::shared_ptr<const Chunk> insert(std::uint32_t index, std::shared_ptr<const Chunk> chunk)
+        {
+            auto&            shard = shardOf(index);
+            std::scoped_lock lock{ shard.m_mutex };
+            if (auto found = shard.m_index.find(index); found != shard.m_index.end()) {
+                return found->second->second;    // another thread decoded it first
+            }
+
+            shard.m_lru.emplace_front(index, chunk);
+            shard.m_index.emplace(index, shard.m_lru.begin());
+            shard.m_bytes += chunk->bytes();
+
+            while (shard.m_bytes > m_shardBudget && shard.m_lru.size() > 1) {
+                shard.m_bytes -= shard.m_lru.back().second->bytes();
+                shard.m_index.erase(shard.m_lru.back().first);
+                shard.m_lru.pop_back();
+            }
+
+            return chunk;
+        }
+
+        void request(std::uint32_t index)
+        {
+            m_deferred.fetch_add(1, std::memory_order_relaxed);
+
+            std::scoped_lock lock{ m_queueMutex };
+            if (m_requested.insert(index).second) {
+                m_prefetch(index);    // the disk can work on it while the loader decodes earlier requests
+                m_queue.push_back(index);
+                m_queueCond.notify_one();
+            }
+        }
+
+        void loaderLoop(std::stop_token stop)
+        {
+            while (true) {
+                std::uint32_t index = 0;
+                {
+                    std::unique_lock lock{ m_queueMutex };
+                    if (!m_queueCond.wait(lock, stop, [&] { return !m_queue.empty(); })) {
+                        return;
+                    }
+                    index = m_queue.front();
+                    m_queue.pop_front();
+                }
+
+                // a chunk that fails to decode is left out, the next waiting get() decodes it again and throws
+                try {
+                    if (!lookup(index)) {
+                        insert(index, m_decode(index));
+                        m_loads.fetch_add(1, std::memory_order_relaxed);
+                    }
+                } catch (...) {
+                }
+
+                std::scoped_lock lock{ m_queueMutex };
+                m_requested.erase(index);
+            }
+        }
+
+        std::uint64_t                  m_id;
+        std::size_t                    m_shardBudget;
+        Decoder                        m_decode;
+        Prefetch                       m_prefetch;
+        std::array<Shard, s_numShards> m_shards;
+        std::atomic<std::size_t>       m_hits     = 0;
+        std::atomic<std::size_t>       m_misses   = 0;
+        std::atomic<std::size_t>       m_deferred = 0;
+        std::atomic<std::size_t>       m_loads    = 0;
+
+        std::mutex                        m_queueMutex;
+        std::condition_variable_any       m_queueCond;
+        std::deque<std::uint32_t>         m_queue;
+        std::unordered_set<std::uint32_t> m_requested;
+
+        std::jthread m_loader;    // last, stops before the rest goes away
+    };
+
+    // Spheres streamed in from an out-of-core geometry file, see the namespace comment. Rays traced while
+    // residency::state().m_deferring is set never wait for a chunk (see residency.hpp).
+    class OutOfCoreGeometry final : public Hittable
+    {
+    public:
+        static constexpr std::size_t s_defaultBudget = 256 * 1024 * 1024;
+
+        explicit OutOfCoreGeometry(const std::filesystem::path& path, std::size_t budgetBytes = s_defaultBudget)
+            : m_file{ std::make_unique<MappedFile>(path) }
+        {
+            using namespace detail;
+
+            auto bytes  = m_file->bytes();
+            auto header = readArray<Header>(bytes, 0, 1).front();
+            if (header.m_magic != s_magic) {
+                throw std::runtime_error{ fmt::format("'{}' is not an out-of-core geometry file", path.string()) };
+            }
+            if (header.m_version != s_version || header.m_fileSize != bytes.size()) {
+                throw std::runtime_error{ fmt::format("'{}' has another version or is damaged", path.string()) };
+            }
+
+            auto layout = sections(header.m_numMaterials, header.m_numTopNodes, header.m_numChunks);
+
+            for (const auto& record : readArray<MaterialRecord>(bytes, layout.m_materials, header.m_numMaterials)) {
+                m_materials.push_back(makeMaterial(record));
+            }
+            for (const auto& node : readArray<FileNode>(bytes, layout.m_topNodes, header.m_numTopNodes)) {
+                if (!valid(node, m_topNodes.size(), header.m_numTopNodes, header.m_numChunks)) {
+                    throw std::runtime_error{ fmt::format("'{}' is damaged", path.string()) };
+                }
+                m_topNodes.push_back(decode(node));
+            }
+            m_chunks     = readArray<ChunkEntry>(bytes, layout.m_chunkTable, header.m_numChunks);
+            m_numSpheres = header.m_numSpheres;
+
+            m_cache = std::make_unique<ChunkCache>(
+                budgetBytes,
+                [this](std::uint32_t index) { return decodeChunk(index); },
+                [this](std::uint32_t index) { m_file->willNeed(m_chunks[index].m_offset, chunkBytes(index)); }
+            );
+        }
+
+        std::optional<HitResult> hit(const Ray& ray, Interval<double> tRange) const override
+        {
+            const bool wait = !residency::state().m_deferring;
+
+            double                       tClosest = tRange.max();
+            std::shared_ptr<const Chunk> closestChunk;
+            std::uint32_t                closestSphere = 0;
+
+            const auto visitChunk = [&](const BvhNode& leaf, double& tMax) {
+                auto chunk = m_cache->get(leaf.m_offset, wait);
+                if (!chunk) {
+                    return true;
+                }
+                if (auto found = chunk->closestHit(ray, tRange.min(), tMax); found.has_value()) {
+                    closestChunk  = std::move(chunk);
+                    closestSphere = *found;
+                }
+                return false;
+            };
+
+            auto stopped = bvh::traverse(m_topNodes, ray, tRange.min(), tClosest, visitChunk);
+
+            if (stopped) {
+                residency::state().m_missed = true;    // the result would be wrong, the caller renders it again
+                return {};
+            }
+            if (!closestChunk) {
+                return {};
+            }
+
+            const auto& sphere    = closestChunk->m_spheres[closestSphere];
+            const Vec   point     = ray.at(tClosest);
+            const Vec   outNormal = (point - sphere.m_center) / sphere.m_radius;
+
+            return HitResult{
+                .m_record   = HitRecord::from(ray, outNormal, point, tClosest),
+                .m_material = sphere.m_material,
+                .m_object   = this,
+            };
+        }
+
+        bool occluded(const Ray& ray, Interval<double> tRange) const override
+        {
+            const bool wait = !residency::state().m_deferring;
+
+            bool   missing = false;
+            double tMax    = tRange.max();
+            auto   found   = bvh::traverse(m_topNodes, ray, tRange.min(), tMax, [&](const BvhNode& leaf, double& t) {
+                auto chunk = m_cache->get(leaf.m_offset, wait);
+                missing    = !chunk;
+                return missing || chunk->anyHit(ray, tRange.min(), t);
+            });
+
+            if (missing) {
+                residency::state().m_missed = true;
+                return false;
+            }
+            return found;
+        }
+
+        Aabb boundingBox() const override { return m_topNodes.empty() ? Aabb{} : m_topNodes.front().m_bounds; }
+
+        std::size_t numSpheres() const { return m_numSpheres; }
+        std::size_t numChunks() const { return m_chunks.size(); }
+        ChunkCache& cache() const { return *m_cache; }
+
+    private:
+        static std::unique_ptr<Material> makeMaterial(const MaterialRecord& record)
+        {
+            Color<> albedo{ double(record.m_albedo[0]), double(record.m_albedo[1]), double(record.m_albedo[2]) };
+            switch (record.m_kind) {
+            case MaterialKind::Lambertian: return std::make_unique<Lambertian>(albedo);
+            case MaterialKind::Metal: return std::make_unique<Metal>(albedo, double(record.m_param));
+            case MaterialKind::Dielectric: return std::make_unique<Dielectric>(double(record.m_param));
+            }
+            throw std::runtime_error{ fmt::format("Unknown material kind {}", std::uint32_t(record.m_kind)) };
+        }
+
+        std::size_t chunkBytes(std::uint32_t index) const
+        {
+            const auto& entry = m_chunks[index];
+            return entry.m_numNodes * sizeof(detail::FileNode) + entry.m_numSpheres * sizeof(SphereRecord);
+        }
+
+        std::shared_ptr<const Chunk> decodeChunk(std::uint32_t index) const
+        {
+            const auto& entry = m_chunks[index];
+            auto        bytes = m_file->bytes();
+
+            auto nodes   = detail::readArray<detail::FileNode>(bytes, entry.m_offset, entry.m_numNodes);
+            auto offset  = entry.m_offset + entry.m_numNodes * sizeof(detail::FileNode);
+            auto spheres = detail::readArray<SphereRecord>(bytes, offset, entry.m_numSpheres);
+
+            // the decoded copy is what counts against the budget, the mapped pages can go
+            m_file->dontNeed(entry.m_offset, chunkBytes(index));
+
+            auto chunk = std::make_shared<Chunk>();
+            chunk->m_nodes.reserve(nodes.size());
+            for (const auto& node : nodes) {
+                if (!detail::valid(node, chunk->m_nodes.size(), nodes.size(), spheres.size())) {
+                    throw std::runtime_error{ fmt::format("Chunk {} of the geometry file is damaged", index) };
+                }
+                chunk->m_nodes.push_back(detail::decode(node));
+            }
+            chunk->m_spheres.reserve(spheres.size());
+            for (const auto& sphere : spheres) {
+                if (sphere.m_material >= m_materials.size()) {
+                    throw std::runtime_error{ fmt::format("Chunk {} of the geometry file is damaged", index) };
+                }
+                const auto& [x, y, z] = sphere.m_center;
+                chunk->m_spheres.push_back({
+                    .m_center   = { double(x), double(y), double(z) },
+                    .m_radius   = double(sphere.m_radius),
+                    .m_material = m_materials[sphere.m_material].get(),
+                });
+            }
+            return chunk;
+        }
+
+        std::unique_ptr<MappedFile>            m_file;
+        std::vector<std::unique_ptr<Material>> m_materials;
+        std::vector<BvhNode>                   m_topNodes;
+        std::vector<detail::ChunkEntry>        m_chunks;
+        std::size_t                            m_numSpheres = 0;
+        std::unique_ptr<ChunkCache>            m_cache;    // last, its loader uses everything above
+    };
+
+}
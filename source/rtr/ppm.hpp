@@ -0,0 +1,196 @@
+#pragma once
+
+#include "rtr/color.hpp"
+#include "rtr/image.hpp"
+#include "rtr/util.hpp"
+
+#include <fmt/core.h>
+
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace rtr
+{
+
+    // writes a plain (P3) ppm file incrementally, pixels must be fed in row-major order
+    class PpmWriter
+    {
+    public:
+        static constexpr int s_maxColor = 255;
+
+        PpmWriter(const std::filesystem::path& outPath, int width, int height)
+            : m_outFile{ outPath, std::ios::out | std::ios::trunc }
+            , m_width{ width }
+            , m_height{ height }
+        {
+            if (!m_outFile.good()) {
+                throw std::runtime_error{ fmt::format("Problem opening file '{}'", outPath.string()) };
+            }
+
+            // prelude
+            m_outFile << fmt::format("P3\n{} {}\n{}\n", m_width, m_height, s_maxColor);
+        }
+
+        void write(std::span<const Color<double>> pixels)
+        {
+            for (const auto& pixel : pixels) {
+                writePixel(pixel);
+            }
+        }
+
+        // converts straight from the image's storage format, no intermediate full-precision copy is made
+        void write(const Image& image)
+        {
+            image.visit([this](auto pixels) {
+                for (const auto& pixel : pixels) {
+                    writePixel(pixel.decode());
+                }
+            });
+        }
+
+        std::size_t written() const { return m_written; }
+        bool        done() const { return m_written == std::size_t(m_width) * std::size_t(m_height); }
+
+        // the line of a pixel in the file
+        static std::string format(const Color<double>& pixel)
+        {
+            auto corrected = colorfn::correctGamma(pixel);
+            auto clamped   = colorfn::clamp(corrected, { 0.0, 0.999 });
+            auto color     = colorfn::cast<int>(clamped, { 0.0, 1.0 }, { 0, s_maxColor });
+            return fmt::format("{} {} {}\n", color.x(), color.y(), color.z());
+        }
+
+    private:
+        void writePixel(const Color<double>& pixel)
+        {
+            m_buffer += format(pixel);
+
+            if (++m_written % std::size_t(m_width) == 0) {
+                m_outFile << std::exchange(m_buffer, {});
+            }
+        }
+
+        std::ofstream m_outFile;
+        std::string   m_buffer;
+        std::size_t   m_written = 0;
+        int           m_width;
+        int           m_height;
+    };
+
+    struct PpmHeader
+    {
+        int m_width;
+        int m_height;
+        int m_maxColor;
+    };
+
+    // opens a plain (P3) ppm file and reads its header, the stream is left at the first pixel
+    inline std::pair<std::ifstream, PpmHeader> openPpm(const std::filesystem::path& path)
+    {
+        std::ifstream file{ path };
+        if (!file.good()) {
+            throw std::runtime_error{ fmt::format("Problem opening file '{}'", path.string()) };
+        }
+
+        std::string magic;
+        PpmHeader   header{ 0, 0, 0 };
+        if (!(file >> magic >> header.m_width >> header.m_height >> header.m_maxColor) || magic != "P3"
+            || header.m_width <= 0 || header.m_height <= 0 || header.m_maxColor <= 0) {
+            throw std::runtime_error{ fmt::format("'{}' is not a plain ppm file", path.string()) };
+        }
+
+        return { std::move(file), header };
+    }
+
+    // reads back a plain (P3) ppm file such as the ones PpmWriter writes, the colors are converted to linear space
+    inline Image readPpm(const std::filesystem::path& path)
+    {
+        auto [file, header]            = openPpm(path);
+        auto [width, height, maxColor] = header;
+
+        const auto linear = [&](int value) { return util::gammaToLinear(double(value) / double(maxColor)); };
+
+        Image image{ width, height };
+        for (int row = 0; row < height; ++row) {
+            for (int col = 0; col < width; ++col) {
+                int r, g, b;
+                if (!(file >> r >> g >> b)) {
+                    throw std::runtime_error{ fmt::format("'{}' is truncated", path.string()) };
+                }
+                image.set(col, row, { linear(r), linear(g), linear(b) });
+            }
+        }
+
+        return image;
+    }
+
+    // Writes the plain ppm file `base` to `outPath` (which can be `base`) with the pixels of `patch` in place of the
+    // ones from (x, y) on. The other pixels are copied as they are, without going through a decode and encode round
+    // trip, so patching the same region again gives the same file.
+    inline void patchPpm(
+        const std::filesystem::path& base,
+        const std::filesystem::path& outPath,
+        const Image&                 patch,
+        int                          x,
+        int                          y
+    )
+    {
+        auto [file, header]            = openPpm(base);
+        auto [width, height, maxColor] = header;
+        if (maxColor != PpmWriter::s_maxColor) {
+            throw std::runtime_error{ fmt::format("'{}' doesn't have 8-bit colors", base.string()) };
+        }
+        if (x < 0 || y < 0 || x + patch.width() > width || y + patch.height() > height) {
+            throw std::runtime_error{ fmt::format(
+                "A {}x{} patch at ({}, {}) doesn't fit in the {}x{} image '{}'",
+                patch.width(),
+                patch.height(),
+                x,
+                y,
+                width,
+                height,
+                base.string()
+            ) };
+        }
+
+        // next to the output and renamed once complete, the output may be the file being read
+        auto tempPath  = outPath;
+        tempPath      += ".patch";
+        {
+            std::ofstream out{ tempPath, std::ios::out | std::ios::trunc };
+            if (!out.good()) {
+                throw std::runtime_error{ fmt::format("Problem opening file '{}'", tempPath.string()) };
+            }
+            out << fmt::format("P3\n{} {}\n{}\n", width, height, maxColor);
+
+            std::string buffer;
+            for (int row = 0; row < height; ++row) {
+                for (int col = 0; col < width; ++col) {
+                    int r, g, b;
+                    if (!(file >> r >> g >> b)) {
+                        throw std::runtime_error{ fmt::format("'{}' is truncated", base.string()) };
+                    }
+
+                    if (col >= x && col < x + patch.width() && row >= y && row < y + patch.height()) {
+                        buffer += PpmWriter::format(patch.get(col - x, row - y));
+                    } else {
+                        buffer += fmt::format("{} {} {}\n", r, g, b);
+                    }
+                }
+                out << std::exchange(buffer, {});
+            }
+
+            if (!out.good()) {
+                throw std::runtime_error{ fmt::format("Problem writing file '{}'", tempPath.string()) };
+            }
+        }
+
+        file.close();
+        std::filesystem::rename(tempPath, outPath);
+    }
+
+}
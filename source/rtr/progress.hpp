@@ -2,6 +2,7 @@
 
 #include "rtr/common.hpp"
 #include "rtr/concepts.hpp"
+#include "rtr/memory.hpp"
 
 #include <concurrencpp/concurrencpp.h>
 #include <fmt/core.h>
@@ -9,11 +10,56 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <cstdint>
+#include <iterator>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#if defined(__unix__)
+    #include <unistd.h>
+#endif
+
 namespace rtr
 {
+    enum class ProgressStyle
+    {
+        Bars,    // one bar per entry, redrawn in place with ANSI escapes
+        Json,    // one JSON object per line (NDJSON) for logs and batch pipelines
+    };
+
+    inline std::string_view toString(ProgressStyle style)
+    {
+        switch (style) {
+        case ProgressStyle::Bars: return "bars";
+        case ProgressStyle::Json: return "json";
+        }
+        return "unknown";
+    }
+
+    inline std::optional<ProgressStyle> parseProgressStyle(std::string_view name)
+    {
+        for (auto style : { ProgressStyle::Bars, ProgressStyle::Json }) {
+            if (toString(style) == name) {
+                return style;
+            }
+        }
+        return {};
+    }
+
+    // bars on a terminal, JSON lines when stderr goes to a file or a pipe
+    inline ProgressStyle defaultProgressStyle()
+    {
+#if defined(__unix__)
+        return ::isatty(STDERR_FILENO) ? ProgressStyle::Bars : ProgressStyle::Json;
+#else
+        return ProgressStyle::Bars;
+#endif
+    }
+
     template <typename T, std::size_t N>
         requires(rtr::Div<T, int, T> && rtr::Add<T, T, T>)
     class MovingAverage
@@ -76,8 +122,10 @@ namespace rtr
             auto operator<=>(const UpdateRecord&) const = default;
         };
 
-        ProgressBarEntry(std::string name, int min, int max)
+        // `unit`: what a step is, a string literal
+        ProgressBarEntry(std::string name, int min, int max, std::string_view unit = "steps")
             : m_name{ std::move(name) }
+            , m_unit{ unit }
             , m_min{ min }
             , m_max{ max }
         {
@@ -88,10 +136,12 @@ namespace rtr
         ProgressBarEntry(ProgressBarEntry&&)                 = default;
         ProgressBarEntry& operator=(ProgressBarEntry&&)      = default;
 
-        void update(int current)
+        // `rays`: traced since the last update
+        void update(int current, std::uint64_t rays = 0)
         {
-            auto last = m_current;
-            m_current = std::clamp(current, m_min, m_max);
+            auto last  = m_current;
+            m_current  = std::clamp(current, m_min, m_max);
+            m_rays    += rays;
 
             auto currentTime = Clock::now();
             auto deltaTime   = currentTime - m_lastUpdate;
@@ -131,8 +181,11 @@ namespace rtr
         }
 
         const std::string& name() const { return m_name; }
+        std::string_view   unit() const { return m_unit; }
+        int                done() const { return m_current - m_min; }
+        int                total() const { return m_max - m_min; }
+        std::uint64_t      rays() const { return m_rays; }
 
-    private:
         TimeInterval calculateRemainingTime() const
         {
             auto remaining    = m_max - m_current;
@@ -146,46 +199,58 @@ namespace rtr
             return TimeInterval{ remainingTime };
         }
 
+    private:
         inline static constexpr std::size_t s_width   = 80;
         inline static constexpr std::array  s_spinner = { '/', '-', '\\', '|' };
 
         inline static constexpr TimeInterval s_delay{ 100 };
         inline static constexpr TimeInterval s_timeout{ 2000 };
 
-        std::string m_name;
+        std::string      m_name;
+        std::string_view m_unit;
 
         int               m_min;
         int               m_max;
         int               m_current    = 0;
+        std::uint64_t     m_rays       = 0;
         std::size_t       m_spinnerIdx = 0;
         Clock::time_point m_lastUpdate;
 
         MovingAverage<UpdateRecord, 10> m_updateRecords;
     };
 
+    // Shows the progress of the entries on stderr, as bars or as JSON lines (see ProgressStyle). Updates are posted to
+    // one worker thread, which also prints, so the render threads never wait for the output.
     class ProgressBarManager
     {
     public:
         using Executor = concurrencpp::worker_thread_executor;
 
-        ProgressBarManager(concurrencpp::runtime& runtime)
+        ProgressBarManager(concurrencpp::runtime& runtime, ProgressStyle style = defaultProgressStyle())
             : m_executor{ runtime.make_worker_thread_executor() }
+            , m_style{ style }
         {
         }
 
         ~ProgressBarManager()
         {
-            fmt::println(stderr, "\033[{}B", m_entries.size());    // move cursor down
+            if (m_style == ProgressStyle::Bars) {
+                fmt::println(stderr, "\033[{}B", m_entries.size());    // move cursor down
+            }
             stop();
         }
 
-        void add(std::string name, int min, int max)
+        ProgressStyle style() const { return m_style; }
+
+        // `unit`: what a step is (tiles, bands, ...), a string literal
+        void add(std::string name, int min, int max, std::string_view unit = "steps")
         {
             std::scoped_lock lock{ m_mutex };
-            m_entries.emplace_back(std::move(name), min, max);
+            m_entries.emplace_back(std::move(name), min, max, unit);
         }
 
-        void update(std::string_view name, int current)
+        // `rays`: traced for the entry since its last update, for the throughput in the JSON lines
+        void update(std::string_view name, int current, std::uint64_t rays = 0)
         {
             m_executor->post([=, this] {
                 std::scoped_lock lock{ m_mutex };
@@ -195,12 +260,21 @@ namespace rtr
                 if (found == m_entries.end()) {
                     return;
                 }
-                found->update(current);
+                found->update(current, rays);
             });
         }
 
         void start(concurrencpp::timer_queue& timerQueue)
         {
+            m_start     = Clock::now();
+            m_lastPrint = m_start;
+            m_started   = true;
+
+            if (m_style == ProgressStyle::Json) {
+                m_timer = timerQueue.make_timer(s_jsonInterval, s_jsonInterval, m_executor, [this] { printJson(); });
+                return;
+            }
+
             fmt::print(stderr, "\0337");    // DECSC
             m_timer = timerQueue.make_timer(0s, 100ms, m_executor, [this] { printLoop(); });
         }
@@ -208,10 +282,97 @@ namespace rtr
         void stop()
         {
             m_timer.cancel();
+
+            // after the updates still queued, so that the last line shows where the run ended
+            if (m_style == ProgressStyle::Json && std::exchange(m_started, false)) {
+                m_executor->submit([this] { printJson(); }).wait();
+            }
             m_executor->shutdown();
         }
 
     private:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr std::chrono::milliseconds s_jsonInterval{ 1000 };
+
+        // One line per interval: progress, rate and remaining time over all the entries, then per entry. The rates are
+        // over the interval since the previous line, the remaining time is that of the slowest entry.
+        void printJson()
+        {
+            auto entries = [this] {
+                std::scoped_lock lock{ m_mutex };
+                return m_entries;
+            }();
+
+            auto now     = Clock::now();
+            auto elapsed = std::chrono::duration<double>(now - m_start).count();
+            auto seconds = std::max(std::chrono::duration<double>(now - m_lastPrint).count(), 1e-3);
+            m_lastPrint  = now;
+            m_lastRays.resize(entries.size(), 0);
+
+            const auto mraysPerSecond = [&](std::uint64_t rays) { return double(rays) / seconds / 1e6; };
+
+            int                            done      = 0;
+            int                            total     = 0;
+            std::uint64_t                  rays      = 0;
+            ProgressBarEntry::TimeInterval remaining = {};
+            std::string                    threads;
+            auto                           out = std::back_inserter(threads);
+
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                const auto& entry = entries[i];
+                auto        delta = entry.rays() - m_lastRays[i];
+                m_lastRays[i]     = entry.rays();
+
+                done      += entry.done();
+                total     += entry.total();
+                rays      += delta;
+                remaining  = std::max(remaining, entry.done() < entry.total() ? entry.calculateRemainingTime() : 0ms);
+
+                fmt::format_to(
+                    out,
+                    R"({}{{"name":{},"done":{},"total":{},"mrays_per_s":{:.3f}}})",
+                    i == 0 ? "" : ",",
+                    jsonString(entry.name()),
+                    entry.done(),
+                    entry.total(),
+                    mraysPerSecond(delta)
+                );
+            }
+
+            auto unit = entries.empty() ? std::string_view{ "steps" } : entries.front().unit();
+            fmt::println(
+                stderr,
+                R"({{"elapsed_s":{:.3f},"percent":{:.2f},"done":{},"total":{},"unit":{},"mrays_per_s":{:.3f},)"
+                R"("eta_s":{:.3f},"threads":[{}]}})",
+                elapsed,
+                total > 0 ? 100.0 * double(done) / double(total) : 0.0,
+                done,
+                total,
+                jsonString(unit),
+                mraysPerSecond(rays),
+                std::chrono::duration<double>(remaining).count(),
+                threads
+            );
+        }
+
+        // `text` as a JSON string, quotes included
+        static std::string jsonString(std::string_view text)
+        {
+            std::string quoted = "\"";
+            for (char c : text) {
+                if (c == '"' || c == '\\') {
+                    quoted += '\\';
+                    quoted += c;
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    quoted += fmt::format("\\u{:04x}", int(c));
+                } else {
+                    quoted += c;
+                }
+            }
+            return quoted + '"';
+        }
+
         void printLoop()
         {
             auto entries = [this] {
@@ -234,9 +395,18 @@ namespace rtr
 
         std::shared_ptr<Executor> m_executor;
         std::mutex                m_mutex;
+        ProgressStyle             m_style;
+
+        // JSON lines, the executor prints them between start() and stop()
+        Clock::time_point          m_start;
+        Clock::time_point          m_lastPrint;
+        std::vector<std::uint64_t> m_lastRays;    // rays of every entry at the previous line
+        bool                       m_started = false;
+
+        using Entries = std::vector<ProgressBarEntry, memory::Allocator<ProgressBarEntry, memory::Subsystem::Progress>>;
 
-        concurrencpp::timer           m_timer;
-        std::vector<ProgressBarEntry> m_entries;
+        concurrencpp::timer m_timer;
+        Entries             m_entries;
     };
 
 }
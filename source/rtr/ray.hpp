@@ -2,9 +2,14 @@
 
 #include "rtr/vec.hpp"
 
+#include <cmath>
+#include <cstddef>
+
 namespace rtr
 {
 
+    // The values derived from the direction that the materials, the background and the bounding box tests need are
+    // computed once here instead of on every use. The direction is left unnormalized, hit distances are in its units.
     class Ray
     {
     public:
@@ -14,16 +19,55 @@ namespace rtr
         Ray(const Point& origin, const Dir& direction)
             : m_origin{ origin }
             , m_direction{ direction }
+            , m_lengthSquared{ vecfn::lengthSquared(direction) }
+            , m_length{ std::sqrt(m_lengthSquared) }
+            , m_unitDirection{ m_length > 0 ? direction / m_length : direction }
+            , m_invDirection{ 1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z() }
+            , m_signBits{ signBitsOf(direction) }
+        {
+        }
+
+        const Dir&   direction() const { return m_direction; }
+        const Point& origin() const { return m_origin; }
+        Point        at(double t) const { return m_origin + t * m_direction; }
+
+        const Dir& unitDirection() const { return m_unitDirection; }
+        const Dir& invDirection() const { return m_invDirection; }    // infinite on the axes the ray is parallel to
+        double     length() const { return m_length; }
+        double     lengthSquared() const { return m_lengthSquared; }
+
+        // bit i is set when the direction is negative along axis i, selects the near and far planes of a box
+        unsigned signBits() const { return m_signBits; }
+        bool     negative(std::size_t axis) const { return (m_signBits >> axis) & 1u; }
+
+        // ray cone used to estimate the footprint of the ray on surfaces (for texture filtering)
+        Ray& setCone(double width, double angle)
         {
+            m_coneWidth = width;
+            m_coneAngle = angle;
+            return *this;
         }
 
-        Dir   direction() const { return m_direction; }
-        Point origin() const { return m_origin; }
-        Point at(double t) const { return m_origin + t * m_direction; }
+        double coneAngle() const { return m_coneAngle; }
+        double coneWidthAt(double t) const { return m_coneWidth + t * m_length * m_coneAngle; }
 
     private:
-        Point m_origin;
-        Dir   m_direction;
+        // the sign bits, not `< 0`: a component of -0.0 has an inverse of -inf and must pick its planes like a negative
+        static unsigned signBitsOf(const Dir& direction)
+        {
+            return unsigned(std::signbit(direction.x())) | unsigned(std::signbit(direction.y())) << 1
+                 | unsigned(std::signbit(direction.z())) << 2;
+        }
+
+        Point    m_origin;
+        Dir      m_direction;
+        double   m_lengthSquared;
+        double   m_length;
+        Dir      m_unitDirection;
+        Dir      m_invDirection;
+        unsigned m_signBits;
+        double   m_coneWidth = 0.0;
+        double   m_coneAngle = 0.0;
     };
 
 }
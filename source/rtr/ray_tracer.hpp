@@ -2,16 +2,42 @@
 
 #include "rtr/color.hpp"
 #include "rtr/common.hpp"
+#include "rtr/cost.hpp"
+#include "rtr/first_hits.hpp"
 #include "rtr/hittable.hpp"
+#include "rtr/image.hpp"
+#include "rtr/light.hpp"
 #include "rtr/progress.hpp"
 #include "rtr/ray.hpp"
+#include "rtr/render_job.hpp"
+#include "rtr/residency.hpp"
+#include "rtr/scene.hpp"
+#include "rtr/thread_pool.hpp"
+#include "rtr/traversal.hpp"
 #include "rtr/util.hpp"
 #include "rtr/vec.hpp"
 
+#include <concurrencpp/concurrencpp.h>
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <concepts>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <ranges>
+#include <span>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
 namespace rtr
@@ -48,33 +74,106 @@ namespace rtr
         double       m_focusDistance;
     };
 
-    struct Image
+    enum class Background
     {
-        std::vector<Color<double>> m_pixels;
-        int                        m_width;
-        int                        m_height;
+        Sky,      // white to blue gradient
+        Black,    // no light from the environment
+    };
+
+    // Render settings that never change during a render. Every combination is compiled into its own kernel so the
+    // per-sample loop doesn't branch on them.
+    struct KernelConfig
+    {
+        bool       m_defocus;
+        bool       m_normalShading;
+        bool       m_lightSampling;    // the scene has emitters (instanced too): add emission and sample the lights
+        Background m_background;
+        int        m_maxDepth;    // 0: use the runtime value
+
+        constexpr bool operator==(const KernelConfig&) const = default;
     };
 
     struct TracerParam
     {
-        double       m_aspectRatio   = 16.0 / 9.0;
-        int          m_height        = 360;
-        int          m_samplingRate  = 100;
-        int          m_maxDepth      = 10;
-        double       m_fov           = 90.0;
-        double       m_focusDistance = 0.80;
-        double       m_defocusAngle  = 10.0;
-        Vec3<double> m_lookFrom      = { 0.0, 0.0, 0.0 };
-        Vec3<double> m_lookAt        = { 0.0, 0.0, -1.0 };
+        double         m_aspectRatio   = 16.0 / 9.0;
+        int            m_height        = 360;
+        int            m_samplingRate  = 100;
+        int            m_maxDepth      = 10;
+        double         m_fov           = 90.0;
+        double         m_focusDistance = 0.80;
+        double         m_defocusAngle  = 10.0;
+        Vec3<double>   m_lookFrom      = { 0.0, 0.0, 0.0 };
+        Vec3<double>   m_lookAt        = { 0.0, 0.0, -1.0 };
+        PixelFormat    m_pixelFormat   = PixelFormat::Float32;
+        bool           m_normalShading = false;    // debug: color by surface normal at the first hit
+        Background     m_background    = Background::Sky;
+        int            m_tileSize      = 16;
+        TraversalOrder m_tileOrder     = TraversalOrder::Scanline;
+        TraversalOrder m_pixelOrder    = TraversalOrder::Scanline;    // within a tile
+        int            m_threads       = 0;                           // 0: one per hardware thread
+        bool           m_pinThreads    = false;
+
+        // Fixed: every pixel draws its samples from its own random stream, so the image is the same whatever the
+        // thread count, tile size or traversal order. Unset: the streams of the threads are not reproducible.
+        std::optional<std::uint64_t> m_seed = std::nullopt;
+
+        // seconds, > 0: run() renders passes over the whole image until the deadline instead of m_samplingRate samples
+        double m_timeBudget = 0.0;
+
+        // diagnostic: run() records the time, rays, intersection tests and path depth of every pixel, see costMaps()
+        bool m_costMaps = false;
+
+        // Pixel rectangle of the frame to render, unset: the whole frame. The camera still covers the whole frame, the
+        // images hold the rectangle only (see region()) and with a fixed seed its pixels are the same as in a full
+        // render, for patching them into an earlier one.
+        std::optional<Tile> m_crop = std::nullopt;
+
+        // Camera ray hits of an earlier render of the same view, for rendering it again after changing materials only.
+        // Empty: the render records them. Filled: the camera rays skip the scene and only intersect the object they hit
+        // then, a view, seed or geometry other than the recording's is rejected. Needs a fixed seed and sampling rate,
+        // and gives every sample its own random stream (see sampleColorAt()).
+        std::shared_ptr<FirstHits> m_firstHits = nullptr;
+
+        // reuse the workers of another tracer, overrides m_threads and m_pinThreads
+        std::shared_ptr<ThreadPool> m_threadPool = nullptr;
+    };
+
+    // what a time-budgeted run() managed to do, pixels on the tiles reached by the last, cut short, pass got one pass
+    // more than the others
+    struct BudgetReport
+    {
+        double m_seconds;
+        int    m_passes;
+        int    m_minSamples;
+        int    m_maxSamples;
+        double m_meanSamples;
     };
 
+    template <typename T>
+    concept RowSink = std::invocable<T&, std::span<const Color<double>>>;
+
     class RayTracer
     {
     public:
         RayTracer(HittableList&& world, TracerParam param)
+            : RayTracer{ std::make_shared<const Scene>(std::move(world)), std::move(param) }
+        {
+        }
+
+        RayTracer(std::shared_ptr<const Scene> scene, TracerParam param)
             : m_aspectRatio{ param.m_aspectRatio }
-            , m_world{ std::move(world) }
+            , m_scene{ std::move(scene) }
             , m_samplesPerPixel{ param.m_samplingRate }
+            , m_timeBudget{ param.m_timeBudget }
+            , m_recordCost{ param.m_costMaps }
+            , m_pixelFormat{ param.m_pixelFormat }
+            , m_seed{ param.m_seed }
+            , m_tileSize{ std::max(param.m_tileSize, 1) }
+            , m_tileOrder{ param.m_tileOrder }
+            , m_pixelOrder{ param.m_pixelOrder }
+            , m_threads{ param.m_threads }
+            , m_pinThreads{ param.m_pinThreads }
+            , m_pool{ std::move(param.m_threadPool) }
         {
             Vec worldUp = { 0.0, 1.0, 0.0 };
 
@@ -111,6 +210,26 @@ namespace rtr
                 .m_height = height,
             };
 
+            m_region = param.m_crop.value_or(Tile{ 0, 0, width, height });
+            {
+                auto left   = std::max(m_region.m_x, 0);
+                auto top    = std::max(m_region.m_y, 0);
+                auto right  = std::min(m_region.m_x + m_region.m_width, width);
+                auto bottom = std::min(m_region.m_y + m_region.m_height, height);
+                if (right <= left || bottom <= top) {
+                    throw std::invalid_argument{ fmt::format(
+                        "Crop window {}x{} at ({}, {}) is outside of the {}x{} frame",
+                        m_region.m_width,
+                        m_region.m_height,
+                        m_region.m_x,
+                        m_region.m_y,
+                        width,
+                        height
+                    ) };
+                }
+                m_region = { left, top, right - left, bottom - top };
+            }
+
             m_camera = {
                 .m_center        = camCenter,
                 .m_viewUp        = viewUp,
@@ -134,97 +253,813 @@ namespace rtr
                 .m_pixel00Loc = pixel00Loc,
             };
 
+            // angle subtended by a pixel, the initial spread of the primary ray cones
+            m_pixelSpreadAngle = vecfn::length(viewport_du) / param.m_focusDistance;
+
+            if (param.m_firstHits) {
+                useFirstHits(std::move(param.m_firstHits), param);
+            }
+
             m_maxDepth = param.m_maxDepth;
+            m_kernel   = selectKernel({
+                .m_defocus       = param.m_defocusAngle > 0,
+                .m_normalShading = param.m_normalShading,
+                .m_lightSampling = m_scene->lights().emission(),
+                .m_background    = param.m_background,
+                .m_maxDepth      = param.m_maxDepth,
+            });
         }
 
         Image run(rtr::ProgressBarManager& progressBar)
         {
-            const int concurrencyLevel = (int)std::thread::hardware_concurrency();
-            const int chunkSize        = m_dimension.m_height / concurrencyLevel;
+            if (m_recordCost) {
+                m_costMaps.emplace(m_region.m_width, m_region.m_height);
+            }
+
+            if (m_timeBudget > 0) {
+                return runBudgeted(progressBar);
+            }
+
+            auto&     pool             = *threadPool();
+            const int concurrencyLevel = pool.size();
+
+            // consecutive rays on a thread stay close together when the tiles and the pixels within them follow a
+            // space filling curve, so they keep touching the same objects
+            const auto width      = m_region.m_width;
+            const auto height     = m_region.m_height;
+            const auto tileWidth  = std::min(m_tileSize, width);
+            const auto tileHeight = std::min(m_tileSize, height);
+            const auto tiles      = traversal::makeTiles(width, height, m_tileSize, m_tileOrder);
+            const auto pixelOrder = traversal::order(tileWidth, tileHeight, m_pixelOrder);
+            const auto tileRows   = (height + m_tileSize - 1) / m_tileSize;
+
+            // Every worker owns a band of tile rows. It places that part of the framebuffer in its own memory (first
+            // touch) and renders those tiles first, in curve order, then helps the workers that are still busy.
+            std::vector<std::vector<Tile>> owned((std::size_t)concurrencyLevel);
+            for (const auto& tile : tiles) {
+                owned[std::size_t((tile.m_y / m_tileSize) * concurrencyLevel / tileRows)].push_back(tile);
+            }
+            const auto bandStart = [&](int worker) {
+                auto tileRow = (worker * tileRows + concurrencyLevel - 1) / concurrencyLevel;
+                return std::min(tileRow * m_tileSize, height);
+            };
 
-            fmt::println("Concurrency level = {} | chunk size: {}", concurrencyLevel, chunkSize);
+            fmt::println(
+                "Concurrency level = {}{} | tiles: {} of {}px ({} order, {} pixels) | pixel format: {}",
+                concurrencyLevel,
+                pool.pinned() ? " (pinned)" : "",
+                tiles.size(),
+                m_tileSize,
+                toString(m_tileOrder),
+                toString(m_pixelOrder),
+                toString(m_pixelFormat)
+            );
 
-            std::vector<Color<double>> pixels(std::size_t(m_dimension.m_width * m_dimension.m_height));
-            std::vector<std::jthread>  threads;
-            threads.reserve((std::size_t)concurrencyLevel);
+            Image image{ width, height, m_pixelFormat, Image::Uninitialized{} };
+            pool.parallel([&](int worker) { image.clearRows(bandStart(worker), bandStart(worker + 1)); });
 
-            // each thread now works on interleaved rows
+            std::vector<std::string> names;
             for (auto i : rv::iota(0, concurrencyLevel)) {
-                std::string name = fmt::format("render thread {}", i);
-                auto numSteps = (chunkSize * concurrencyLevel + i < m_dimension.m_height) ? chunkSize + 1 : chunkSize;
-                progressBar.add(name, 0, numSteps);
-
-                threads.emplace_back([=, this, &pixels, &progressBar, name = std::move(name)] {
-                    for (auto count : rv::iota(0, numSteps)) {
-                        auto row = (count * concurrencyLevel) + i;
-                        progressBar.update(name, count + 1);
-
-                        for (auto col : rv::iota(0, m_dimension.m_width)) {
-                            auto rowSize = std::size_t(m_dimension.m_width);
-                            auto idx     = (std::size_t)row * rowSize + (std::size_t)col;
-                            pixels[idx]  = colorfn::clamp(sampleColorAt(col, row), { 0.0, 1.0 });
+                names.push_back(fmt::format("render thread {}", i));
+                progressBar.add(names.back(), 0, std::max((int)owned[(std::size_t)i].size(), 1), "tiles");
+            }
+
+            std::vector<std::atomic<int>> cursors((std::size_t)concurrencyLevel);
+            std::vector<std::atomic<int>> done((std::size_t)concurrencyLevel);
+
+            // tiles that are rendered again after a deferral add the cost of both renders
+            auto* costMaps = m_costMaps ? &*m_costMaps : nullptr;
+
+            // tiles that reached geometry which wasn't loaded yet, rendered again once everything else is done
+            std::mutex        deferredMutex;
+            std::vector<Tile> deferred;
+
+            // `rays`: traced for the tile, they count for the thread owning it
+            const auto store = [&](const Tile& tile, std::span<const Color<double>> tilePixels, std::uint64_t rays) {
+                for (auto row : rv::iota(0, tile.m_height)) {
+                    auto rowPixels = tilePixels.subspan(std::size_t(row * tile.m_width));
+                    image.setSpan(tile.m_x, tile.m_y + row, rowPixels.first(std::size_t(tile.m_width)));
+                }
+                auto owner = std::size_t((tile.m_y / m_tileSize) * concurrencyLevel / tileRows);
+                progressBar.update(names[owner], done[owner].fetch_add(1, std::memory_order_relaxed) + 1, rays);
+            };
+
+            pool.parallel([&](int worker) {
+                // accumulate a tile in full precision, then store it in the image's pixel format
+                std::vector<Color<double>> tilePixels(std::size_t(tileWidth) * std::size_t(tileHeight));
+
+                auto& deferral       = residency::state();
+                deferral.m_deferring = true;
+
+                for (auto offset : rv::iota(0, concurrencyLevel)) {
+                    auto        owner = std::size_t((worker + offset) % concurrencyLevel);
+                    const auto& queue = owned[owner];
+
+                    while (true) {
+                        auto next = cursors[owner].fetch_add(1, std::memory_order_relaxed);
+                        if (next >= (int)queue.size()) {
+                            break;
                         }
+
+                        const auto& tile  = queue[(std::size_t)next];
+                        const auto  rays  = cost::counters().m_rays;
+                        deferral.m_missed = false;
+                        renderTile(tile, pixelOrder, tilePixels, costMaps);
+
+                        if (deferral.m_missed) {
+                            std::scoped_lock lock{ deferredMutex };
+                            deferred.push_back(tile);
+                        } else {
+                            store(tile, tilePixels, cost::counters().m_rays - rays);
+                        }
+                    }
+                }
+
+                deferral.m_deferring = false;
+            });
+
+            if (!deferred.empty()) {
+                fmt::println("{} tiles waited for geometry to load", deferred.size());
+
+                std::atomic<std::size_t> next = 0;
+                pool.parallel([&](int) {
+                    std::vector<Color<double>> tilePixels(std::size_t(tileWidth) * std::size_t(tileHeight));
+                    for (auto i = next.fetch_add(1); i < deferred.size(); i = next.fetch_add(1)) {
+                        auto rays = cost::counters().m_rays;
+                        renderTile(deferred[i], pixelOrder, tilePixels, costMaps);
+                        store(deferred[i], tilePixels, cost::counters().m_rays - rays);
                     }
                 });
             }
 
-            for (auto& thread : threads) {
-                thread.join();
-            }
+            return image;
+        }
+
+        // Render the image in bands of rows and hand them to `sink` in row-major order as soon as they are complete.
+        // Bands that finish out of order wait in a small reorder buffer; workers that run too far ahead block until
+        // the writer catches up, so peak memory depends on the thread count and band height, not on the resolution.
+        template <RowSink Sink>
+        void stream(rtr::ProgressBarManager& progressBar, Sink&& sink, int bandHeight = 16)
+        {
+            auto&     pool             = *threadPool();
+            const int concurrencyLevel = pool.size();
+            const int numBands         = (m_region.m_height + bandHeight - 1) / bandHeight;
+            const int window           = 2 * concurrencyLevel;    // max bands in flight ahead of the writer
+
+            fmt::println("Concurrency level = {} | band height: {} ({} bands)", concurrencyLevel, bandHeight, numBands);
+
+            std::mutex              mutex;
+            std::condition_variable cond;
+
+            std::map<int, std::vector<Color<double>>> pending;    // reorder buffer
+            std::vector<std::vector<Color<double>>>   freeBuffers;
+
+            int                nextToWrite = 0;
+            bool               flushing    = false;
+            std::exception_ptr error;
+
+            // the thread that completes the next band in order becomes the writer until it runs out of ready bands
+            const auto submit = [&](int band, std::vector<Color<double>>&& pixels) {
+                std::unique_lock lock{ mutex };
+                pending.emplace(band, std::move(pixels));
+
+                if (flushing) {
+                    return;
+                }
+                flushing = true;
 
-            return {
-                .m_pixels = std::move(pixels),
-                .m_width  = m_dimension.m_width,
-                .m_height = m_dimension.m_height,
+                while (!error && !pending.empty() && pending.begin()->first == nextToWrite) {
+                    auto node = pending.extract(pending.begin());
+                    lock.unlock();
+
+                    try {
+                        sink(std::span<const Color<double>>{ node.mapped() });
+                    } catch (...) {
+                        lock.lock();
+                        error = std::current_exception();
+                        break;
+                    }
+
+                    lock.lock();
+                    freeBuffers.push_back(std::move(node.mapped()));
+                    ++nextToWrite;
+                    cond.notify_all();
+                }
+
+                flushing = false;
+                cond.notify_all();
             };
+
+            std::vector<std::string> names;
+            for (auto i : rv::iota(0, concurrencyLevel)) {
+                auto numSteps = (numBands - i + concurrencyLevel - 1) / concurrencyLevel;
+                names.push_back(fmt::format("render thread {}", i));
+                progressBar.add(names.back(), 0, std::max(numSteps, 1), "bands");
+            }
+
+            // each worker works on interleaved bands
+            pool.parallel([&](int i) {
+                auto numSteps = (numBands - i + concurrencyLevel - 1) / concurrencyLevel;
+
+                for (auto count : rv::iota(0, numSteps)) {
+                    auto band  = (count * concurrencyLevel) + i;
+                    auto first = band * bandHeight;
+                    auto last  = std::min(first + bandHeight, m_region.m_height);
+
+                    std::vector<Color<double>> pixels;
+                    {
+                        std::unique_lock lock{ mutex };
+                        cond.wait(lock, [&] { return error || band < nextToWrite + window; });
+                        if (error) {
+                            return;
+                        }
+                        if (!freeBuffers.empty()) {
+                            pixels = std::move(freeBuffers.back());
+                            freeBuffers.pop_back();
+                        }
+                    }
+
+                    auto rays = cost::counters().m_rays;
+                    try {
+                        pixels.resize(std::size_t((last - first) * m_region.m_width));
+                        for (auto row : rv::iota(first, last)) {
+                            for (auto col : rv::iota(0, m_region.m_width)) {
+                                auto rowSize = std::size_t(m_region.m_width);
+                                auto idx     = (std::size_t)(row - first) * rowSize + (std::size_t)col;
+                                auto color   = samplePixel(col, row, 0, m_samplesPerPixel, nullptr);
+                                pixels[idx]  = colorfn::clamp(color, { 0.0, 1.0 });
+                            }
+                        }
+                    } catch (...) {
+                        // the band will never be written, wake the workers waiting for it so that they stop too
+                        std::scoped_lock lock{ mutex };
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                        cond.notify_all();
+                        return;
+                    }
+
+                    rays = cost::counters().m_rays - rays;
+                    submit(band, std::move(pixels));
+                    progressBar.update(names[(std::size_t)i], count + 1, rays);
+                }
+            });
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        // Start rendering on `executor` and return right away, the image is the value of the result. The render runs as
+        // a few coroutine lanes that each take one tile at a time and requeue themselves on the executor in between,
+        // so renders submitted to the same executor take turns instead of running one after the other. `job` is
+        // used to cancel the render (the result then throws RenderCancelled) and to look at it while it runs.
+        // The tracer must outlive the render.
+        concurrencpp::result<Image> submit(
+            std::shared_ptr<concurrencpp::executor> executor,
+            std::shared_ptr<RenderJob>              job = std::make_shared<RenderJob>()
+        ) const
+        {
+            auto queue = std::make_shared<TileQueue>();
+
+            const auto width  = m_region.m_width;
+            const auto height = m_region.m_height;
+
+            const auto tileWidth  = std::min(m_tileSize, width);
+            const auto tileHeight = std::min(m_tileSize, height);
+
+            queue->m_tiles      = traversal::makeTiles(width, height, m_tileSize, m_tileOrder);
+            queue->m_pixelOrder = traversal::order(tileWidth, tileHeight, m_pixelOrder);
+
+            job->begin(width, height, m_pixelFormat, queue->m_tiles.size());
+
+            auto numLanes = std::clamp(executor->max_concurrency_level(), 1, std::max((int)queue->m_tiles.size(), 1));
+
+            std::vector<concurrencpp::result<void>> lanes;
+            for (auto i [[maybe_unused]] : rv::iota(0, numLanes)) {
+                lanes.push_back(renderLane(executor, job, queue));
+            }
+
+            // wait for every lane even after a failure, they all use this tracer
+            std::exception_ptr error;
+            for (auto& lane : lanes) {
+                try {
+                    co_await lane;
+                } catch (...) {
+                    if (!error) {
+                        error = std::current_exception();
+                        job->cancel();
+                    }
+                }
+            }
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            if (job->cancelled()) {
+                throw RenderCancelled{};
+            }
+
+            co_return job->finish();
+        }
+
+        Dimension dimension() const { return m_dimension; }
+
+        // the pixels of the frame that are rendered: the crop window or the whole frame, images start at its corner
+        Tile region() const { return m_region; }
+
+        // set by the last time-budgeted run()
+        const std::optional<BudgetReport>& budgetReport() const { return m_budgetReport; }
+
+        // set by the last run() with TracerParam::m_costMaps
+        const std::optional<cost::CostMaps>& costMaps() const { return m_costMaps; }
+
+        // the workers of run() and stream(), only started on first use as submit() runs on the caller's executor
+        std::shared_ptr<ThreadPool> threadPool()
+        {
+            std::call_once(m_poolOnce, [this] {
+                if (!m_pool) {
+                    m_pool = std::make_shared<ThreadPool>(m_threads, m_pinThreads);
+                }
+            });
+            return m_pool;
         }
 
     private:
-        Color<double> rayColor(const Ray& ray, int depth = 0) const
+        // average of the samples [firstSample, firstSample + numSamples) of a pixel
+        using Kernel = Color<double> (RayTracer::*)(int col, int row, int firstSample, int numSamples) const;
+
+        // spread of the ray cone after a diffuse bounce, roughly the lobe width seen by a texture lookup
+        static constexpr double s_diffuseConeAngle = 0.2;
+
+        // depths common enough to get their own loop bound, anything else uses the runtime m_maxDepth
+        static constexpr std::array s_fixedDepths = { 0, 10, 25, 50 };
+
+        // Normal shading stops at the first hit, before the depth loop or the lights matter: its kernels only vary by
+        // defocus and background.
+        static constexpr auto s_kernelConfigs = [] {
+            std::array<KernelConfig, 2 * 2 * 2 * s_fixedDepths.size() + 2 * 2> configs{};
+
+            std::size_t i = 0;
+            for (bool defocus : { false, true }) {
+                for (auto background : { Background::Sky, Background::Black }) {
+                    for (bool lightSampling : { false, true }) {
+                        for (int depth : s_fixedDepths) {
+                            configs[i++] = { defocus, false, lightSampling, background, depth };
+                        }
+                    }
+                    configs[i++] = { defocus, true, false, background, 0 };
+                }
+            }
+            return configs;
+        }();
+
+        static Kernel selectKernel(KernelConfig config)
+        {
+            if (config.m_normalShading) {
+                config.m_lightSampling = false;
+                config.m_maxDepth      = 0;
+            } else if (rr::find(s_fixedDepths, config.m_maxDepth) == s_fixedDepths.end()) {
+                config.m_maxDepth = 0;
+            }
+
+            const auto select = [&]<std::size_t... I>(std::index_sequence<I...>) {
+                Kernel kernel = nullptr;
+                ((kernel = (config == s_kernelConfigs[I] ? &RayTracer::sampleColorAt<s_kernelConfigs[I]> : kernel)), ...);
+                return kernel;
+            };
+            return select(std::make_index_sequence<s_kernelConfigs.size()>{});
+        }
+
+        // Check that the hits were recorded for this view and scene geometry, or make room for recording them.
+        void useFirstHits(std::shared_ptr<FirstHits> firstHits, const TracerParam& param)
+        {
+            if (!m_seed.has_value() || m_timeBudget > 0) {
+                throw std::invalid_argument{ "First hits need a fixed seed and sampling rate, not a time budget" };
+            }
+
+            m_objectTable = ObjectTable{ m_scene->world() };
+
+            // everything the camera rays depend on
+            const auto& lookFrom = param.m_lookFrom;
+            const auto& lookAt   = param.m_lookAt;
+
+            auto view = fmt::format(
+                "{}x{} {},{},{},{} {} {}\n{},{},{} {},{},{} {} {} {}\n",
+                m_dimension.m_width,
+                m_dimension.m_height,
+                m_region.m_x,
+                m_region.m_y,
+                m_region.m_width,
+                m_region.m_height,
+                m_samplesPerPixel,
+                *m_seed,
+                lookFrom.x(),
+                lookFrom.y(),
+                lookFrom.z(),
+                lookAt.x(),
+                lookAt.y(),
+                lookAt.z(),
+                param.m_fov,
+                param.m_focusDistance,
+                param.m_defocusAngle
+            );
+            auto key = util::hashBytes(view, m_objectTable.geometryHash());
+
+            auto numSamples = std::size_t(m_region.m_width) * std::size_t(m_region.m_height)
+                            * std::size_t(m_samplesPerPixel);
+            if (firstHits->empty()) {
+                firstHits->reset(key, m_region.m_width, m_region.m_height, m_samplesPerPixel);
+            } else if (firstHits->key() != key || firstHits->size() != numSamples) {
+                throw std::invalid_argument{ "The first hits were recorded for another view, sampling or geometry" };
+            } else {
+                m_replayFirstHits = true;
+            }
+            m_firstHits = std::move(firstHits);
+        }
+
+        struct TileQueue
+        {
+            std::vector<Tile>                m_tiles;
+            std::vector<std::pair<int, int>> m_pixelOrder;
+            std::atomic<std::size_t>         m_next = 0;
+        };
+
+        concurrencpp::result<void> renderLane(
+            std::shared_ptr<concurrencpp::executor> executor,
+            std::shared_ptr<RenderJob>              job,
+            std::shared_ptr<TileQueue>              queue
+        ) const
+        {
+            std::vector<Color<double>> pixels;
+
+            while (true) {
+                // the first time this moves off the caller's thread, then it goes behind the work of other renders
+                co_await concurrencpp::resume_on(executor);
+
+                auto next = queue->m_next.fetch_add(1, std::memory_order_relaxed);
+                if (job->cancelled() || next >= queue->m_tiles.size()) {
+                    co_return;
+                }
+
+                const auto& tile = queue->m_tiles[next];
+                pixels.resize(std::size_t(tile.m_width) * std::size_t(tile.m_height));
+                renderTile(tile, queue->m_pixelOrder, pixels);
+                job->store(tile, pixels);
+            }
+        }
+
+        // pixels are stored row-major in `pixels` with a stride of the tile width
+        using PixelOrder = std::span<const std::pair<int, int>>;
+
+        void renderTile(
+            const Tile&              tile,
+            PixelOrder               pixelOrder,
+            std::span<Color<double>> pixels,
+            cost::CostMaps*          costMaps = nullptr
+        ) const
+        {
+            for (auto [x, y] : pixelOrder) {
+                if (x >= tile.m_width || y >= tile.m_height) {
+                    continue;    // partial tile on the image edge
+                }
+                auto color = samplePixel(tile.m_x + x, tile.m_y + y, 0, m_samplesPerPixel, costMaps);
+
+                pixels[std::size_t(y * tile.m_width + x)] = colorfn::clamp(color, { 0.0, 1.0 });
+            }
+        }
+
+        // The kernel at (col, row) of the region, recording what the samples cost when `costMaps` is set. The kernel
+        // takes frame coordinates, the pixels of a crop window look and sample the same as in the whole frame.
+        Color<double> samplePixel(int col, int row, int firstSample, int numSamples, cost::CostMaps* costMaps) const
+        {
+            auto frameCol = m_region.m_x + col;
+            auto frameRow = m_region.m_y + row;
+            if (costMaps == nullptr) {
+                return (this->*m_kernel)(frameCol, frameRow, firstSample, numSamples);
+            }
+
+            auto& work   = cost::counters();
+            auto  before = work;
+            auto  start  = std::chrono::steady_clock::now();
+            auto  color  = (this->*m_kernel)(frameCol, frameRow, firstSample, numSamples);
+            auto  time   = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+            const cost::Counters spent{
+                .m_rays     = work.m_rays - before.m_rays,
+                .m_segments = work.m_segments - before.m_segments,
+                .m_tests    = work.m_tests - before.m_tests,
+            };
+            costMaps->record(col, row, time.count(), spent, numSamples);
+            return color;
+        }
+
+        // Render passes of a few samples over every pixel until the time budget runs out. The first pass takes one
+        // sample per pixel and times it, later passes are sized to a fraction of the budget so that the pass cut short
+        // by the deadline changes little. Every pixel is divided by the number of samples it actually got.
+        Image runBudgeted(rtr::ProgressBarManager& progressBar)
+        {
+            using Clock   = std::chrono::steady_clock;
+            using Seconds = std::chrono::duration<double>;
+
+            // a pass should take about this fraction of the budget
+            static constexpr double passFraction = 1.0 / 16.0;
+
+            auto&     pool             = *threadPool();
+            const int concurrencyLevel = pool.size();
+
+            const auto width      = m_region.m_width;
+            const auto height     = m_region.m_height;
+            const auto tileWidth  = std::min(m_tileSize, width);
+            const auto tileHeight = std::min(m_tileSize, height);
+            const auto tiles      = traversal::makeTiles(width, height, m_tileSize, m_tileOrder);
+            const auto pixelOrder = traversal::order(tileWidth, tileHeight, m_pixelOrder);
+
+            fmt::println(
+                "Concurrency level = {}{} | tiles: {} of {}px | time budget: {:.2f}s | pixel format: {}",
+                concurrencyLevel,
+                pool.pinned() ? " (pinned)" : "",
+                tiles.size(),
+                m_tileSize,
+                m_timeBudget,
+                toString(m_pixelFormat)
+            );
+
+            const auto start    = Clock::now();
+            const auto deadline = start + std::chrono::duration_cast<Clock::duration>(Seconds{ m_timeBudget });
+            const auto numMs    = std::max(int(m_timeBudget * 1000.0), 1);
+
+            std::vector<Color<double>> sums(std::size_t(width) * std::size_t(height), Color<double>{ 0.0, 0.0, 0.0 });
+            std::vector<int>           counts(sums.size(), 0);
+
+            const std::string name = "time budget";
+            progressBar.add(name, 0, numMs, "ms");
+
+            auto* costMaps = m_costMaps ? &*m_costMaps : nullptr;
+
+            int  passes      = 0;
+            int  firstSample = 0;
+            int  passSamples = 1;
+            bool expired     = false;
+
+            while (!expired) {
+                auto passStart = Clock::now();
+
+                std::atomic<std::size_t> next     = 0;
+                std::atomic<bool>        cutShort = false;
+
+                pool.parallel([&](int) {
+                    while (true) {
+                        // checked between tiles, so the deadline is missed by at most one tile
+                        if (Clock::now() >= deadline) {
+                            cutShort.store(true, std::memory_order_relaxed);
+                            return;
+                        }
+
+                        auto index = next.fetch_add(1, std::memory_order_relaxed);
+                        if (index >= tiles.size()) {
+                            return;
+                        }
+
+                        const auto& tile = tiles[index];
+                        const auto  rays = cost::counters().m_rays;
+                        for (auto [x, y] : pixelOrder) {
+                            if (x >= tile.m_width || y >= tile.m_height) {
+                                continue;
+                            }
+                            auto col   = tile.m_x + x;
+                            auto row   = tile.m_y + y;
+                            auto idx   = std::size_t(row) * std::size_t(width) + std::size_t(col);
+                            auto color = samplePixel(col, row, firstSample, passSamples, costMaps);
+
+                            sums[idx]   += color * double(passSamples);
+                            counts[idx] += passSamples;
+                        }
+
+                        // every worker reports its rays, the elapsed time may go back by a few milliseconds
+                        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+                        progressBar.update(name, std::min(int(elapsed.count()), numMs), cost::counters().m_rays - rays);
+                    }
+                });
+
+                ++passes;
+                firstSample += passSamples;
+                expired      = cutShort.load(std::memory_order_relaxed) || Clock::now() >= deadline;
+
+                // size the next pass from the time per sample of this one, never past the remaining time
+                auto now       = Clock::now();
+                auto perSample = Seconds{ now - passStart }.count() / double(passSamples);
+                auto remaining = Seconds{ deadline - now }.count();
+                auto target    = std::min(passFraction * m_timeBudget, remaining);
+                passSamples    = std::max(int(target / std::max(perSample, 1e-9)), 1);
+            }
+
+            Image image{ width, height, m_pixelFormat, Image::Uninitialized{} };
+            pool.parallel([&](int worker) {
+                for (int row = worker; row < height; row += concurrencyLevel) {
+                    for (int col = 0; col < width; ++col) {
+                        auto idx   = std::size_t(row) * std::size_t(width) + std::size_t(col);
+                        auto color = counts[idx] > 0 ? sums[idx] / double(counts[idx]) : Color<double>{ 0.0, 0.0, 0.0 };
+                        image.set(col, row, colorfn::clamp(color, { 0.0, 1.0 }));
+                    }
+                }
+            });
+
+            auto [minCount, maxCount] = rr::minmax(counts);
+            auto totalSamples         = std::accumulate(counts.begin(), counts.end(), 0.0);
+
+            m_budgetReport = BudgetReport{
+                .m_seconds     = Seconds{ Clock::now() - start }.count(),
+                .m_passes      = passes,
+                .m_minSamples  = minCount,
+                .m_maxSamples  = maxCount,
+                .m_meanSamples = totalSamples / double(counts.size()),
+            };
+
+            progressBar.update(name, numMs);
+            fmt::println(
+                "Time budget: {} passes in {:.2f}s, {:.1f} spp on average (min {}, max {})",
+                m_budgetReport->m_passes,
+                m_budgetReport->m_seconds,
+                m_budgetReport->m_meanSamples,
+                m_budgetReport->m_minSamples,
+                m_budgetReport->m_maxSamples
+            );
+
+            return image;
+        }
+
+        template <Background B>
+        static Color<double> background(const Ray& ray)
         {
-            if (depth > m_maxDepth) {
+            if constexpr (B == Background::Black) {
                 return { 0.0, 0.0, 0.0 };
+            } else {
+                static const Color<> white{ 1.0, 1.0, 1.0 };
+                static const Color<> blueMinusWhite{ -0.5, -0.3, 0.0 };    // blue = { 0.5, 0.7, 1.0 }
+
+                // linear blend (lerp) between white and blue
+                auto a = 0.5 * (ray.unitDirection().y() + 1.0);
+                return white + a * blueMinusWhite;
             }
+        }
+
+        // `firstHit`: the entry of the camera ray in the first hits, if any
+        template <KernelConfig C>
+        Color<double> rayColor(Ray ray, std::uint32_t* firstHit) const
+        {
+            const int maxDepth = C.m_maxDepth > 0 ? C.m_maxDepth : m_maxDepth;
+
+            auto& work = cost::counters();
+
+            Color<> radiance{ 0.0, 0.0, 0.0 };
+            Color<> throughput{ 1.0, 1.0, 1.0 };
+
+            // previous bounce, for weighting emission found by bsdf sampling against direct light sampling
+            double       prevPdf = 0.0;    // 0: camera ray or specular bounce, emission is not sampled directly
+            Vec3<double> prevPoint;
 
-            if (auto hit = m_world.hit(ray, { 0.001, n::infinity }); hit.has_value()) {
-                auto [record, material] = std::move(hit).value();
+            for (int depth = 0; depth <= maxDepth; ++depth) {
+                ++work.m_rays;
+                ++work.m_segments;
 
-                if (!material) {
-                    // no material, use normal as color
+                auto hit = depth == 0 && firstHit != nullptr ? cameraHit(ray, *firstHit)
+                                                             : m_scene->world().hit(ray, { 0.001, n::infinity });
+                if (!hit.has_value()) {
+                    // missed, use background color
+                    return radiance + throughput * background<C.m_background>(ray);
+                }
+
+                const auto& [record, material, object] = *hit;
+
+                if constexpr (C.m_normalShading) {
                     Color<> offset{ 1.0, 1.0, 1.0 };
                     return 0.5 * (record.m_normal + offset);
                 }
 
-                if (auto scatter = material->scatter(ray, record); scatter.has_value()) {
-                    auto [newRay, attenuation] = std::move(scatter).value();
-                    return attenuation * rayColor(newRay, depth + 1);
+                if constexpr (C.m_lightSampling) {
+                    if (material->emissive()) {
+                        auto lightPdf = prevPdf > 0 ? m_scene->lights().pdf(*object, prevPoint) : 0.0;
+                        auto weight   = prevPdf > 0 ? powerHeuristic(prevPdf, lightPdf) : 1.0;
+                        radiance     += throughput * material->emitted(ray, record) * weight;
+                    }
+                }
+
+                auto scatter = material->scatter(ray, record);
+                if (!scatter.has_value()) {
+                    return radiance;
                 }
+
+                if constexpr (C.m_lightSampling) {
+                    if (scatter->m_pdf > 0) {
+                        radiance += throughput * sampleDirectLight(record, *material);
+                    }
+                }
+
+                // diffuse bounces widen the ray cone, specular ones keep its spread
+                auto coneWidth = ray.coneWidthAt(record.m_t);
+                auto coneAngle = scatter->m_pdf > 0 ? std::max(ray.coneAngle(), s_diffuseConeAngle) : ray.coneAngle();
+
+                throughput *= scatter->m_attenuation;
+                prevPdf     = scatter->m_pdf;
+                prevPoint   = record.m_point;
+                ray         = scatter->m_ray.setCone(coneWidth, coneAngle);
             }
 
-            // missed, use background color
-            auto dir = vecfn::normalized(ray.direction());
+            return radiance;
+        }
 
-            auto          a = 0.5 * (dir.y() + 1.0);
-            const Color<> white{ 1.0, 1.0, 1.0 };
-            const Color<> blue{ 0.5, 0.7, 1.0 };
+        // the hit of a camera ray, recorded in its first hits entry or taken from it
+        std::optional<HitResult> cameraHit(const Ray& ray, std::uint32_t& entry) const
+        {
+            if (m_replayFirstHits && entry != FirstHits::s_traced) {
+                if (entry == FirstHits::s_miss) {
+                    return std::nullopt;
+                }
+                ++cost::counters().m_tests;
+                return m_objectTable.at(entry).hit(ray, { 0.001, n::infinity });
+            }
 
-            // linear blend (lerp)
-            return (1.0 - a) * white + a * blue;
+            auto hit = m_scene->world().hit(ray, { 0.001, n::infinity });
+            if (!m_replayFirstHits) {
+                entry = hit.has_value() ? m_objectTable.indexOf(hit->m_object).value_or(FirstHits::s_traced)
+                                        : FirstHits::s_miss;
+            }
+            return hit;
+        }
+
+        // next event estimation: one shadow ray toward a randomly chosen light, weighted against bsdf sampling
+        Color<double> sampleDirectLight(const HitRecord& record, const Material& material) const
+        {
+            auto choice = m_scene->lights().sample(record.m_point);
+            if (!choice.has_value()) {
+                return { 0.0, 0.0, 0.0 };
+            }
+
+            const auto& [light, sample] = *choice;
+
+            auto bsdf = material.evaluate(record, sample.m_direction);
+            if (!bsdf.has_value()) {
+                return { 0.0, 0.0, 0.0 };
+            }
+
+            Ray  shadowRay{ record.m_point, sample.m_direction };
+            auto lightHit = light->hit(shadowRay, { 0.001, n::infinity });
+            if (!lightHit.has_value()) {
+                return { 0.0, 0.0, 0.0 };
+            }
+
+            ++cost::counters().m_rays;
+
+            auto tLight = lightHit->m_record.m_t;
+            if (m_scene->world().occluded(shadowRay, { 0.001, tLight * (1.0 - 1e-6) })) {
+                return { 0.0, 0.0, 0.0 };
+            }
+
+            auto emitted = lightHit->m_material->emitted(shadowRay, lightHit->m_record);
+            auto weight  = powerHeuristic(sample.m_pdf, bsdf->m_pdf);
+            return bsdf->m_value * emitted * (weight / sample.m_pdf);
         }
 
-        Color<double> sampleColorAt(int col, int row) const
+        template <KernelConfig C>
+        Color<double> sampleColorAt(int col, int row, int firstSample, int numSamples) const
         {
+            const auto pixel = std::uint64_t(row) << 32 | std::uint32_t(col);
+            if (m_seed.has_value()) {
+                util::seedRandom(util::mixBits(*m_seed + std::uint64_t(firstSample)) ^ pixel);
+            }
+
             Color<> accumulatedColor{ 0.0, 0.0, 0.0 };
             auto    pixelCenter = m_viewport.m_pixel00Loc + (col * m_viewport.m_du) + (row * m_viewport.m_dv);
 
-            for (auto i [[maybe_unused]] : rv::iota(0, m_samplesPerPixel)) {
-                auto pixelSample   = pixelCenter + sampleUnitSquare();
-                auto rayOrigin     = m_camera.m_defocusAngle <= 0 ? m_camera.m_center : defocusDiskSample();
+            std::uint32_t* firstHits = nullptr;
+            if (m_firstHits) {
+                firstHits = m_firstHits->pixel(col - m_region.m_x, row - m_region.m_y).subspan(firstSample).data();
+            }
+
+            for (auto i : rv::iota(0, numSamples)) {
+                // Every sample starts its own stream, so that its camera ray doesn't depend on what the materials of
+                // the samples before drew. Sample 0 is the same as without first hits, the others only differ by noise.
+                if (firstHits != nullptr && i > 0) {
+                    util::seedRandom(util::mixBits(*m_seed + std::uint64_t(firstSample + i)) ^ pixel);
+                }
+
+                auto pixelSample = pixelCenter + sampleUnitSquare();
+
+                Vec3<double> rayOrigin;
+                if constexpr (C.m_defocus) {
+                    rayOrigin = defocusDiskSample();
+                } else {
+                    rayOrigin = m_camera.m_center;
+                }
+
                 auto rayDirection  = pixelSample - rayOrigin;
-                accumulatedColor  += rayColor({ rayOrigin, rayDirection });
+                auto ray           = Ray{ rayOrigin, rayDirection }.setCone(0.0, m_pixelSpreadAngle);
+                accumulatedColor  += rayColor<C>(ray, firstHits != nullptr ? firstHits + i : nullptr);
             }
 
-            return accumulatedColor / static_cast<double>(m_samplesPerPixel);
+            return accumulatedColor / static_cast<double>(numSamples);
         }
 
         Vec3<double> sampleUnitSquare() const
@@ -242,13 +1077,37 @@ namespace rtr
 
         double    m_aspectRatio;
         Dimension m_dimension;
+        Tile      m_region;
         Viewport  m_viewport;
         Camera    m_camera;
 
         // scene
-        HittableList m_world;
+        std::shared_ptr<const Scene> m_scene;
+
+        int                           m_samplesPerPixel;
+        double                        m_timeBudget;
+        std::optional<BudgetReport>   m_budgetReport;
+        bool                          m_recordCost;
+        std::optional<cost::CostMaps> m_costMaps;
+        int                           m_maxDepth;
+        double                        m_pixelSpreadAngle;
+        PixelFormat                   m_pixelFormat;
+        std::optional<std::uint64_t>  m_seed;
+        Kernel                        m_kernel;
+
+        // camera ray hits recorded or replayed, see TracerParam::m_firstHits
+        std::shared_ptr<FirstHits> m_firstHits;
+        ObjectTable                m_objectTable;
+        bool                       m_replayFirstHits = false;
+
+        // work distribution
+        int            m_tileSize;
+        TraversalOrder m_tileOrder;
+        TraversalOrder m_pixelOrder;
 
-        int m_samplesPerPixel;
-        int m_maxDepth;
+        int                         m_threads;
+        bool                        m_pinThreads;
+        std::once_flag              m_poolOnce;
+        std::shared_ptr<ThreadPool> m_pool;
     };
 }
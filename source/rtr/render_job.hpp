@@ -0,0 +1,88 @@
+#pragma once
+
+#include "rtr/color.hpp"
+#include "rtr/image.hpp"
+#include "rtr/traversal.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+namespace rtr
+{
+
+    class RenderCancelled : public std::runtime_error
+    {
+    public:
+        RenderCancelled()
+            : std::runtime_error{ "Render cancelled" }
+        {
+        }
+    };
+
+    // Handle shared between the caller and an asynchronous render started with RayTracer::submit(), used to follow
+    // the render and to stop it early. Cancellation is cooperative: tiles already being rendered are finished first.
+    // A job follows one render at a time, submitting it again once that render is over starts it afresh, uncancelled.
+    class RenderJob
+    {
+    public:
+        void cancel() { m_cancelled.store(true, std::memory_order_relaxed); }
+        bool cancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+
+        // fraction of the tiles done, 0 until the render starts
+        double progress() const
+        {
+            auto total = m_total.load(std::memory_order_relaxed);
+            return total == 0 ? 0.0 : double(m_done.load(std::memory_order_relaxed)) / double(total);
+        }
+
+        // copy of the image rendered so far, the tiles not done yet are black
+        std::optional<Image> snapshot() const
+        {
+            std::scoped_lock lock{ m_mutex };
+            return m_image;
+        }
+
+    private:
+        friend class RayTracer;
+
+        void begin(int width, int height, PixelFormat format, std::size_t numTiles)
+        {
+            std::scoped_lock lock{ m_mutex };
+            m_image.emplace(width, height, format);
+            m_done.store(0, std::memory_order_relaxed);
+            m_total.store(numTiles, std::memory_order_relaxed);
+            m_cancelled.store(false, std::memory_order_relaxed);
+        }
+
+        // pixels are the tile's rows, back to back
+        void store(const Tile& tile, std::span<const Color<double>> pixels)
+        {
+            {
+                std::scoped_lock lock{ m_mutex };
+                for (int row = 0; row < tile.m_height; ++row) {
+                    auto rowPixels = pixels.subspan(std::size_t(row * tile.m_width), std::size_t(tile.m_width));
+                    m_image->setSpan(tile.m_x, tile.m_y + row, rowPixels);
+                }
+            }
+            m_done.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        Image finish()
+        {
+            std::scoped_lock lock{ m_mutex };
+            return *std::exchange(m_image, std::nullopt);
+        }
+
+        mutable std::mutex       m_mutex;
+        std::optional<Image>     m_image;
+        std::atomic<std::size_t> m_done      = 0;
+        std::atomic<std::size_t> m_total     = 0;
+        std::atomic<bool>        m_cancelled = false;
+    };
+
+}
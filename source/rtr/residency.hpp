@@ -0,0 +1,22 @@
+#pragma once
+
+namespace rtr::residency
+{
+
+    // Geometry that streams its data in (see OutOfCoreGeometry) checks this before waiting for data that is not in
+    // memory. When the calling thread defers, it starts loading the data, treats the ray as a miss and sets
+    // m_missed. The caller then throws away what it rendered with that ray and renders it again later, doing other
+    // work in the meantime instead of stalling on the disk.
+    struct ThreadState
+    {
+        bool m_deferring = false;
+        bool m_missed    = false;
+    };
+
+    inline ThreadState& state()
+    {
+        thread_local ThreadState threadState;
+        return threadState;
+    }
+
+}
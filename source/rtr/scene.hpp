@@ -0,0 +1,38 @@
+#pragma once
+
+#include "rtr/hittable.hpp"
+#include "rtr/light.hpp"
+
+#include <utility>
+
+namespace rtr
+{
+
+    // Everything a render needs from the world that doesn't depend on the camera or the render settings. It is
+    // immutable once built, so one scene can be shared by any number of tracers (see RayTracer's constructor).
+    class Scene
+    {
+    public:
+        explicit Scene(HittableList&& world)
+            : m_world{ std::move(world) }
+            , m_lights{ LightList::collect(m_world) }
+        {
+            // a world built beforehand (with a BvhCache say) is taken as it is
+            if (!m_world.built()) {
+                m_world.build();
+            }
+        }
+
+        // m_lights points into m_world
+        Scene(const Scene&)            = delete;
+        Scene& operator=(const Scene&) = delete;
+
+        const HittableList& world() const { return m_world; }
+        const LightList&    lights() const { return m_lights; }
+
+    private:
+        HittableList m_world;
+        LightList    m_lights;
+    };
+
+}
@@ -0,0 +1,334 @@
+#pragma once
+
+#include "rtr/color.hpp"
+#include "rtr/common.hpp"
+#include "rtr/hittable.hpp"
+#include "rtr/material.hpp"
+#include "rtr/sphere.hpp"
+#include "rtr/texture.hpp"
+#include "rtr/vec.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// The built-in scenes. Every random choice comes from `seed`, so the same arguments always build the same scene.
+namespace rtr::scenes
+{
+
+    inline constexpr std::array s_names = {
+        std::string_view{ "default" },
+        std::string_view{ "lights" },
+        std::string_view{ "generated" },
+    };
+
+    enum class Distribution
+    {
+        Uniform,      // spread evenly over the whole volume
+        Clustered,    // dense clusters, empty space between them
+        Nested,       // clusters of clusters, every cluster a nested list with a BVH of its own
+    };
+
+    // relative weights of the materials of generated spheres
+    struct MaterialMix
+    {
+        double m_diffuse = 0.8;
+        double m_metal   = 0.15;
+        double m_glass   = 0.05;
+        double m_light   = 0.0;
+    };
+
+    struct GeneratorParam
+    {
+        std::size_t  m_count        = 100'000;
+        Distribution m_distribution = Distribution::Uniform;
+        MaterialMix  m_materials;
+    };
+
+    inline std::string_view toString(Distribution distribution)
+    {
+        switch (distribution) {
+        case Distribution::Uniform: return "uniform";
+        case Distribution::Clustered: return "clustered";
+        case Distribution::Nested: return "nested";
+        }
+        return "unknown";
+    }
+
+    inline std::optional<Distribution> parseDistribution(std::string_view name)
+    {
+        for (auto distribution : { Distribution::Uniform, Distribution::Clustered, Distribution::Nested }) {
+            if (toString(distribution) == name) {
+                return distribution;
+            }
+        }
+        return {};
+    }
+
+    // "diffuse,metal,glass[,light]" weights
+    inline MaterialMix parseMaterialMix(const std::string& value)
+    {
+        MaterialMix mix;
+        auto        count = std::sscanf(
+            value.c_str(), "%lf,%lf,%lf,%lf", &mix.m_diffuse, &mix.m_metal, &mix.m_glass, &mix.m_light
+        );
+        if (count < 3) {
+            throw std::invalid_argument{ fmt::format("Expected diffuse,metal,glass[,light] but got '{}'", value) };
+        }
+        if (count == 3) {
+            mix.m_light = 0.0;
+        }
+
+        auto total = mix.m_diffuse + mix.m_metal + mix.m_glass + mix.m_light;
+        if (mix.m_diffuse < 0.0 || mix.m_metal < 0.0 || mix.m_glass < 0.0 || mix.m_light < 0.0 || !(total > 0.0)) {
+            throw std::invalid_argument{ fmt::format("Material weights must be positive, got '{}'", value) };
+        }
+        return mix;
+    }
+
+    // the final scene of the first book; `texture`, when set, replaces the albedo of the big diffuse sphere
+    inline HittableList spheres(std::uint64_t seed, std::shared_ptr<const Texture> texture = nullptr)
+    {
+        static constexpr double glassRefractionIndex = 1.5;
+
+        std::mt19937_64                        rng{ seed };
+        std::uniform_real_distribution<double> dist{ 0.0, 1.0 };
+
+        const auto random      = [&](double min = 0.0, double max = 1.0) { return min + (max - min) * dist(rng); };
+        const auto randomColor = [&](double min, double max) {
+            return Color<>{ random(min, max), random(min, max), random(min, max) };
+        };
+
+        HittableList scene;
+
+        auto& ground = scene.emplace<Sphere>(Vec{ 0.0, -1000.0, 0.0 }, 1000.0);
+        ground.setMaterial<Lambertian>(Color<>{ 0.5, 0.5, 0.5 });
+
+        // small spheres
+        for (int a : rv::iota(-11, 11)) {
+            for (int b : rv::iota(-11, 11)) {
+                Vec center{ a + 0.9 * random(), 0.2, b + 0.9 * random() };
+                Vec offset{ 4.0, 0.2, 0.0 };
+
+                if (vecfn::length(center - offset) <= 0.9) {
+                    break;
+                }
+
+                auto& sphere = scene.emplace<Sphere>(center, 0.2);
+
+                if (double chooseMaterial = random(); chooseMaterial < 0.8) {
+                    // diffuse
+                    auto albedo = randomColor(0.0, 1.0) * randomColor(0.0, 1.0);
+                    sphere.setMaterial<Lambertian>(albedo);
+                } else if (chooseMaterial < 0.95) {
+                    // metal
+                    auto albedo = randomColor(0.5, 1.0);
+                    auto fuzz   = random(0.0, 0.5);
+                    sphere.setMaterial<Metal>(albedo, fuzz);
+                } else {
+                    // glass
+                    sphere.setMaterial<Dielectric>(glassRefractionIndex);
+                }
+            }
+        }
+
+        // big spheres
+        auto& sphere1 = scene.emplace<Sphere>(Vec{ 0.0, 1.0, 0.0 }, 1.0);
+        sphere1.setMaterial<Dielectric>(glassRefractionIndex);
+
+        auto& sphere2 = scene.emplace<Sphere>(Vec{ -4.0, 1.0, 0.0 }, 1.0);
+        if (texture) {
+            sphere2.setMaterial<Lambertian>(std::move(texture));
+        } else {
+            sphere2.setMaterial<Lambertian>(Color<>{ 0.4, 0.2, 0.1 });
+        }
+
+        auto& sphere3 = scene.emplace<Sphere>(Vec{ 4.0, 1.0, 0.0 }, 1.0);
+        sphere3.setMaterial<Metal>(Color<>{ 0.7, 0.6, 0.5 }, 0.0);
+
+        return scene;
+    }
+
+    // small emitters in an otherwise dark scene, needs light sampling to converge at low sample counts
+    inline HittableList lights(std::shared_ptr<const Texture> texture = nullptr)
+    {
+        HittableList scene;
+
+        auto& ground = scene.emplace<Sphere>(Vec{ 0.0, -1000.0, 0.0 }, 1000.0);
+        ground.setMaterial<Lambertian>(Color<>{ 0.5, 0.5, 0.5 });
+
+        auto& sphere1 = scene.emplace<Sphere>(Vec{ 0.0, 1.0, 0.0 }, 1.0);
+        sphere1.setMaterial<Dielectric>(1.5);
+
+        auto& sphere2 = scene.emplace<Sphere>(Vec{ -4.0, 1.0, 0.0 }, 1.0);
+        if (texture) {
+            sphere2.setMaterial<Lambertian>(std::move(texture));
+        } else {
+            sphere2.setMaterial<Lambertian>(Color<>{ 0.4, 0.2, 0.1 });
+        }
+
+        auto& sphere3 = scene.emplace<Sphere>(Vec{ 4.0, 1.0, 0.0 }, 1.0);
+        sphere3.setMaterial<Metal>(Color<>{ 0.7, 0.6, 0.5 }, 0.1);
+
+        auto& light1 = scene.emplace<Sphere>(Vec{ -2.0, 3.5, 2.0 }, 0.25);
+        light1.setMaterial<DiffuseLight>(Color<>{ 60.0, 50.0, 40.0 });
+
+        auto& light2 = scene.emplace<Sphere>(Vec{ 3.0, 2.5, -3.0 }, 0.15);
+        light2.setMaterial<DiffuseLight>(Color<>{ 20.0, 40.0, 80.0 });
+
+        return scene;
+    }
+
+    // Any number of spheres over the ground in front of the default camera, for measuring how building and tracing
+    // scale with the size of the scene. The radius shrinks as the count grows so the volume stays about as full.
+    inline HittableList generated(
+        std::uint64_t seed, const GeneratorParam& param = {}, std::shared_ptr<const Texture> texture = nullptr
+    )
+    {
+        static constexpr double glassRefractionIndex = 1.5;
+
+        // where the spheres go, the view of the default camera
+        const Vec3<double> regionMin{ -8.0, 0.0, -8.0 };
+        const Vec3<double> regionMax{ 8.0, 4.0, 8.0 };
+
+        std::mt19937_64                        rng{ seed };
+        std::uniform_real_distribution<double> dist{ 0.0, 1.0 };
+        std::normal_distribution<double>       normal{ 0.0, 1.0 };
+
+        const auto random      = [&](double min = 0.0, double max = 1.0) { return min + (max - min) * dist(rng); };
+        const auto randomColor = [&](double min, double max) {
+            return Color<>{ random(min, max), random(min, max), random(min, max) };
+        };
+        const auto randomIn = [&](const Vec3<double>& min, const Vec3<double>& max) {
+            return Vec3<double>{ random(min.x(), max.x()), random(min.y(), max.y()), random(min.z(), max.z()) };
+        };
+
+        const auto& mix         = param.m_materials;
+        const auto  mixTotal    = mix.m_diffuse + mix.m_metal + mix.m_glass + mix.m_light;
+        const auto  setMaterial = [&](Hittable& sphere) {
+            auto choose = random(0.0, mixTotal);
+            if ((choose -= mix.m_diffuse) < 0.0) {
+                sphere.setMaterial<Lambertian>(randomColor(0.0, 1.0) * randomColor(0.0, 1.0));
+            } else if ((choose -= mix.m_metal) < 0.0) {
+                sphere.setMaterial<Metal>(randomColor(0.5, 1.0), random(0.0, 0.5));
+            } else if ((choose -= mix.m_glass) < 0.0) {
+                sphere.setMaterial<Dielectric>(glassRefractionIndex);
+            } else {
+                sphere.setMaterial<DiffuseLight>(4.0 * randomColor(0.5, 1.0));
+            }
+        };
+
+        // mean distance between the spheres
+        auto extent  = regionMax - regionMin;
+        auto volume  = extent.x() * extent.y() * extent.z();
+        auto spacing = std::cbrt(volume / double(std::max(param.m_count, std::size_t{ 1 })));
+
+        const auto addSphere = [&](HittableList& list, const Vec3<double>& center) {
+            setMaterial(list.emplace<Sphere>(center, 0.3 * spacing * random(0.5, 1.5)));
+        };
+
+        // `count` spheres around `center`, normally distributed with `spread` per axis
+        const auto addCluster = [&](HittableList& list, const Vec3<double>& center, double spread, std::size_t count) {
+            for (std::size_t i = 0; i < count; ++i) {
+                addSphere(list, center + spread * Vec3<double>{ normal(rng), normal(rng), normal(rng) });
+            }
+        };
+
+        // `total` split over `parts` as evenly as possible
+        const auto share = [](std::size_t total, std::size_t parts, std::size_t part) {
+            return total / parts + (part < total % parts ? 1 : 0);
+        };
+
+        HittableList scene;
+
+        auto& ground = scene.emplace<Sphere>(Vec{ 0.0, -1000.0, 0.0 }, 1000.0);
+        if (texture) {
+            ground.setMaterial<Lambertian>(std::move(texture));
+        } else {
+            ground.setMaterial<Lambertian>(Color<>{ 0.5, 0.5, 0.5 });
+        }
+
+        if (param.m_count == 0) {
+            return scene;
+        }
+
+        // count^(1/3) clusters of about count^(2/3) spheres, nested ones make count^(1/6) groups of count^(1/6)
+        auto numClusters = std::max(std::size_t(std::cbrt(double(param.m_count))), std::size_t{ 1 });
+
+        switch (param.m_distribution) {
+        case Distribution::Uniform:
+            for (std::size_t i = 0; i < param.m_count; ++i) {
+                addSphere(scene, randomIn(regionMin, regionMax));
+            }
+            break;
+
+        case Distribution::Clustered: {
+            auto spread = 0.25 * std::cbrt(volume / double(numClusters));
+            for (std::size_t cluster = 0; cluster < numClusters; ++cluster) {
+                addCluster(scene, randomIn(regionMin, regionMax), spread, share(param.m_count, numClusters, cluster));
+            }
+            break;
+        }
+
+        case Distribution::Nested: {
+            auto numGroups = std::max(std::size_t(std::sqrt(double(numClusters))), std::size_t{ 1 });
+            auto spread    = 0.25 * std::cbrt(volume / double(numGroups));
+            for (std::size_t group = 0; group < numGroups; ++group) {
+                auto groupCenter   = randomIn(regionMin, regionMax);
+                auto groupCount    = share(param.m_count, numGroups, group);
+                auto groupSize     = share(numClusters, numGroups, group);
+                auto clusterSpread = 0.25 * spread / std::cbrt(double(groupSize));
+
+                auto groupList = std::make_unique<HittableList>();
+                for (std::size_t cluster = 0; cluster < groupSize; ++cluster) {
+                    auto center = groupCenter + spread * Vec3<double>{ normal(rng), normal(rng), normal(rng) };
+                    auto list   = std::make_unique<HittableList>();
+                    addCluster(*list, center, clusterSpread, share(groupCount, groupSize, cluster));
+                    groupList->add(std::move(list));
+                }
+                scene.add(std::move(groupList));
+            }
+            break;
+        }
+        }
+
+        return scene;
+    }
+
+    inline bool exists(std::string_view name)
+    {
+        return rr::find(s_names, name) != s_names.end();
+    }
+
+    inline HittableList make(
+        std::string_view               name,
+        std::uint64_t                  seed,
+        std::shared_ptr<const Texture> texture   = nullptr,
+        const GeneratorParam&          generator = {}
+    )
+    {
+        if (name == "default") {
+            return spheres(seed, std::move(texture));
+        }
+        if (name == "lights") {
+            return lights(std::move(texture));
+        }
+        if (name == "generated") {
+            return generated(seed, generator, std::move(texture));
+        }
+        throw std::invalid_argument{ fmt::format("Unknown scene '{}'", name) };
+    }
+
+}
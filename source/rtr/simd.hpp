@@ -0,0 +1,224 @@
+#pragma once
+
+#include <array>
+#include <concepts>
+#include <cstddef>
+
+#if defined(__SSE2__)
+    #include <immintrin.h>
+#endif
+
+// 4-lane packs used as the storage of 3 component float/double vectors. The 4th lane is padding and is kept at zero by
+// every operation, so comparisons and horizontal sums can simply work on all 4 lanes.
+namespace rtr::simd
+{
+
+    template <typename T, std::size_t N>
+    concept Accelerated = N == 3 && (std::same_as<T, float> || std::same_as<T, double>);
+
+    template <typename T, std::size_t N>
+    inline constexpr std::size_t s_storageSize = Accelerated<T, N> ? 4 : N;
+
+    template <typename T, std::size_t N>
+    inline constexpr std::size_t s_alignment = Accelerated<T, N> ? 4 * sizeof(T) : alignof(std::array<T, N>);
+
+    // portable fallback, also documents the interface every specialization provides
+    template <std::floating_point T>
+    struct Pack
+    {
+        std::array<T, 4> m_v;
+
+        static Pack load(const T* ptr) { return { { ptr[0], ptr[1], ptr[2], ptr[3] } }; }
+        static Pack splat3(T s) { return { { s, s, s, T{ 0 } } }; }      // padding stays 0
+        static Pack divisor3(T s) { return { { s, s, s, T{ 1 } } }; }    // 0 / 1 keeps the padding at 0
+
+        void store(T* ptr) const
+        {
+            for (std::size_t i = 0; i < 4; ++i) {
+                ptr[i] = m_v[i];
+            }
+        }
+
+        Pack padOne() const { return { { m_v[0], m_v[1], m_v[2], T{ 1 } } }; }
+        T    sum() const { return (m_v[0] + m_v[1]) + (m_v[2] + m_v[3]); }
+
+        Pack operator-() const { return { { -m_v[0], -m_v[1], -m_v[2], -m_v[3] } }; }
+
+        // clang-format off
+        friend Pack operator+(const Pack& a, const Pack& b) { return apply(a, b, [](T x, T y) { return x + y; }); }
+        friend Pack operator-(const Pack& a, const Pack& b) { return apply(a, b, [](T x, T y) { return x - y; }); }
+        friend Pack operator*(const Pack& a, const Pack& b) { return apply(a, b, [](T x, T y) { return x * y; }); }
+        friend Pack operator/(const Pack& a, const Pack& b) { return apply(a, b, [](T x, T y) { return x / y; }); }
+        // clang-format on
+
+        static Pack cross(const Pack& a, const Pack& b)
+        {
+            const auto& [ax, ay, az, aw] = a.m_v;
+            const auto& [bx, by, bz, bw] = b.m_v;
+            return { { ay * bz - az * by, az * bx - ax * bz, ax * by - ay * bx, T{ 0 } } };
+        }
+
+    private:
+        template <typename Fn>
+        static Pack apply(const Pack& a, const Pack& b, Fn&& fn)
+        {
+            return { { fn(a.m_v[0], b.m_v[0]), fn(a.m_v[1], b.m_v[1]), fn(a.m_v[2], b.m_v[2]), fn(a.m_v[3], b.m_v[3]) } };
+        }
+    };
+
+#if defined(__SSE2__)
+
+    template <>
+    struct Pack<float>
+    {
+        __m128 m_v;
+
+        static Pack load(const float* ptr) { return { _mm_load_ps(ptr) }; }
+        static Pack splat3(float s) { return { _mm_set_ps(0.0f, s, s, s) }; }
+        static Pack divisor3(float s) { return { _mm_set_ps(1.0f, s, s, s) }; }
+
+        void store(float* ptr) const { _mm_store_ps(ptr, m_v); }
+
+        Pack padOne() const { return { _mm_add_ps(m_v, _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f)) }; }
+
+        float sum() const
+        {
+            // (x + y) + (z + w), same association as the fallback
+            __m128 swapped = _mm_shuffle_ps(m_v, m_v, _MM_SHUFFLE(2, 3, 0, 1));
+            __m128 pairs   = _mm_add_ps(m_v, swapped);
+            __m128 high    = _mm_movehl_ps(swapped, pairs);
+            return _mm_cvtss_f32(_mm_add_ss(pairs, high));
+        }
+
+        Pack operator-() const { return { _mm_xor_ps(m_v, _mm_set1_ps(-0.0f)) }; }
+
+        // clang-format off
+        friend Pack operator+(const Pack& a, const Pack& b) { return { _mm_add_ps(a.m_v, b.m_v) }; }
+        friend Pack operator-(const Pack& a, const Pack& b) { return { _mm_sub_ps(a.m_v, b.m_v) }; }
+        friend Pack operator*(const Pack& a, const Pack& b) { return { _mm_mul_ps(a.m_v, b.m_v) }; }
+        friend Pack operator/(const Pack& a, const Pack& b) { return { _mm_div_ps(a.m_v, b.m_v) }; }
+        // clang-format on
+
+        static Pack cross(const Pack& a, const Pack& b)
+        {
+            // a.yzx * b.zxy - a.zxy * b.yzx, the w lane becomes w*w - w*w = 0
+            __m128 aYzx = _mm_shuffle_ps(a.m_v, a.m_v, _MM_SHUFFLE(3, 0, 2, 1));
+            __m128 bYzx = _mm_shuffle_ps(b.m_v, b.m_v, _MM_SHUFFLE(3, 0, 2, 1));
+            __m128 aZxy = _mm_shuffle_ps(a.m_v, a.m_v, _MM_SHUFFLE(3, 1, 0, 2));
+            __m128 bZxy = _mm_shuffle_ps(b.m_v, b.m_v, _MM_SHUFFLE(3, 1, 0, 2));
+            return { _mm_sub_ps(_mm_mul_ps(aYzx, bZxy), _mm_mul_ps(aZxy, bYzx)) };
+        }
+    };
+
+    #if defined(__AVX__)
+
+    template <>
+    struct Pack<double>
+    {
+        __m256d m_v;
+
+        static Pack load(const double* ptr) { return { _mm256_load_pd(ptr) }; }
+        static Pack splat3(double s) { return { _mm256_set_pd(0.0, s, s, s) }; }
+        static Pack divisor3(double s) { return { _mm256_set_pd(1.0, s, s, s) }; }
+
+        void store(double* ptr) const { _mm256_store_pd(ptr, m_v); }
+
+        Pack padOne() const { return { _mm256_add_pd(m_v, _mm256_set_pd(1.0, 0.0, 0.0, 0.0)) }; }
+
+        double sum() const
+        {
+            __m128d low   = _mm256_castpd256_pd128(m_v);
+            __m128d high  = _mm256_extractf128_pd(m_v, 1);
+            __m128d pairs = _mm_add_pd(_mm_unpacklo_pd(low, high), _mm_unpackhi_pd(low, high));    // (x+y), (z+w)
+            return _mm_cvtsd_f64(_mm_add_sd(pairs, _mm_unpackhi_pd(pairs, pairs)));
+        }
+
+        Pack operator-() const { return { _mm256_xor_pd(m_v, _mm256_set1_pd(-0.0)) }; }
+
+        // clang-format off
+        friend Pack operator+(const Pack& a, const Pack& b) { return { _mm256_add_pd(a.m_v, b.m_v) }; }
+        friend Pack operator-(const Pack& a, const Pack& b) { return { _mm256_sub_pd(a.m_v, b.m_v) }; }
+        friend Pack operator*(const Pack& a, const Pack& b) { return { _mm256_mul_pd(a.m_v, b.m_v) }; }
+        friend Pack operator/(const Pack& a, const Pack& b) { return { _mm256_div_pd(a.m_v, b.m_v) }; }
+        // clang-format on
+
+        static Pack cross(const Pack& a, const Pack& b)
+        {
+        #if defined(__AVX2__)
+            __m256d aYzx = _mm256_permute4x64_pd(a.m_v, _MM_SHUFFLE(3, 0, 2, 1));
+            __m256d bYzx = _mm256_permute4x64_pd(b.m_v, _MM_SHUFFLE(3, 0, 2, 1));
+            __m256d aZxy = _mm256_permute4x64_pd(a.m_v, _MM_SHUFFLE(3, 1, 0, 2));
+            __m256d bZxy = _mm256_permute4x64_pd(b.m_v, _MM_SHUFFLE(3, 1, 0, 2));
+            return { _mm256_sub_pd(_mm256_mul_pd(aYzx, bZxy), _mm256_mul_pd(aZxy, bYzx)) };
+        #else
+            alignas(32) double l[4];
+            alignas(32) double r[4];
+            a.store(l);
+            b.store(r);
+            return { _mm256_set_pd(0.0, l[0] * r[1] - l[1] * r[0], l[2] * r[0] - l[0] * r[2], l[1] * r[2] - l[2] * r[1]) };
+        #endif
+        }
+    };
+
+    #else
+
+    // SSE2 only: two 2-lane registers, (x, y) and (z, w)
+    template <>
+    struct Pack<double>
+    {
+        __m128d m_xy;
+        __m128d m_zw;
+
+        static Pack load(const double* ptr) { return { _mm_load_pd(ptr), _mm_load_pd(ptr + 2) }; }
+        static Pack splat3(double s) { return { _mm_set1_pd(s), _mm_set_pd(0.0, s) }; }
+        static Pack divisor3(double s) { return { _mm_set1_pd(s), _mm_set_pd(1.0, s) }; }
+
+        void store(double* ptr) const
+        {
+            _mm_store_pd(ptr, m_xy);
+            _mm_store_pd(ptr + 2, m_zw);
+        }
+
+        Pack padOne() const { return { m_xy, _mm_add_pd(m_zw, _mm_set_pd(1.0, 0.0)) }; }
+
+        double sum() const
+        {
+            __m128d pairs = _mm_add_pd(_mm_unpacklo_pd(m_xy, m_zw), _mm_unpackhi_pd(m_xy, m_zw));    // (x+y), (z+w)
+            return _mm_cvtsd_f64(_mm_add_sd(pairs, _mm_unpackhi_pd(pairs, pairs)));
+        }
+
+        Pack operator-() const
+        {
+            const __m128d sign = _mm_set1_pd(-0.0);
+            return { _mm_xor_pd(m_xy, sign), _mm_xor_pd(m_zw, sign) };
+        }
+
+        // clang-format off
+        friend Pack operator+(const Pack& a, const Pack& b) { return { _mm_add_pd(a.m_xy, b.m_xy), _mm_add_pd(a.m_zw, b.m_zw) }; }
+        friend Pack operator-(const Pack& a, const Pack& b) { return { _mm_sub_pd(a.m_xy, b.m_xy), _mm_sub_pd(a.m_zw, b.m_zw) }; }
+        friend Pack operator*(const Pack& a, const Pack& b) { return { _mm_mul_pd(a.m_xy, b.m_xy), _mm_mul_pd(a.m_zw, b.m_zw) }; }
+        friend Pack operator/(const Pack& a, const Pack& b) { return { _mm_div_pd(a.m_xy, b.m_xy), _mm_div_pd(a.m_zw, b.m_zw) }; }
+        // clang-format on
+
+        static Pack cross(const Pack& a, const Pack& b)
+        {
+            // yz * zx - zx * yz for (x, y), then xy - yx for z
+            __m128d aYz = _mm_shuffle_pd(a.m_xy, a.m_zw, 0b01);    // (y, z)
+            __m128d bYz = _mm_shuffle_pd(b.m_xy, b.m_zw, 0b01);
+            __m128d aZx = _mm_shuffle_pd(a.m_zw, a.m_xy, 0b00);    // (z, x)
+            __m128d bZx = _mm_shuffle_pd(b.m_zw, b.m_xy, 0b00);
+
+            __m128d xy = _mm_sub_pd(_mm_mul_pd(aYz, bZx), _mm_mul_pd(aZx, bYz));
+
+            __m128d bYx  = _mm_shuffle_pd(b.m_xy, b.m_xy, 0b01);             // (y, x)
+            __m128d prod = _mm_mul_pd(a.m_xy, bYx);                          // (x*by, y*bx)
+            __m128d z    = _mm_sub_sd(prod, _mm_unpackhi_pd(prod, prod));    // x*by - y*bx
+            return { xy, _mm_move_sd(_mm_setzero_pd(), z) };
+        }
+    };
+
+    #endif
+
+#endif
+
+}
@@ -2,7 +2,11 @@
 
 #include "rtr/hittable.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <optional>
+#include <stdexcept>
+#include <utility>
 
 namespace rtr
 {
@@ -16,24 +20,25 @@ namespace rtr
         {
         }
 
-        void setMaterial(std::unique_ptr<Material> material) { m_material = std::move(material); }
+        template <std::derived_from<Material> T>
+        void setMaterial(std::unique_ptr<T> material)
+        {
+            // the render kernels rely on every object having a material, use TracerParam::m_normalShading to debug
+            if (!material) {
+                throw std::invalid_argument{ "Material can't be null" };
+            }
+            m_material = std::move(material);
+            m_materialCharge.reset(sizeof(T));
+        }
 
         std::optional<HitResult> hit(const Ray& ray, Interval<double> tRange) const override
         {
-            // basically quadratic formula
-            const Vec  oc     = ray.origin() - m_center;
-            const auto a      = vecfn::lengthSquared(ray.direction());
-            const auto b_half = vecfn::dot(oc, ray.direction());
-            const auto c      = vecfn::lengthSquared(oc) - m_radius * m_radius;
-
-            const auto D = b_half * b_half - a * c;
-            if (D < 0) {
+            auto roots = intersect(ray, m_center, m_radius);
+            if (!roots.has_value()) {
                 return {};
             }
 
-            const auto D_sqrt = std::sqrt(D);
-            const auto root1  = (-b_half - D_sqrt) / a;
-            const auto root2  = (-b_half + D_sqrt) / a;
+            const auto [root1, root2] = *roots;
 
             if (!tRange.surrounds(root1) && !tRange.surrounds(root2)) {
                 return {};
@@ -47,15 +52,98 @@ namespace rtr
             const Vec point     = ray.at(root);
             const Vec outNormal = (point - m_center) / m_radius;
 
+            auto record = HitRecord::from(ray, outNormal, point, root);
+
+            if (m_material->usesTextureCoords()) {
+                // u: angle around the y axis from x = -1, v: angle from y = -1
+                auto theta           = std::acos(std::clamp(-outNormal.y(), -1.0, 1.0));
+                auto phi             = std::atan2(-outNormal.z(), outNormal.x()) + n::pi;
+                record.m_u           = phi / (2.0 * n::pi);
+                record.m_v           = theta / n::pi;
+                record.m_uvFootprint = ray.coneWidthAt(root) / (n::pi * m_radius);
+            }
+
             return HitResult{
-                .m_record   = HitRecord::from(ray, outNormal, point, root),
+                .m_record   = record,
                 .m_material = m_material.get(),
+                .m_object   = this,
             };
         }
 
+        bool occluded(const Ray& ray, Interval<double> tRange) const override
+        {
+            auto roots = intersect(ray, m_center, m_radius);
+            return roots.has_value() && (tRange.surrounds(roots->first) || tRange.surrounds(roots->second));
+        }
+
+        Aabb boundingBox() const override
+        {
+            Vec3<double> radius{ m_radius, m_radius, m_radius };
+            return { m_center - radius, m_center + radius };
+        }
+
+        // uniform sampling of the cone of directions subtended by the sphere
+        std::optional<LightSample> sampleToward(const Vec3<double>& origin) const override
+        {
+            auto toCenter      = m_center - origin;
+            auto distSquared   = vecfn::lengthSquared(toCenter);
+            auto radiusSquared = m_radius * m_radius;
+            if (distSquared <= radiusSquared) {
+                return {};    // inside the sphere
+            }
+
+            auto cosThetaMax = std::sqrt(1.0 - radiusSquared / distSquared);
+            auto z           = 1.0 + util::getRandomDouble() * (cosThetaMax - 1.0);
+            auto phi         = 2.0 * n::pi * util::getRandomDouble();
+            auto sinTheta    = std::sqrt(std::max(0.0, 1.0 - z * z));
+
+            // orthonormal basis around the direction to the center
+            auto w = toCenter / std::sqrt(distSquared);
+            auto a = std::abs(w.x()) > 0.9 ? Vec3<double>{ 0.0, 1.0, 0.0 } : Vec3<double>{ 1.0, 0.0, 0.0 };
+            auto v = vecfn::normalized(vecfn::cross(w, a));
+            auto u = vecfn::cross(w, v);
+
+            return LightSample{
+                .m_direction = (std::cos(phi) * sinTheta) * u + (std::sin(phi) * sinTheta) * v + z * w,
+                .m_pdf       = 1.0 / (2.0 * n::pi * (1.0 - cosThetaMax)),
+            };
+        }
+
+        double pdfToward(const Vec3<double>& origin) const override
+        {
+            auto distSquared   = vecfn::lengthSquared(m_center - origin);
+            auto radiusSquared = m_radius * m_radius;
+            if (distSquared <= radiusSquared) {
+                return 0.0;
+            }
+
+            auto cosThetaMax = std::sqrt(1.0 - radiusSquared / distSquared);
+            return 1.0 / (2.0 * n::pi * (1.0 - cosThetaMax));
+        }
+
         Vec3<double> center() const { return m_center; }
         double       radius() const { return m_radius; }
 
+        // both roots of the ray/sphere quadratic, root1 <= root2
+        static std::optional<std::pair<double, double>> intersect(
+            const Ray& ray, const Vec3<double>& center, double radius
+        )
+        {
+            // basically quadratic formula
+            const Vec  oc     = ray.origin() - center;
+            const auto a      = ray.lengthSquared();
+            const auto b_half = vecfn::dot(oc, ray.direction());
+            const auto c      = vecfn::lengthSquared(oc) - radius * radius;
+
+            const auto D = b_half * b_half - a * c;
+            if (D < 0) {
+                return {};
+            }
+
+            const auto D_sqrt = std::sqrt(D);
+            return std::pair{ (-b_half - D_sqrt) / a, (-b_half + D_sqrt) / a };
+        }
+
     private:
         Vec3<double> m_center;
         double       m_radius;
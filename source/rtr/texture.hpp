@@ -0,0 +1,382 @@
+#pragma once
+
+#include "rtr/color.hpp"
+#include "rtr/memory.hpp"
+#include "rtr/util.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace rtr
+{
+
+    struct TexCoord
+    {
+        double m_u;
+        double m_v;
+        double m_footprint;    // width of the ray footprint in uv units, selects the mip level
+    };
+
+    class Texture
+    {
+    public:
+        virtual ~Texture() = default;
+
+        virtual Color<double> value(const TexCoord& coord) const = 0;
+
+        // whether value() depends on the coordinates, lets primitives skip computing them
+        virtual bool varying() const { return true; }
+    };
+
+    class SolidColor final : public Texture
+    {
+    public:
+        SolidColor(Color<double> color)
+            : m_color{ std::move(color) }
+        {
+        }
+
+        Color<double> value(const TexCoord& /* coord */) const override { return m_color; }
+        bool          varying() const override { return false; }
+
+    private:
+        Color<double> m_color;
+    };
+
+    // Gamma encoded 8-bit mip pyramid, every level is stored tile by tile so a tile is one contiguous block. This is
+    // the compact backing store, texels are decoded to linear floats on demand by the TileCache.
+    class MipPyramid
+    {
+    public:
+        static constexpr int         s_tileSize   = 32;
+        static constexpr std::size_t s_tileTexels = s_tileSize * s_tileSize;
+
+        using Texels = std::vector<std::uint8_t, memory::Allocator<std::uint8_t, memory::Subsystem::Textures>>;
+
+        struct Level
+        {
+            int    m_width;
+            int    m_height;
+            int    m_tilesX;
+            int    m_tilesY;
+            Texels m_texels;    // rgb
+        };
+
+        MipPyramid(std::span<const std::uint8_t> rgb, int width, int height)
+            : m_id{ s_nextId++ }
+        {
+            // filter in linear space
+            std::vector<Color<double>> linear(std::size_t(width) * std::size_t(height));
+            for (std::size_t i = 0; i < linear.size(); ++i) {
+                linear[i] = {
+                    util::gammaToLinear(rgb[i * 3 + 0] / 255.0),
+                    util::gammaToLinear(rgb[i * 3 + 1] / 255.0),
+                    util::gammaToLinear(rgb[i * 3 + 2] / 255.0),
+                };
+            }
+
+            while (true) {
+                m_levels.push_back(makeLevel(linear, width, height));
+                if (width == 1 && height == 1) {
+                    break;
+                }
+                std::tie(linear, width, height) = downsample(linear, width, height);
+            }
+        }
+
+        std::uint32_t id() const { return m_id; }
+        int           levels() const { return int(m_levels.size()); }
+        const Level&  level(int level) const { return m_levels[std::size_t(level)]; }
+
+        std::span<const std::uint8_t> tile(int level, int tileX, int tileY) const
+        {
+            const auto& lvl   = m_levels[std::size_t(level)];
+            auto        index = std::size_t(tileY * lvl.m_tilesX + tileX) * s_tileTexels * 3;
+            return std::span{ lvl.m_texels }.subspan(index, s_tileTexels * 3);
+        }
+
+    private:
+        static Level makeLevel(const std::vector<Color<double>>& linear, int width, int height)
+        {
+            Level level{
+                .m_width  = width,
+                .m_height = height,
+                .m_tilesX = (width + s_tileSize - 1) / s_tileSize,
+                .m_tilesY = (height + s_tileSize - 1) / s_tileSize,
+                .m_texels = {},
+            };
+            level.m_texels.resize(std::size_t(level.m_tilesX * level.m_tilesY) * s_tileTexels * 3);
+
+            const auto encode = [](double value) {
+                return std::uint8_t(std::clamp(util::linearToGamma(value) * 255.0 + 0.5, 0.0, 255.0));
+            };
+
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    auto tile   = std::size_t((y / s_tileSize) * level.m_tilesX + (x / s_tileSize));
+                    auto inTile = std::size_t((y % s_tileSize) * s_tileSize + (x % s_tileSize));
+                    auto dst    = (tile * s_tileTexels + inTile) * 3;
+
+                    const auto& color = linear[std::size_t(y) * std::size_t(width) + std::size_t(x)];
+
+                    level.m_texels[dst + 0] = encode(color.x());
+                    level.m_texels[dst + 1] = encode(color.y());
+                    level.m_texels[dst + 2] = encode(color.z());
+                }
+            }
+
+            return level;
+        }
+
+        // 2x2 box filter, odd edges reuse the last row/column
+        static std::tuple<std::vector<Color<double>>, int, int> downsample(
+            const std::vector<Color<double>>& linear,
+            int                               width,
+            int                               height
+        )
+        {
+            int  newWidth  = std::max(1, width / 2);
+            int  newHeight = std::max(1, height / 2);
+            auto at        = [&](int x, int y) {
+                auto row = std::size_t(std::min(y, height - 1));
+                auto col = std::size_t(std::min(x, width - 1));
+                return linear[row * std::size_t(width) + col];
+            };
+
+            std::vector<Color<double>> result(std::size_t(newWidth) * std::size_t(newHeight));
+            for (int y = 0; y < newHeight; ++y) {
+                for (int x = 0; x < newWidth; ++x) {
+                    auto top    = at(2 * x, 2 * y) + at(2 * x + 1, 2 * y);
+                    auto bottom = at(2 * x, 2 * y + 1) + at(2 * x + 1, 2 * y + 1);
+
+                    result[std::size_t(y) * std::size_t(newWidth) + std::size_t(x)] = (top + bottom) / 4.0;
+                }
+            }
+
+            return { std::move(result), newWidth, newHeight };
+        }
+
+        inline static std::atomic<std::uint32_t> s_nextId = 0;
+
+        std::uint32_t      m_id;
+        std::vector<Level> m_levels;
+    };
+
+    // Bounded cache of decoded (linear float) texture tiles, shared by all threads and all image textures. The least
+    // recently used tiles are evicted once the budget is reached; lookups are sharded to keep lock contention low.
+    class TileCache
+    {
+    public:
+        struct Tile
+        {
+            std::array<float, MipPyramid::s_tileTexels * 3> m_texels;
+        };
+
+        static constexpr std::size_t s_defaultBudget = 64 * 1024 * 1024;
+
+        explicit TileCache(std::size_t budgetBytes = s_defaultBudget)
+            : m_shardBudget{ std::max(budgetBytes / s_numShards, sizeof(Tile)) }
+        {
+        }
+
+        std::shared_ptr<const Tile> get(const MipPyramid& pyramid, int level, int tileX, int tileY)
+        {
+            Key   key{ pyramid.id(), level, tileX, tileY };
+            auto& shard = m_shards[key.hash() >> 60];    // top 4 bits: one of 16 shards
+
+            {
+                std::scoped_lock lock{ shard.m_mutex };
+                if (auto found = shard.m_index.find(key); found != shard.m_index.end()) {
+                    shard.m_lru.splice(shard.m_lru.begin(), shard.m_lru, found->second);
+                    m_hits.fetch_add(1, std::memory_order_relaxed);
+                    return found->second->second;
+                }
+            }
+
+            // decode outside of the lock, another thread may race us to it which is harmless
+            auto tile = decode(pyramid.tile(level, tileX, tileY));
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+
+            std::scoped_lock lock{ shard.m_mutex };
+            if (auto found = shard.m_index.find(key); found != shard.m_index.end()) {
+                return found->second->second;
+            }
+
+            shard.m_lru.emplace_front(key, tile);
+            shard.m_index.emplace(key, shard.m_lru.begin());
+            shard.m_charge.add(sizeof(Tile));
+
+            while (shard.m_charge.bytes() > m_shardBudget && shard.m_lru.size() > 1) {
+                shard.m_index.erase(shard.m_lru.back().first);
+                shard.m_lru.pop_back();
+                shard.m_charge.release(sizeof(Tile));
+            }
+
+            return tile;
+        }
+
+        std::size_t budget() const { return m_shardBudget * s_numShards; }
+        std::size_t hits() const { return m_hits.load(std::memory_order_relaxed); }
+        std::size_t misses() const { return m_misses.load(std::memory_order_relaxed); }
+
+        std::size_t bytes()
+        {
+            std::size_t total = 0;
+            for (auto& shard : m_shards) {
+                std::scoped_lock lock{ shard.m_mutex };
+                total += shard.m_charge.bytes();
+            }
+            return total;
+        }
+
+    private:
+        static constexpr std::size_t s_numShards = 16;
+
+        // every field whole: packing them into one integer let large textures and late pyramid ids collide
+        struct Key
+        {
+            std::uint32_t m_id;
+            int           m_level;
+            int           m_tileX;
+            int           m_tileY;
+
+            bool operator==(const Key&) const = default;
+
+            std::uint64_t hash() const
+            {
+                auto idLevel = (std::uint64_t(m_id) << 32) | std::uint32_t(m_level);
+                auto tile    = (std::uint64_t(std::uint32_t(m_tileY)) << 32) | std::uint32_t(m_tileX);
+                return util::mixBits(idLevel ^ util::mixBits(tile));
+            }
+        };
+
+        struct KeyHash
+        {
+            std::size_t operator()(const Key& key) const { return std::size_t(key.hash()); }
+        };
+
+        using Entry = std::pair<Key, std::shared_ptr<const Tile>>;
+
+        struct Shard
+        {
+            std::mutex                                                   m_mutex;
+            std::list<Entry>                                             m_lru;
+            std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+            memory::Charge                                               m_charge{ memory::Subsystem::TextureTiles };
+        };
+
+        static std::shared_ptr<const Tile> decode(std::span<const std::uint8_t> texels)
+        {
+            static const auto table = [] {
+                std::array<float, 256> table{};
+                for (std::size_t i = 0; i < table.size(); ++i) {
+                    table[i] = float(util::gammaToLinear(double(i) / 255.0));
+                }
+                return table;
+            }();
+
+            auto tile = std::make_shared<Tile>();
+            for (std::size_t i = 0; i < texels.size(); ++i) {
+                tile->m_texels[i] = table[texels[i]];
+            }
+            return tile;
+        }
+
+        std::size_t                    m_shardBudget;
+        std::array<Shard, s_numShards> m_shards;
+        std::atomic<std::size_t>       m_hits   = 0;
+        std::atomic<std::size_t>       m_misses = 0;
+    };
+
+    // trilinear filtered lookups into a mip pyramid through a shared tile cache, u wraps around and v is clamped
+    class ImageTexture final : public Texture
+    {
+    public:
+        ImageTexture(std::shared_ptr<const MipPyramid> pyramid, std::shared_ptr<TileCache> cache)
+            : m_pyramid{ std::move(pyramid) }
+            , m_cache{ std::move(cache) }
+        {
+        }
+
+        Color<double> value(const TexCoord& coord) const override
+        {
+            const auto& base   = m_pyramid->level(0);
+            auto        texels = coord.m_footprint * std::max(base.m_width, base.m_height);
+            auto        lod    = std::clamp(std::log2(std::max(texels, 1.0)), 0.0, double(m_pyramid->levels() - 1));
+
+            auto level = int(lod);
+            auto frac  = lod - level;
+
+            auto color = bilinear(level, coord.m_u, coord.m_v);
+            if (frac > 0.0 && level + 1 < m_pyramid->levels()) {
+                color = (1.0 - frac) * color + frac * bilinear(level + 1, coord.m_u, coord.m_v);
+            }
+            return color;
+        }
+
+    private:
+        Color<double> bilinear(int level, double u, double v) const
+        {
+            const auto& lvl = m_pyramid->level(level);
+
+            auto x  = (u - std::floor(u)) * lvl.m_width - 0.5;
+            auto y  = std::clamp(v, 0.0, 1.0) * lvl.m_height - 0.5;
+            auto x0 = int(std::floor(x));
+            auto y0 = int(std::floor(y));
+            auto fx = x - x0;
+            auto fy = y - y0;
+
+            auto top    = (1.0 - fx) * texel(level, x0, y0) + fx * texel(level, x0 + 1, y0);
+            auto bottom = (1.0 - fx) * texel(level, x0, y0 + 1) + fx * texel(level, x0 + 1, y0 + 1);
+            return (1.0 - fy) * top + fy * bottom;
+        }
+
+        Color<double> texel(int level, int x, int y) const
+        {
+            const auto& lvl = m_pyramid->level(level);
+
+            x = ((x % lvl.m_width) + lvl.m_width) % lvl.m_width;
+            y = std::clamp(y, 0, lvl.m_height - 1);
+
+            auto tileX = x / MipPyramid::s_tileSize;
+            auto tileY = y / MipPyramid::s_tileSize;
+
+            // neighboring lookups mostly land in the same tile, remember the last one per thread to skip the cache
+            struct LastTile
+            {
+                const TileCache*                       m_cache   = nullptr;
+                std::uint32_t                          m_pyramid = 0;
+                int                                    m_level   = -1;
+                int                                    m_tileX   = -1;
+                int                                    m_tileY   = -1;
+                std::shared_ptr<const TileCache::Tile> m_tile;
+            };
+            thread_local LastTile last;
+
+            if (last.m_cache != m_cache.get() || last.m_pyramid != m_pyramid->id() || last.m_level != level
+                || last.m_tileX != tileX || last.m_tileY != tileY) {
+                auto tile = m_cache->get(*m_pyramid, level, tileX, tileY);
+                last      = { m_cache.get(), m_pyramid->id(), level, tileX, tileY, std::move(tile) };
+            }
+
+            constexpr auto size = MipPyramid::s_tileSize;
+
+            auto        inTile = std::size_t((y % size) * size + (x % size));
+            const auto* rgb    = &last.m_tile->m_texels[inTile * 3];
+            return { double(rgb[0]), double(rgb[1]), double(rgb[2]) };
+        }
+
+        std::shared_ptr<const MipPyramid> m_pyramid;
+        std::shared_ptr<TileCache>        m_cache;
+    };
+
+}
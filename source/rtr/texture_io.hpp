@@ -0,0 +1,38 @@
+#pragma once
+
+#include "rtr/texture.hpp"
+
+#include <fmt/core.h>
+#include <stb_image.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <stdexcept>
+
+namespace rtr
+{
+
+    // Decodes an image file into a mip pyramid. Kept apart from texture.hpp so that only the programs reading image
+    // files need stb.
+    inline std::shared_ptr<const MipPyramid> loadMipPyramid(const std::filesystem::path& path)
+    {
+        int  width    = 0;
+        int  height   = 0;
+        int  channels = 0;
+        auto data     = stbi_load(path.string().c_str(), &width, &height, &channels, 3);
+        if (data == nullptr) {
+            throw std::runtime_error{
+                fmt::format("Problem loading texture '{}': {}", path.string(), stbi_failure_reason())
+            };
+        }
+
+        auto size    = std::size_t(width) * std::size_t(height) * 3;
+        auto pyramid = std::make_shared<const MipPyramid>(std::span{ data, size }, width, height);
+        stbi_image_free(data);
+
+        return pyramid;
+    }
+
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "rtr/memory.hpp"
+
+#include <algorithm>
+#include <concepts>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace rtr
+{
+
+    // Fixed set of persistent workers for fork-join style parallel loops. Workers are created once and reused by every
+    // render, optionally pinned to one CPU each so they (and the memory they first touch) stay on the same NUMA node.
+    class ThreadPool
+    {
+    public:
+        // numThreads <= 0: one per hardware thread
+        explicit ThreadPool(int numThreads = 0, bool pinThreads = false)
+        {
+            auto hardware = std::max(int(std::thread::hardware_concurrency()), 1);
+            auto count    = numThreads > 0 ? numThreads : hardware;
+
+            // pinning is best effort, pinned() reports whether it worked for every worker
+            m_pinned = pinThreads;
+            m_stacks.add(std::size_t(count) * memory::defaultStackSize());
+            m_workers.reserve(std::size_t(count));
+            for (int i = 0; i < count; ++i) {
+                m_workers.emplace_back([this, i] { workerLoop(i); });
+                if (pinThreads) {
+                    m_pinned = pin(m_workers.back(), i % hardware) && m_pinned;
+                }
+            }
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::scoped_lock lock{ m_mutex };
+                m_stop = true;
+            }
+            m_wake.notify_all();
+        }
+
+        ThreadPool(const ThreadPool&)            = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        int  size() const { return int(m_workers.size()); }
+        bool pinned() const { return m_pinned; }
+
+        // Run `fn(workerIndex)` once on every worker and wait for all of them. The first exception thrown by a worker
+        // is rethrown here. Calls from different threads are serialized.
+        template <std::invocable<int> Fn>
+        void parallel(Fn&& fn)
+        {
+            std::scoped_lock callLock{ m_callMutex };
+
+            std::unique_lock lock{ m_mutex };
+            m_task    = [&fn](int worker) { fn(worker); };
+            m_pending = size();
+            m_error   = nullptr;
+            ++m_generation;
+
+            m_wake.notify_all();
+            m_done.wait(lock, [this] { return m_pending == 0; });
+
+            m_task = nullptr;
+            if (m_error) {
+                std::rethrow_exception(std::exchange(m_error, nullptr));
+            }
+        }
+
+    private:
+        static bool pin([[maybe_unused]] std::jthread& thread, [[maybe_unused]] int cpu)
+        {
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+            return false;
+#endif
+        }
+
+        void workerLoop(int index)
+        {
+            std::uint64_t seen = 0;
+
+            while (true) {
+                std::function<void(int)> task;
+                {
+                    std::unique_lock lock{ m_mutex };
+                    m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+                    if (m_stop) {
+                        return;
+                    }
+                    seen = m_generation;
+                    task = m_task;
+                }
+
+                std::exception_ptr error;
+                try {
+                    task(index);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+
+                std::scoped_lock lock{ m_mutex };
+                if (error && !m_error) {
+                    m_error = error;
+                }
+                if (--m_pending == 0) {
+                    m_done.notify_one();
+                }
+            }
+        }
+
+        std::mutex              m_callMutex;
+        std::mutex              m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_done;
+
+        std::function<void(int)> m_task;
+        std::uint64_t            m_generation = 0;
+        int                      m_pending    = 0;
+        std::exception_ptr       m_error;
+        bool                     m_stop   = false;
+        bool                     m_pinned = false;
+        memory::Charge           m_stacks{ memory::Subsystem::ThreadStacks };
+
+        std::vector<std::jthread> m_workers;    // last, joined before the state above is destroyed
+    };
+
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "rtr/common.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace rtr
+{
+
+    enum class TraversalOrder
+    {
+        Scanline,    // row-major
+        Morton,      // Z-order curve
+        Hilbert,     // Hilbert curve, no jumps between consecutive cells
+    };
+
+    struct Tile
+    {
+        int m_x;
+        int m_y;
+        int m_width;
+        int m_height;
+    };
+
+    inline std::string_view toString(TraversalOrder order)
+    {
+        switch (order) {
+        case TraversalOrder::Scanline: return "scanline";
+        case TraversalOrder::Morton: return "morton";
+        case TraversalOrder::Hilbert: return "hilbert";
+        }
+        return "unknown";
+    }
+
+    inline std::optional<TraversalOrder> parseTraversalOrder(std::string_view name)
+    {
+        for (auto order : { TraversalOrder::Scanline, TraversalOrder::Morton, TraversalOrder::Hilbert }) {
+            if (toString(order) == name) {
+                return order;
+            }
+        }
+        return {};
+    }
+
+    namespace traversal
+    {
+        // every other bit of `code`, the inverse of interleaving x and y
+        inline std::uint32_t compactBits(std::uint64_t code)
+        {
+            code &= 0x5555'5555'5555'5555;
+            code  = (code | (code >> 1)) & 0x3333'3333'3333'3333;
+            code  = (code | (code >> 2)) & 0x0f0f'0f0f'0f0f'0f0f;
+            code  = (code | (code >> 4)) & 0x00ff'00ff'00ff'00ff;
+            code  = (code | (code >> 8)) & 0x0000'ffff'0000'ffff;
+            code  = (code | (code >> 16)) & 0x0000'0000'ffff'ffff;
+            return std::uint32_t(code);
+        }
+
+        inline std::pair<int, int> mortonDecode(std::uint64_t code)
+        {
+            return { int(compactBits(code)), int(compactBits(code >> 1)) };
+        }
+
+        // index along the Hilbert curve filling a `side` x `side` square (side is a power of two) to coordinates
+        inline std::pair<int, int> hilbertDecode(std::uint64_t index, int side)
+        {
+            int x = 0;
+            int y = 0;
+            for (int s = 1; s < side; s *= 2) {
+                auto rx = int((index / 2) & 1);
+                auto ry = int((index ^ std::uint64_t(rx)) & 1);
+
+                // rotate the quadrant
+                if (ry == 0) {
+                    if (rx == 1) {
+                        x = s - 1 - x;
+                        y = s - 1 - y;
+                    }
+                    std::swap(x, y);
+                }
+
+                x     += s * rx;
+                y     += s * ry;
+                index /= 4;
+            }
+            return { x, y };
+        }
+
+        // Cells of a `width` x `height` grid in the given order. The curves are generated over the enclosing power of
+        // two square and cells falling outside the grid are skipped, which keeps the remaining ones coherent.
+        inline std::vector<std::pair<int, int>> order(int width, int height, TraversalOrder order)
+        {
+            std::vector<std::pair<int, int>> cells;
+            cells.reserve(std::size_t(width) * std::size_t(height));
+
+            if (order == TraversalOrder::Scanline) {
+                for (int y = 0; y < height; ++y) {
+                    for (int x = 0; x < width; ++x) {
+                        cells.emplace_back(x, y);
+                    }
+                }
+                return cells;
+            }
+
+            auto side  = int(std::bit_ceil(std::uint32_t(std::max({ width, height, 1 }))));
+            auto count = std::uint64_t(side) * std::uint64_t(side);
+
+            for (std::uint64_t i = 0; i < count; ++i) {
+                auto [x, y] = order == TraversalOrder::Morton ? mortonDecode(i) : hilbertDecode(i, side);
+                if (x < width && y < height) {
+                    cells.emplace_back(x, y);
+                }
+            }
+            return cells;
+        }
+
+        // tiles covering a `width` x `height` image, the ones on the right and bottom edges may be smaller
+        inline std::vector<Tile> makeTiles(int width, int height, int tileSize, TraversalOrder tileOrder)
+        {
+            auto tilesX = (width + tileSize - 1) / tileSize;
+            auto tilesY = (height + tileSize - 1) / tileSize;
+
+            std::vector<Tile> tiles;
+            tiles.reserve(std::size_t(tilesX) * std::size_t(tilesY));
+
+            for (auto [tx, ty] : order(tilesX, tilesY, tileOrder)) {
+                auto x = tx * tileSize;
+                auto y = ty * tileSize;
+                tiles.push_back({ x, y, std::min(tileSize, width - x), std::min(tileSize, height - y) });
+            }
+            return tiles;
+        }
+    }
+
+}
@@ -3,8 +3,10 @@
 #include "rtr/common.hpp"
 
 #include <cmath>
+#include <cstdint>
 #include <ctime>
 #include <random>
+#include <string_view>
 
 namespace rtr::util
 {
@@ -29,11 +31,40 @@ namespace rtr::util
         return toRadian(static_cast<double>(deg));
     }
 
-    inline double getRandomCanonical()
+    inline std::mt19937& randomEngine()
     {
         thread_local static std::mt19937 mt{ static_cast<std::mt19937::result_type>(std::time(nullptr)) };
-        thread_local static std::uniform_real_distribution<double> dist{ 0.0, 1.0 };
-        return dist(mt);
+        return mt;
+    }
+
+    // splitmix64 finalizer, spreads nearby inputs (pixel coordinates) over the whole range
+    inline std::uint64_t mixBits(std::uint64_t value)
+    {
+        value = (value ^ (value >> 30)) * 0xbf58'476d'1ce4'e5b9;
+        value = (value ^ (value >> 27)) * 0x94d0'49bb'1331'11eb;
+        return value ^ (value >> 31);
+    }
+
+    // FNV-1a
+    inline std::uint64_t hashBytes(std::string_view bytes, std::uint64_t hash = 0xcbf2'9ce4'8422'2325)
+    {
+        for (auto byte : bytes) {
+            hash ^= std::uint8_t(byte);
+            hash *= 0x100'0000'01b3;
+        }
+        return hash;
+    }
+
+    // restart the calling thread's random sequence, used to give every pixel its own stream
+    inline void seedRandom(std::uint64_t seed)
+    {
+        randomEngine().seed(static_cast<std::mt19937::result_type>(mixBits(seed) >> 32));
+    }
+
+    inline double getRandomCanonical()
+    {
+        std::uniform_real_distribution<double> dist{ 0.0, 1.0 };
+        return dist(randomEngine());
     }
 
     template <typename T>
@@ -54,4 +85,9 @@ namespace rtr::util
         return std::sqrt(linear);
     }
 
+    inline double gammaToLinear(double gamma)
+    {
+        return gamma * gamma;
+    }
+
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rtr/concepts.hpp"
+#include "rtr/simd.hpp"
 #include "rtr/util.hpp"
 
 #include <cstdlib>
@@ -11,6 +12,7 @@
 #include <array>
 #include <cmath>
 #include <concepts>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <tuple>
@@ -37,6 +39,9 @@ namespace rtr
 
         template <typename T, std::size_t N>
         Vec<T, N> normalized(const Vec<T, N>&);
+
+        template <typename T>
+        Vec<T, 3> cross(const Vec<T, 3>&, const Vec<T, 3>&);
     }
     // forward declarations end
 
@@ -63,6 +68,10 @@ namespace rtr
 
         Vec operator-() const
         {
+            if constexpr (s_accelerated) {
+                return fromPack(-pack());
+            }
+
             auto data = m_data;
             for (auto& e : data) {
                 e = -e;
@@ -72,6 +81,10 @@ namespace rtr
 
         Vec operator+(const Vec& other) const
         {
+            if constexpr (s_accelerated) {
+                return fromPack(pack() + other.pack());
+            }
+
             auto data = m_data;
             for (std::size_t i = 0; i < data.size(); ++i) {
                 data[i] = data[i] + other.m_data[i];
@@ -81,6 +94,10 @@ namespace rtr
 
         Vec operator-(const Vec& other) const
         {
+            if constexpr (s_accelerated) {
+                return fromPack(pack() - other.pack());
+            }
+
             auto data = m_data;
             for (std::size_t i = 0; i < data.size(); ++i) {
                 data[i] = data[i] - other.m_data[i];
@@ -90,6 +107,10 @@ namespace rtr
 
         Vec operator*(const Vec& other) const
         {
+            if constexpr (s_accelerated) {
+                return fromPack(pack() * other.pack());
+            }
+
             auto data = m_data;
             for (std::size_t i = 0; i < data.size(); ++i) {
                 data[i] = data[i] * other.m_data[i];
@@ -99,6 +120,10 @@ namespace rtr
 
         Vec operator/(const Vec& other) const
         {
+            if constexpr (s_accelerated) {
+                return fromPack(pack() / other.pack().padOne());
+            }
+
             auto data = m_data;
             for (std::size_t i = 0; i < data.size(); ++i) {
                 data[i] = data[i] / other.m_data[i];
@@ -110,6 +135,10 @@ namespace rtr
             requires Add<T, TT, T>
         Vec operator+(const TT& other) const
         {
+            if constexpr (s_accelerated) {
+                return fromPack(pack() + Pack::splat3(static_cast<T>(other)));
+            }
+
             auto data = m_data;
             for (auto& e : data) {
                 e = e + other;
@@ -128,6 +157,10 @@ namespace rtr
             requires Mul<T, TT, T>
         Vec operator*(const TT& other) const
         {
+            if constexpr (s_accelerated) {
+                return fromPack(pack() * Pack::splat3(static_cast<T>(other)));
+            }
+
             auto data = m_data;
             for (auto& e : data) {
                 e = e * other;
@@ -139,6 +172,10 @@ namespace rtr
             requires Div<T, TT, T>
         Vec operator/(const TT& other) const
         {
+            if constexpr (s_accelerated) {
+                return fromPack(pack() / Pack::divisor3(static_cast<T>(other)));
+            }
+
             auto data = m_data;
             for (auto& e : data) {
                 e = e / other;
@@ -148,6 +185,11 @@ namespace rtr
 
         Vec& operator+=(const Vec& other)
         {
+            if constexpr (s_accelerated) {
+                (pack() + other.pack()).store(m_data.data());
+                return *this;
+            }
+
             for (std::size_t i = 0; i < m_data.size(); ++i) {
                 m_data[i] = m_data[i] + other.m_data[i];
             };
@@ -156,6 +198,11 @@ namespace rtr
 
         Vec& operator-=(const Vec& other)
         {
+            if constexpr (s_accelerated) {
+                (pack() - other.pack()).store(m_data.data());
+                return *this;
+            }
+
             for (std::size_t i = 0; i < m_data.size(); ++i) {
                 m_data[i] = m_data[i] - other.m_data[i];
             };
@@ -164,6 +211,11 @@ namespace rtr
 
         Vec& operator*=(const Vec& other)
         {
+            if constexpr (s_accelerated) {
+                (pack() * other.pack()).store(m_data.data());
+                return *this;
+            }
+
             for (std::size_t i = 0; i < m_data.size(); ++i) {
                 m_data[i] = m_data[i] * other.m_data[i];
             };
@@ -172,6 +224,11 @@ namespace rtr
 
         Vec& operator/=(const Vec& other)
         {
+            if constexpr (s_accelerated) {
+                (pack() / other.pack().padOne()).store(m_data.data());
+                return *this;
+            }
+
             for (std::size_t i = 0; i < m_data.size(); ++i) {
                 m_data[i] = m_data[i] / other.m_data[i];
             };
@@ -182,6 +239,11 @@ namespace rtr
             requires Add<T, TT, T>
         Vec& operator+=(const TT& other)
         {
+            if constexpr (s_accelerated) {
+                (pack() + Pack::splat3(static_cast<T>(other))).store(m_data.data());
+                return *this;
+            }
+
             for (auto& e : m_data) {
                 e = e + other;
             };
@@ -199,6 +261,11 @@ namespace rtr
             requires Mul<T, TT, T>
         Vec& operator*=(const TT& other)
         {
+            if constexpr (s_accelerated) {
+                (pack() * Pack::splat3(static_cast<T>(other))).store(m_data.data());
+                return *this;
+            }
+
             for (auto& e : m_data) {
                 e = e * other;
             };
@@ -209,6 +276,11 @@ namespace rtr
             requires Div<T, TT, T>
         Vec& operator/=(const TT& other)
         {
+            if constexpr (s_accelerated) {
+                (pack() / Pack::divisor3(static_cast<T>(other))).store(m_data.data());
+                return *this;
+            }
+
             for (auto& e : m_data) {
                 e = e / other;
             };
@@ -257,11 +329,11 @@ namespace rtr
             requires(fmt::is_formattable<T>::value || std::convertible_to<const T, std::string>)
         {
             if constexpr (fmt::is_formattable<T>::value) {
-                return fmt::format("{}", m_data);
+                return fmt::format("{}", std::span{ m_data }.template first<N>());
             } else {
                 auto str  = std::string{ "[" };
                 str      += static_cast<std::string>(m_data[0]);
-                for (std::size_t i = 1; i < m_data.size(); ++i) {
+                for (std::size_t i = 1; i < N; ++i) {
                     str += ", " + static_cast<std::string>(m_data[i]);
                 }
                 str += ']';
@@ -287,13 +359,36 @@ namespace rtr
         friend auto vecfn::length<T, N>(const Vec&) -> T;
         friend auto vecfn::normalized<T, N>(const Vec&) -> Vec;
 
+        template <typename U>
+        friend Vec<U, 3> vecfn::cross(const Vec<U, 3>&, const Vec<U, 3>&);
+
     private:
-        explicit Vec(std::array<T, N>&& data)
+        // float and double 3D vectors are stored as 4 lanes (the last one always 0) and use SIMD operations
+        static constexpr bool s_accelerated = simd::Accelerated<T, N>;
+
+        using Storage = std::array<T, simd::s_storageSize<T, N>>;
+        using Pack    = simd::Pack<std::conditional_t<s_accelerated, T, float>>;    // unused when not accelerated
+
+        explicit Vec(Storage&& data)
             : m_data{ std::move(data) }
         {
         }
 
-        std::array<T, N> m_data{};
+        Pack pack() const
+            requires s_accelerated
+        {
+            return Pack::load(m_data.data());
+        }
+
+        static Vec fromPack(const Pack& pack)
+            requires s_accelerated
+        {
+            Vec vec;
+            pack.store(vec.m_data.data());
+            return vec;
+        }
+
+        alignas(simd::s_alignment<T, N>) Storage m_data{};
     };
 
     // aliases
@@ -323,6 +418,10 @@ namespace rtr
         template <typename T>
         Vec<T, 3> cross(const Vec<T, 3>& lhs, const Vec<T, 3>& rhs)
         {
+            if constexpr (simd::Accelerated<T, 3>) {
+                return Vec<T, 3>::fromPack(Vec<T, 3>::Pack::cross(lhs.pack(), rhs.pack()));
+            }
+
             auto x = lhs.y() * rhs.z() - lhs.z() * rhs.y();
             auto y = lhs.z() * rhs.x() - lhs.x() * rhs.z();
             auto z = lhs.x() * rhs.y() - lhs.y() * rhs.x();
@@ -332,8 +431,12 @@ namespace rtr
         template <typename T, std::size_t N = 3>
         T dot(const Vec<T, N>& lhs, const Vec<T, N>& rhs)
         {
+            if constexpr (simd::Accelerated<T, N>) {
+                return (lhs.pack() * rhs.pack()).sum();
+            }
+
             T acc{};
-            for (std::size_t i = 0; i < lhs.m_data.size(); ++i) {
+            for (std::size_t i = 0; i < N; ++i) {
                 acc += lhs.m_data[i] * rhs.m_data[i];
             };
             return acc;
@@ -0,0 +1,371 @@
+#pragma once
+
+#include "rtr/aabb.hpp"
+#include "rtr/bvh.hpp"
+#include "rtr/ray.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+    #include <immintrin.h>
+#endif
+
+namespace rtr
+{
+
+    // Node of a wide BVH, up to `Width` children tested together. Child bounds are 8 bit offsets from the corner of the
+    // node in steps of a power of two per axis, rounded outward, so a 4-wide node fits a cache line and an 8-wide one
+    // two. A child is either another node or a leaf, whose primitives are m_order[m_child, m_child + m_count) of the
+    // binary tree the wide one was collapsed from (see bvh::widen), there are no leaf nodes.
+    template <std::size_t Width>
+    struct alignas(64) WideBvhNode
+    {
+        static_assert(Width == 4 || Width == 8);
+
+        using Lanes = std::array<std::uint8_t, Width>;
+
+        // the leaves of bvh::build's default options fit m_count, bvh::widen() rejects larger ones
+        static_assert(bvh::s_maxLeafSize <= std::numeric_limits<std::uint8_t>::max());
+
+        std::array<float, 3>             m_origin;      // lower corner, rounded down
+        std::array<std::int8_t, 3>       m_exponent;    // a quantization step is 2^m_exponent
+        std::uint8_t                     m_numChildren;
+        std::array<Lanes, 3>             m_lower;    // per axis, structure of arrays for the SIMD test
+        std::array<Lanes, 3>             m_upper;
+        std::array<std::uint32_t, Width> m_child;
+        Lanes                            m_count;    // 0 for inner nodes
+
+        bool leaf(std::size_t child) const { return m_count[child] > 0; }
+    };
+
+    static_assert(sizeof(WideBvhNode<4>) == 64);
+    static_assert(sizeof(WideBvhNode<8>) == 128);
+
+    namespace bvh
+    {
+#if defined(__AVX__)
+        inline constexpr std::size_t s_width = 8;    // children per node of the scene BVH
+#else
+        inline constexpr std::size_t s_width = 4;
+#endif
+
+        namespace detail
+        {
+            // Room left around every child on top of the rounding of the quantization, relative to the size of the
+            // node, and on the interval a ray spends in a child box. They cover the rounding of the single precision
+            // box test, which then never misses a box that the double precision one would hit.
+            inline constexpr int   s_boxMarginExponent = -20;
+            inline constexpr float s_rayMargin         = 0x1p-20f;
+
+            template <std::size_t Width>
+            class Widener
+            {
+            public:
+                explicit Widener(std::span<const BvhNode> nodes)
+                    : m_nodes{ nodes }
+                {
+                }
+
+                std::vector<WideBvhNode<Width>> widen()
+                {
+                    if (!m_nodes.empty()) {
+                        m_wide.reserve(m_nodes.size() / (Width - 1) + 1);
+                        emit(0);
+                    }
+                    return std::move(m_wide);
+                }
+
+            private:
+                // Opens the largest inner child until there are `Width` children, they are the binary nodes the wide
+                // node stands for. A root that is a leaf is the only child of the wide root.
+                std::uint32_t emit(std::uint32_t index)
+                {
+                    auto wideIndex = std::uint32_t(m_wide.size());
+                    m_wide.emplace_back();
+
+                    std::array<std::uint32_t, Width> children{};
+                    std::size_t                      numChildren = 0;
+                    if (m_nodes[index].leaf()) {
+                        children[numChildren++] = index;
+                    } else {
+                        children[numChildren++] = index + 1;
+                        children[numChildren++] = m_nodes[index].m_offset;
+                    }
+
+                    while (numChildren < Width) {
+                        std::size_t open = numChildren;
+                        double      area = -1.0;
+                        for (std::size_t i = 0; i < numChildren; ++i) {
+                            const auto& node = m_nodes[children[i]];
+                            if (!node.leaf() && node.m_bounds.surfaceArea() > area) {
+                                open = i;
+                                area = node.m_bounds.surfaceArea();
+                            }
+                        }
+                        if (open == numChildren) {
+                            break;
+                        }
+
+                        // its first child takes its place, keeping the children in depth first order
+                        auto opened = children[open];
+                        std::move_backward(
+                            children.begin() + std::ptrdiff_t(open) + 1,
+                            children.begin() + std::ptrdiff_t(numChildren),
+                            children.begin() + std::ptrdiff_t(numChildren) + 1
+                        );
+                        children[open]     = opened + 1;
+                        children[open + 1] = m_nodes[opened].m_offset;
+                        ++numChildren;
+                    }
+
+                    WideBvhNode<Width> wide{};
+                    wide.m_numChildren = std::uint8_t(numChildren);
+                    quantize(wide, m_nodes[index].m_bounds, std::span{ children }.first(numChildren));
+                    for (std::size_t i = 0; i < numChildren; ++i) {
+                        const auto& node = m_nodes[children[i]];
+                        if (node.m_count > std::numeric_limits<std::uint8_t>::max()) {
+                            throw std::invalid_argument{ fmt::format(
+                                "A leaf of {} primitives doesn't fit a wide BVH node, the limit is {}",
+                                node.m_count,
+                                int(std::numeric_limits<std::uint8_t>::max())
+                            ) };
+                        }
+                        wide.m_count[i] = std::uint8_t(node.m_count);
+                        wide.m_child[i] = node.leaf() ? node.m_offset : emit(children[i]);
+                    }
+
+                    m_wide[wideIndex] = wide;
+                    return wideIndex;
+                }
+
+                void quantize(
+                    WideBvhNode<Width>& wide, const Aabb& bounds, std::span<const std::uint32_t> children
+                ) const
+                {
+                    auto extent = bounds.extent();
+                    auto margin = std::ldexp(std::max({ extent.x(), extent.y(), extent.z() }), s_boxMarginExponent);
+
+                    for (std::size_t axis = 0; axis < 3; ++axis) {
+                        auto origin = roundDown(bounds.min()[axis] - margin);
+                        auto span   = bounds.max()[axis] + margin - origin;
+                        span        = std::max(span, double(std::numeric_limits<float>::min()));
+
+                        // the smallest step for which 255 of them cover the node
+                        int exponent = 0;
+                        std::frexp(span / 255.0, &exponent);
+                        while (std::ldexp(255.0, exponent - 1) >= span) {
+                            --exponent;
+                        }
+                        exponent = std::clamp(exponent, -100, 100);
+
+                        wide.m_origin[axis]   = float(origin);
+                        wide.m_exponent[axis] = std::int8_t(exponent);
+
+                        for (std::size_t i = 0; i < children.size(); ++i) {
+                            const auto& box   = m_nodes[children[i]].m_bounds;
+                            auto        lower = std::floor(std::ldexp(box.min()[axis] - margin - origin, -exponent));
+                            auto        upper = std::ceil(std::ldexp(box.max()[axis] + margin - origin, -exponent));
+
+                            wide.m_lower[axis][i] = std::uint8_t(std::clamp(lower, 0.0, 255.0));
+                            wide.m_upper[axis][i] = std::uint8_t(std::clamp(upper, 0.0, 255.0));
+                        }
+                    }
+                }
+
+                static double roundDown(double value)
+                {
+                    auto rounded = float(value);
+                    auto lower   = std::nextafter(rounded, -std::numeric_limits<float>::infinity());
+                    return double(rounded) > value ? double(lower) : double(rounded);
+                }
+
+                std::span<const BvhNode>        m_nodes;
+                std::vector<WideBvhNode<Width>> m_wide;
+            };
+
+            // 2^exponent, quantize keeps the exponents in the range of normal floats
+            inline float stepOf(std::int8_t exponent)
+            {
+                return std::bit_cast<float>(std::uint32_t(exponent + 127) << 23);
+            }
+
+            // the ray in the frame of a node, single precision
+            struct LocalRay
+            {
+                std::array<float, 3> m_origin;
+                std::array<float, 3> m_invDirection;
+                unsigned             m_signBits;
+
+                LocalRay(const Ray& ray, const std::array<float, 3>& corner)
+                    : m_signBits{ ray.signBits() }
+                {
+                    for (std::size_t axis = 0; axis < 3; ++axis) {
+                        m_origin[axis]       = float(ray.origin()[axis] - double(corner[axis]));
+                        m_invDirection[axis] = float(ray.invDirection()[axis]);
+                    }
+                }
+            };
+
+            // Slab test of the children of a node, bit i of the result is set when the ray crosses child i within
+            // [tMin, tMax] and tNear[i] is then where it enters. Same NaN handling as Aabb::hit.
+            template <std::size_t Width>
+            unsigned hitChildren(
+                const WideBvhNode<Width>& node, const Ray& ray, float tMin, float tMax, std::array<float, Width>& tNear
+            )
+            {
+                LocalRay local{ ray, node.m_origin };
+
+#if defined(__SSE2__)
+                // groups of 4 lanes, two of them for 8-wide nodes
+                const auto toFloats = [](const std::uint8_t* bytes) {
+                    std::int32_t packed = 0;
+                    std::memcpy(&packed, bytes, sizeof(packed));
+                    __m128i zero  = _mm_setzero_si128();
+                    __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+                    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+                };
+                const __m128 signMask = _mm_set1_ps(-0.0f);
+                const __m128 margin   = _mm_set1_ps(s_rayMargin);
+
+                unsigned mask = 0;
+                for (std::size_t group = 0; group < Width; group += 4) {
+                    __m128 nearT = _mm_set1_ps(tMin);
+                    __m128 farT  = _mm_set1_ps(tMax);
+                    for (std::size_t axis = 0; axis < 3; ++axis) {
+                        __m128 step   = _mm_set1_ps(stepOf(node.m_exponent[axis]));
+                        __m128 origin = _mm_set1_ps(local.m_origin[axis]);
+                        __m128 inv    = _mm_set1_ps(local.m_invDirection[axis]);
+
+                        const auto slab = [&](const std::uint8_t* bounds) {
+                            return _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(toFloats(bounds), step), origin), inv);
+                        };
+                        auto lower = slab(&node.m_lower[axis][group]);
+                        auto upper = slab(&node.m_upper[axis][group]);
+
+                        bool negative = (local.m_signBits >> axis) & 1u;
+                        nearT         = _mm_max_ps(negative ? upper : lower, nearT);    // the second operand on NaN
+                        farT          = _mm_min_ps(negative ? lower : upper, farT);
+                    }
+
+                    nearT = _mm_sub_ps(nearT, _mm_mul_ps(_mm_andnot_ps(signMask, nearT), margin));
+                    farT  = _mm_add_ps(farT, _mm_mul_ps(_mm_andnot_ps(signMask, farT), margin));
+
+                    _mm_storeu_ps(&tNear[group], nearT);
+                    mask |= unsigned(_mm_movemask_ps(_mm_cmple_ps(nearT, farT))) << group;
+                }
+#else
+                unsigned mask = 0;
+                for (std::size_t child = 0; child < Width; ++child) {
+                    float nearT = tMin;
+                    float farT  = tMax;
+                    for (std::size_t axis = 0; axis < 3; ++axis) {
+                        float step  = stepOf(node.m_exponent[axis]);
+                        float lower = (float(node.m_lower[axis][child]) * step - local.m_origin[axis])
+                                    * local.m_invDirection[axis];
+                        float upper = (float(node.m_upper[axis][child]) * step - local.m_origin[axis])
+                                    * local.m_invDirection[axis];
+
+                        bool negative = (local.m_signBits >> axis) & 1u;
+                        nearT         = std::max(nearT, negative ? upper : lower);
+                        farT          = std::min(farT, negative ? lower : upper);
+                    }
+
+                    nearT         = nearT - std::abs(nearT) * s_rayMargin;
+                    farT          = farT + std::abs(farT) * s_rayMargin;
+                    tNear[child]  = nearT;
+                    mask         |= unsigned(nearT <= farT) << child;
+                }
+#endif
+
+                return mask & ((1u << node.m_numChildren) - 1u);
+            }
+        }
+
+        // Collapse a binary hierarchy into one with up to `Width` children per node. The leaves stay as they are, the
+        // primitive order of the binary tree is the one the wide tree refers to.
+        template <std::size_t Width>
+        std::vector<WideBvhNode<Width>> widen(std::span<const BvhNode> nodes)
+        {
+            return detail::Widener<Width>{ nodes }.widen();
+        }
+
+        // Same contract as traverse over binary nodes, except that `leaf(first, count, tMax)` gets the primitive range
+        // of a leaf. The children a ray crosses are visited nearest first and skipped when tMax dropped below where
+        // the ray enters them.
+        template <std::size_t Width, typename Leaf>
+        bool traverse(std::span<const WideBvhNode<Width>> nodes, const Ray& ray, double tMin, double& tMax, Leaf&& leaf)
+        {
+            if (nodes.empty()) {
+                return false;
+            }
+
+            struct Entry
+            {
+                std::uint32_t m_child;
+                std::uint32_t m_count;
+                float         m_tNear;
+            };
+
+            // every level pushes at most all its children but one
+            std::array<Entry, s_maxDepth * (Width - 1)> stack;
+            std::size_t                                 top = 0;
+
+            std::array<float, Width>         tNear;
+            std::array<std::uint32_t, Width> order;
+
+            Entry entry{ 0, 0, float(tMin) };
+            while (true) {
+                if (double(entry.m_tNear) <= tMax) {
+                    if (entry.m_count > 0) {
+                        if (leaf(entry.m_child, entry.m_count, tMax)) {
+                            return true;
+                        }
+                    } else {
+                        const auto& node = nodes[entry.m_child];
+                        auto        mask = detail::hitChildren(node, ray, float(tMin), float(tMax), tNear);
+
+                        // farthest first, by insertion: the nearest child is visited next and the others pushed
+                        std::size_t numHits = 0;
+                        for (; mask != 0; mask &= mask - 1) {
+                            auto child = std::uint32_t(std::countr_zero(mask));
+                            auto slot  = numHits++;
+                            for (; slot > 0 && tNear[order[slot - 1]] < tNear[child]; --slot) {
+                                order[slot] = order[slot - 1];
+                            }
+                            order[slot] = child;
+                        }
+
+                        if (numHits > 0) {
+                            for (std::size_t i = 0; i + 1 < numHits; ++i) {
+                                auto child   = order[i];
+                                stack[top++] = { node.m_child[child], node.m_count[child], tNear[child] };
+                            }
+                            auto nearest = order[numHits - 1];
+                            entry        = { node.m_child[nearest], node.m_count[nearest], tNear[nearest] };
+                            continue;
+                        }
+                    }
+                }
+
+                if (top == 0) {
+                    return false;
+                }
+                entry = stack[--top];
+            }
+        }
+    }
+
+}
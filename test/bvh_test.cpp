@@ -0,0 +1,190 @@
+#include "rtr/aabb.hpp"
+#include "rtr/bvh.hpp"
+#include "rtr/hittable.hpp"
+#include "rtr/sphere.hpp"
+#include "rtr/thread_pool.hpp"
+#include "rtr/wide_bvh.hpp"
+
+#include <fmt/core.h>
+#include <boost/ut.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <span>
+#include <utility>
+#include <vector>
+
+using rtr::Hittable;
+using rtr::HittableList;
+using rtr::Ray;
+using rtr::Sphere;
+using rtr::Vec3;
+
+int main()
+{
+    namespace ut = boost::ut;
+    using namespace ut::literals;
+    using namespace ut::operators;
+
+    // the same spheres twice, the reference list is scanned linearly and the other one is built
+    std::mt19937                           rng{ 1234 };
+    std::uniform_real_distribution<double> position{ -50.0, 50.0 };
+    std::uniform_real_distribution<double> radius{ 0.1, 2.0 };
+    std::uniform_real_distribution<double> unit{ -1.0, 1.0 };
+
+    HittableList                                 reference;
+    HittableList                                 scene;
+    std::vector<std::pair<Vec3<double>, double>> spheres;
+    for (int i = 0; i < 3000; ++i) {
+        Vec3<double> center{ position(rng), position(rng), position(rng) };
+        auto         r = radius(rng);
+        reference.emplace<Sphere>(center, r);
+        scene.emplace<Sphere>(center, r);
+        spheres.emplace_back(center, r);
+    }
+    scene.build();
+
+    // Rays grazing a sphere from outside and from inside the spheres, rays along the axes (infinite inverse
+    // directions, half of them with the other components -0.0) and random ones.
+    std::vector<Ray> rays;
+    for (std::size_t i = 0; i < 4000; ++i) {
+        const auto& [center, r] = spheres[i % spheres.size()];
+
+        Vec3<double> origin{ 1.5 * position(rng), 1.5 * position(rng), 1.5 * position(rng) };
+        Vec3<double> normal{ unit(rng), unit(rng), unit(rng) };
+        normal = normal / rtr::vecfn::length(normal);
+        if (i % 4 == 1) {
+            origin = center + 0.5 * r * normal;
+        }
+
+        Vec3<double> direction = center + r * normal - origin;
+        if (i % 4 == 2) {
+            direction              = i % 16 < 8 ? Vec3<double>{ 0.0, 0.0, 0.0 } : -Vec3<double>{ 0.0, 0.0, 0.0 };
+            direction[(i / 4) % 3] = i % 8 < 4 ? 1.0 : -1.0;
+        } else if (i % 4 == 3) {
+            direction = { unit(rng), unit(rng), unit(rng) };
+        }
+        rays.emplace_back(origin, direction);
+    }
+
+    const rtr::Interval<double> tRange{ 0.001, rtr::n::infinity };
+
+    const auto indexOf = [](const HittableList& list, const Hittable* object) -> std::optional<std::size_t> {
+        auto objects = list.objects();
+        auto found   = std::ranges::find_if(objects, [&](const auto& other) { return other.get() == object; });
+        return found == objects.end() ? std::nullopt : std::optional{ std::size_t(found - objects.begin()) };
+    };
+
+    std::vector<std::optional<std::size_t>> expected;
+    for (const auto& ray : rays) {
+        auto hit = reference.hit(ray, tRange);
+        expected.push_back(hit.has_value() ? indexOf(reference, hit->m_object) : std::nullopt);
+    }
+    auto numHits = std::size_t(std::ranges::count_if(expected, [](const auto& hit) { return hit.has_value(); }));
+    ut::expect(numHits > rays.size() / 2) << fmt::format("{} hits", numHits);
+
+    "hittable list"_test = [&] {
+        for (std::size_t i = 0; i < rays.size(); ++i) {
+            auto hit   = scene.hit(rays[i], tRange);
+            auto index = hit.has_value() ? indexOf(scene, hit->m_object) : std::nullopt;
+            ut::expect(index == expected[i]) << fmt::format("ray {}", i);
+            ut::expect(scene.occluded(rays[i], tRange) == expected[i].has_value()) << fmt::format("ray {}", i);
+        }
+
+        // a negated axis has -0.0 components, the boxes must see those like 0.0: straight down from above a sphere
+        // and from its center
+        for (std::size_t i = 0; i < 100; ++i) {
+            const auto& [center, r] = spheres[i];
+            for (auto origin : { center + Vec3<double>{ 0.0, r + 1.0, 0.0 }, center }) {
+                Ray  down{ origin, -Vec3<double>{ 0.0, 1.0, 0.0 } };
+                auto hit   = scene.hit(down, tRange);
+                auto index = hit.has_value() ? indexOf(scene, hit->m_object) : std::nullopt;
+                auto ref   = reference.hit(down, tRange);
+                ut::expect(ref.has_value() && index == indexOf(reference, ref->m_object))
+                    << fmt::format("sphere {}", i);
+                ut::expect(scene.occluded(down, tRange)) << fmt::format("sphere {}", i);
+            }
+        }
+    };
+
+    // the same closest hits through nodes of any width
+    const auto closestHits = [&]<std::size_t Width>(const std::vector<rtr::WideBvhNode<Width>>& nodes) {
+        const auto& tree    = scene.bvh();
+        auto        objects = scene.objects();
+
+        std::vector<std::optional<std::size_t>> hits;
+        for (const auto& ray : rays) {
+            std::optional<std::size_t> hit;
+            auto                       tMax = tRange.max();
+            rtr::bvh::traverse(std::span{ nodes }, ray, tRange.min(), tMax, [&](auto first, auto count, double& t) {
+                for (auto index : tree.m_order.subspan(first, count)) {
+                    if (auto result = objects[index]->hit(ray, { tRange.min(), t }); result.has_value()) {
+                        t   = result->m_record.m_t;
+                        hit = index;
+                    }
+                }
+                return false;
+            });
+            hits.push_back(hit);
+        }
+        return hits;
+    };
+
+    "wide"_test = [&] {
+        auto wide4 = rtr::bvh::widen<4>(scene.bvh().m_nodes);
+        auto wide8 = rtr::bvh::widen<8>(scene.bvh().m_nodes);
+        ut::expect(wide4.size() < scene.bvh().m_nodes.size() / 3);
+        ut::expect(wide8.size() < wide4.size());
+
+        ut::expect(closestHits(wide4) == expected);
+        ut::expect(closestHits(wide8) == expected);
+    };
+
+    "wide leaves"_test = [&] {
+        // every primitive is in exactly one leaf
+        auto                     wide = rtr::bvh::widen<4>(scene.bvh().m_nodes);
+        std::vector<std::size_t> seen(scene.objects().size());
+        for (const auto& node : wide) {
+            for (std::size_t child = 0; child < node.m_numChildren; ++child) {
+                for (std::uint32_t i = 0; node.leaf(child) && i < node.m_count[child]; ++i) {
+                    ++seen[scene.bvh().m_order[node.m_child[child] + i]];
+                }
+            }
+        }
+        ut::expect(std::ranges::all_of(seen, [](auto count) { return count == 1; }));
+
+        ut::expect(rtr::bvh::widen<4>({}).empty());
+    };
+
+    "parallel build"_test = [&] {
+        // enough boxes for the parallel builder to split the top of the tree between the workers several times
+        std::vector<rtr::Aabb> boxes;
+        for (std::size_t i = 0; i < 8 * rtr::bvh::detail::s_parallelGrain + 321; ++i) {
+            Vec3<double> center{ position(rng), position(rng), position(rng) };
+            auto         r = 0.05 * radius(rng);
+            boxes.emplace_back(center - Vec3<double>{ r, r, r }, center + Vec3<double>{ r, r, r });
+        }
+
+        const auto sameVec = [](const Vec3<double>& lhs, const Vec3<double>& rhs) {
+            return lhs.x() == rhs.x() && lhs.y() == rhs.y() && lhs.z() == rhs.z();
+        };
+        const auto sameNode = [&](const rtr::BvhNode& lhs, const rtr::BvhNode& rhs) {
+            return lhs.m_offset == rhs.m_offset && lhs.m_count == rhs.m_count && lhs.m_axis == rhs.m_axis
+                && sameVec(lhs.m_bounds.min(), rhs.m_bounds.min()) && sameVec(lhs.m_bounds.max(), rhs.m_bounds.max());
+        };
+
+        // the tree doesn't depend on the worker count, BVH cache keys rely on it
+        auto serial = rtr::bvh::build(boxes);
+        for (int workers : { 1, 2, 3, 5, 8 }) {
+            rtr::ThreadPool pool{ workers };
+            auto            tree = rtr::bvh::build(boxes, { .m_pool = &pool });
+            ut::expect(tree.m_order == serial.m_order)
+                << fmt::format("{} workers order the boxes differently", workers);
+            ut::expect(std::ranges::equal(tree.m_nodes, serial.m_nodes, sameNode))
+                << fmt::format("{} workers build another tree", workers);
+        }
+    };
+}
@@ -0,0 +1,348 @@
+// Renders small versions of the built-in scenes with a fixed seed and compares them against the reference images in
+// test/golden. Also records the render time of every scene and reports, without failing, a scene that got much slower
+// than its best recorded time on this machine: timings of such short renders follow the load of the machine.
+//
+// usage: golden_test <reference dir> <output dir> [--update]
+//   <output dir> receives the new renders (<scene>.ppm) and the timing history (timings.txt)
+//   --update     replaces the reference images with the new renders
+
+#include "rtr/first_hits.hpp"
+#include "rtr/image.hpp"
+#include "rtr/instance.hpp"
+#include "rtr/ppm.hpp"
+#include "rtr/ray_tracer.hpp"
+#include "rtr/render_job.hpp"
+#include "rtr/scene.hpp"
+#include "rtr/scenes.hpp"
+#include "rtr/sphere.hpp"
+
+#include <concurrencpp/concurrencpp.h>
+#include <fmt/core.h>
+#include <boost/ut.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using rtr::Image;
+
+namespace
+{
+    struct GoldenScene
+    {
+        std::string_view m_name;
+        rtr::Background  m_background;
+    };
+
+    // small enough to render in about a second, with enough samples to keep the noise well above the error floor
+    rtr::TracerParam goldenParam(rtr::Background background, std::uint64_t seed)
+    {
+        return {
+            .m_aspectRatio   = 16.0 / 9.0,
+            .m_height        = 36,
+            .m_samplingRate  = 32,
+            .m_maxDepth      = 10,
+            .m_fov           = 20.0,
+            .m_focusDistance = 10.0,
+            .m_defocusAngle  = 0.6,
+            .m_lookFrom      = { 13.0, 2.0, 3.0 },
+            .m_lookAt        = { 0.0, 0.0, 0.0 },
+            .m_background    = background,
+            .m_seed          = seed,
+        };
+    }
+
+    // mean over all the channels of |image - reference| / (reference + 0.01), the offset keeps dark pixels from
+    // dominating
+    double meanRelativeError(const Image& image, const Image& reference)
+    {
+        double sum = 0.0;
+        for (int row = 0; row < reference.height(); ++row) {
+            for (int col = 0; col < reference.width(); ++col) {
+                auto lhs = image.get(col, row);
+                auto rhs = reference.get(col, row);
+                for (std::size_t c = 0; c < 3; ++c) {
+                    sum += std::abs(lhs[c] - rhs[c]) / (rhs[c] + 0.01);
+                }
+            }
+        }
+        return sum / (3.0 * double(reference.size()));
+    }
+
+    bool identical(const Image& lhs, const Image& rhs)
+    {
+        if (lhs.width() != rhs.width() || lhs.height() != rhs.height()) {
+            return false;
+        }
+        for (int row = 0; row < lhs.height(); ++row) {
+            for (int col = 0; col < lhs.width(); ++col) {
+                if (lhs.get(col, row) != rhs.get(col, row)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // the image as it is stored in a reference file
+    Image quantized(const Image& image, const std::filesystem::path& path)
+    {
+        {
+            rtr::PpmWriter writer{ path, image.width(), image.height() };
+            writer.write(image);
+        }
+        return rtr::readPpm(path);
+    }
+
+    std::map<std::string, double> readTimings(const std::filesystem::path& path)
+    {
+        std::map<std::string, double> timings;
+
+        std::ifstream file{ path };
+        std::string   name;
+        double        seconds = 0.0;
+        while (file >> name >> seconds) {
+            timings[name] = seconds;
+        }
+        return timings;
+    }
+
+    void writeTimings(const std::filesystem::path& path, const std::map<std::string, double>& timings)
+    {
+        std::ofstream file{ path, std::ios::out | std::ios::trunc };
+        for (const auto& [name, seconds] : timings) {
+            file << fmt::format("{} {:.6f}\n", name, seconds);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    namespace ut = boost::ut;
+    using namespace ut::literals;
+    using namespace ut::operators;
+
+    if (argc < 3) {
+        fmt::println(stderr, "Usage: {} <reference dir> <output dir> [--update]", argv[0]);
+        return 1;
+    }
+
+    const std::filesystem::path referenceDir = argv[1];
+    const std::filesystem::path outputDir    = argv[2];
+    const bool                  update       = argc > 3 && std::string_view{ argv[3] } == "--update";
+
+    std::filesystem::create_directories(outputDir);
+
+    // a fresh render this much slower than the best recorded one is reported, the constant term absorbs the jitter of
+    // such short renders
+    constexpr double slowdownFactor = 1.5;
+    constexpr double slowdownSlack  = 0.05;
+    constexpr int    timingRuns     = 3;
+
+    // same seed: only floating point differences between builds, which make a few pixels take another path, are
+    // allowed. A change to the renderer moves most pixels and lands near the error of an unrelated seed.
+    constexpr double noiseFraction = 0.25;
+    constexpr double errorFloor    = 1e-3;
+
+    constexpr std::uint64_t seed = 1;
+
+    const std::array goldenScenes = {
+        GoldenScene{ "default", rtr::Background::Sky },
+        GoldenScene{ "lights", rtr::Background::Black },
+    };
+
+    concurrencpp::runtime runtime;
+    auto                  pool   = runtime.thread_pool_executor();
+    auto                  single = runtime.make_worker_thread_executor();
+
+    const auto render = [](std::shared_ptr<const rtr::Scene>       scene,
+                           rtr::TracerParam                        param,
+                           std::shared_ptr<concurrencpp::executor> executor) {
+        rtr::RayTracer tracer{ std::move(scene), std::move(param) };
+        return tracer.submit(std::move(executor)).get();
+    };
+
+    std::vector<std::shared_ptr<const rtr::Scene>> scenes;
+    for (const auto& golden : goldenScenes) {
+        scenes.push_back(std::make_shared<const rtr::Scene>(rtr::scenes::make(golden.m_name, 7)));
+    }
+
+    "deterministic"_test = [&] {
+        for (std::size_t i = 0; i < goldenScenes.size(); ++i) {
+            auto param           = goldenParam(goldenScenes[i].m_background, seed);
+            param.m_samplingRate = 4;
+
+            auto reference = render(scenes[i], param, single);
+
+            param.m_tileSize   = 7;
+            param.m_tileOrder  = rtr::TraversalOrder::Hilbert;
+            param.m_pixelOrder = rtr::TraversalOrder::Morton;
+            ut::expect(identical(render(scenes[i], param, pool), reference))
+                << fmt::format("{} depends on the threads or the tiles", goldenScenes[i].m_name);
+
+            // a crop window holds the same pixels as the whole frame
+            param.m_crop = rtr::Tile{ 11, 5, 20, 13 };
+            auto crop    = render(scenes[i], param, pool);
+            bool same    = crop.width() == 20 && crop.height() == 13;
+            for (int row = 0; same && row < crop.height(); ++row) {
+                for (int col = 0; same && col < crop.width(); ++col) {
+                    same = crop.get(col, row) == reference.get(11 + col, 5 + row);
+                }
+            }
+            ut::expect(same) << fmt::format("{} differs in a crop window", goldenScenes[i].m_name);
+        }
+    };
+
+    "resubmitted job"_test = [&] {
+        auto param           = goldenParam(goldenScenes[0].m_background, seed);
+        param.m_samplingRate = 1;
+
+        // a job cancelled by an earlier render renders again when submitted
+        rtr::RayTracer tracer{ scenes[0], param };
+        auto           job = std::make_shared<rtr::RenderJob>();
+        job->cancel();
+        ut::expect(identical(tracer.submit(pool, job).get(), render(scenes[0], param, pool)))
+            << "a resubmitted job stayed cancelled";
+    };
+
+    "first hits"_test = [&] {
+        // the default scene with other materials
+        auto world = rtr::scenes::make("default", 7);
+        for (std::size_t i = 0; const auto& object : world.objects()) {
+            if (dynamic_cast<const rtr::HittableList*>(object.get()) != nullptr) {
+                continue;
+            }
+            if (i++ % 2 == 0) {
+                object->setMaterial<rtr::Metal>(rtr::Color<>{ 0.8, 0.6, 0.2 }, 0.1);
+            } else {
+                object->setMaterial<rtr::Lambertian>(rtr::Color<>{ 0.2, 0.3, 0.7 });
+            }
+        }
+        auto restyled = std::make_shared<const rtr::Scene>(std::move(world));
+
+        auto param           = goldenParam(rtr::Background::Sky, seed);
+        param.m_samplingRate = 4;
+
+        const auto withFirstHits = [&](std::shared_ptr<rtr::FirstHits> firstHits) {
+            auto withHits        = param;
+            withHits.m_firstHits = std::move(firstHits);
+            return withHits;
+        };
+
+        // replaying the hits recorded on the original gives the same image as tracing the restyled scene
+        auto firstHits = std::make_shared<rtr::FirstHits>();
+        auto original  = render(scenes[0], withFirstHits(firstHits), pool);
+        auto traced    = render(restyled, withFirstHits(std::make_shared<rtr::FirstHits>()), pool);
+        auto replayed  = render(restyled, withFirstHits(firstHits), pool);
+        ut::expect(!identical(original, traced));
+        ut::expect(identical(replayed, traced)) << "the first hits shade differently than tracing";
+
+        param.m_lookAt = { 0.0, 1.0, 0.0 };
+        ut::expect(ut::throws<std::invalid_argument>([&] { render(restyled, withFirstHits(firstHits), pool); }))
+            << "the first hits of another view were used";
+    };
+
+    "instanced light"_test = [&] {
+        // a scene lit only by a sphere light, placed directly or in an instance
+        const auto litScene = [](bool instanced) {
+            rtr::HittableList world;
+            auto& ground = world.emplace<rtr::Sphere>(rtr::Vec3<double>{ 0.0, -1000.0, 0.0 }, 1000.0);
+            ground.setMaterial<rtr::Lambertian>(rtr::Color<>{ 0.5, 0.5, 0.5 });
+            auto& sphere = world.emplace<rtr::Sphere>(rtr::Vec3<double>{ 0.0, 1.0, 0.0 }, 1.0);
+            sphere.setMaterial<rtr::Lambertian>(rtr::Color<>{ 0.4, 0.2, 0.1 });
+
+            auto  lights = std::make_shared<rtr::HittableList>();
+            auto& target = instanced ? *lights : world;
+            auto& light  = target.emplace<rtr::Sphere>(rtr::Vec3<double>{ -2.0, 3.5, 2.0 }, 0.25);
+            light.setMaterial<rtr::DiffuseLight>(rtr::Color<>{ 60.0, 50.0, 40.0 });
+            if (instanced) {
+                lights->build();
+                world.emplace<rtr::Instance>(std::move(lights));
+            }
+            return std::make_shared<const rtr::Scene>(std::move(world));
+        };
+
+        const auto meanLuminance = [](const Image& image) {
+            double sum = 0.0;
+            for (int row = 0; row < image.height(); ++row) {
+                for (int col = 0; col < image.width(); ++col) {
+                    auto pixel  = image.get(col, row);
+                    sum        += (pixel.x() + pixel.y() + pixel.z()) / 3.0;
+                }
+            }
+            return sum / double(image.width() * image.height());
+        };
+
+        auto param   = goldenParam(rtr::Background::Black, seed);
+        auto direct  = meanLuminance(render(litScene(false), param, pool));
+        auto instead = meanLuminance(render(litScene(true), param, pool));
+        ut::expect(instead > 0.5 * direct) << fmt::format("an instanced light gives {} instead of {}", instead, direct);
+    };
+
+    "golden"_test = [&] {
+        auto timingsPath = outputDir / "timings.txt";
+        auto timings     = readTimings(timingsPath);
+
+        for (std::size_t i = 0; i < goldenScenes.size(); ++i) {
+            const auto name  = std::string{ goldenScenes[i].m_name };
+            const auto param = goldenParam(goldenScenes[i].m_background, seed);
+
+            double seconds = std::numeric_limits<double>::infinity();
+            Image  image{ 1, 1 };
+            for (int run = 0; run < timingRuns; ++run) {
+                auto start   = std::chrono::steady_clock::now();
+                image        = render(scenes[i], param, pool);
+                auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+                seconds      = std::min(seconds, elapsed.count());
+            }
+
+            auto renderedPath  = outputDir / (name + ".ppm");
+            auto referencePath = referenceDir / (name + ".ppm");
+            auto rendered      = quantized(image, renderedPath);
+
+            if (update) {
+                auto options = std::filesystem::copy_options::overwrite_existing;
+                std::filesystem::copy_file(renderedPath, referencePath, options);
+                fmt::println("updated '{}'", referencePath.string());
+                continue;
+            }
+
+            auto reference = rtr::readPpm(referencePath);
+            if (reference.width() != rendered.width() || reference.height() != rendered.height()) {
+                ut::expect(false) << fmt::format("{}: the reference has another size", name);
+                continue;
+            }
+
+            auto otherParam = goldenParam(goldenScenes[i].m_background, seed + 1);
+            auto other      = quantized(render(scenes[i], otherParam, pool), outputDir / (name + "-noise.ppm"));
+            auto noise      = meanRelativeError(other, reference);
+            auto error      = meanRelativeError(rendered, reference);
+
+            fmt::println("{}: error {:.5f} (noise {:.5f}), {:.3f}s", name, error, noise, seconds);
+            ut::expect(error <= noiseFraction * noise + errorFloor)
+                << fmt::format("{} differs from the reference: error {:.5f}, noise {:.5f}", name, error, noise);
+
+            if (auto best = timings.find(name); best != timings.end()) {
+                if (seconds > slowdownFactor * best->second + slowdownSlack) {
+                    fmt::println("{}: slower than the best recorded time {:.3f}s", name, best->second);
+                }
+                best->second = std::min(best->second, seconds);
+            } else {
+                timings[name] = seconds;
+            }
+        }
+
+        writeTimings(timingsPath, timings);
+    };
+}
@@ -0,0 +1,76 @@
+#include "rtr/color.hpp"
+#include "rtr/image.hpp"
+
+#include <fmt/core.h>
+#include <boost/ut.hpp>
+
+#include <cmath>
+#include <vector>
+
+using rtr::Color;
+using rtr::Image;
+using rtr::PixelFormat;
+
+int main()
+{
+    namespace ut = boost::ut;
+    using namespace ut::literals;
+    using namespace ut::operators;
+
+    const auto near = [](const Color<double>& lhs, const Color<double>& rhs, double tolerance) {
+        return std::abs(lhs.x() - rhs.x()) <= tolerance    //
+            && std::abs(lhs.y() - rhs.y()) <= tolerance    //
+            && std::abs(lhs.z() - rhs.z()) <= tolerance;
+    };
+
+    "half"_test = [] {
+        using rtr::PixelHalf;
+
+        ut::expect(PixelHalf::toHalf(0.0f) == 0x0000);
+        ut::expect(PixelHalf::toHalf(1.0f) == 0x3c00);
+        ut::expect(PixelHalf::toHalf(-2.0f) == 0xc000);
+        ut::expect(PixelHalf::toHalf(65504.0f) == 0x7bff);
+        ut::expect(PixelHalf::toHalf(1e6f) == 0x7c00);    // overflow to inf
+        ut::expect(PixelHalf::fromHalf(0x3555) == 0.333251953125_d);
+        ut::expect(PixelHalf::fromHalf(0x0001) == std::ldexp(1.0, -24));
+
+        for (int i = 0; i <= 1000; ++i) {
+            auto value = i / 1000.0;
+            auto back  = PixelHalf::fromHalf(PixelHalf::toHalf(float(value)));
+            ut::expect(std::abs(back - value) <= value / 1024.0 + 1e-7) << fmt::format("{} -> {}", value, back);
+        }
+    };
+
+    "rgbe"_test = [&] {
+        using rtr::PixelRgbe;
+
+        ut::expect(PixelRgbe::encode({ 0.0, 0.0, 0.0 }).decode() == Color<double>{ 0.0, 0.0, 0.0 });
+
+        Color<double> color{ 0.75, 0.5, 0.125 };
+        ut::expect(near(PixelRgbe::encode(color).decode(), color, 0.75 / 128.0));
+
+        Color<double> bright{ 12.0, 3.0, 0.5 };
+        ut::expect(near(PixelRgbe::encode(bright).decode(), bright, 12.0 / 128.0));
+    };
+
+    "image"_test = [&] {
+        for (auto format : { PixelFormat::Float32, PixelFormat::Half, PixelFormat::Rgbe }) {
+            Image image{ 4, 3, format };
+            ut::expect(image.size() == 12_u);
+
+            std::vector<Color<double>> row{ { 0.1, 0.2, 0.3 }, { 0.4, 0.5, 0.6 }, { 0.7, 0.8, 0.9 } };
+            image.setSpan(1, 2, row);
+            image.set(0, 0, { 1.0, 0.0, 0.5 });
+
+            ut::expect(near(image.get(0, 0), { 1.0, 0.0, 0.5 }, 1.0 / 128.0)) << rtr::toString(format);
+            for (int i = 0; i < 3; ++i) {
+                ut::expect(near(image.get(i + 1, 2), row[std::size_t(i)], 1.0 / 128.0)) << rtr::toString(format);
+            }
+            ut::expect(image.get(3, 1) == Color<double>{ 0.0, 0.0, 0.0 });
+        }
+
+        ut::expect(Image{ 10, 10, PixelFormat::Float32 }.bytes() == 1200_u);
+        ut::expect(Image{ 10, 10, PixelFormat::Half }.bytes() == 600_u);
+        ut::expect(Image{ 10, 10, PixelFormat::Rgbe }.bytes() == 400_u);
+    };
+}
@@ -0,0 +1,88 @@
+#include "rtr/hittable.hpp"
+#include "rtr/image.hpp"
+#include "rtr/memory.hpp"
+#include "rtr/sphere.hpp"
+
+#include <fmt/core.h>
+#include <boost/ut.hpp>
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+using rtr::memory::Subsystem;
+
+int main()
+{
+    namespace ut = boost::ut;
+    using namespace ut::literals;
+    using namespace ut::operators;
+
+    auto& accounting = rtr::memory::accounting();
+
+    const auto current = [&](Subsystem subsystem) { return accounting.usage(subsystem).m_current; };
+
+    "allocator"_test = [&] {
+        auto before = current(Subsystem::Progress);
+        {
+            std::vector<int, rtr::memory::Allocator<int, Subsystem::Progress>> values(1000);
+            ut::expect(current(Subsystem::Progress) == before + 1000 * sizeof(int));
+        }
+        ut::expect(current(Subsystem::Progress) == before);
+        ut::expect(accounting.usage(Subsystem::Progress).m_peak >= before + 1000 * sizeof(int));
+    };
+
+    "framebuffer"_test = [&] {
+        auto before = current(Subsystem::Framebuffer);
+        {
+            rtr::Image image{ 64, 32, rtr::PixelFormat::Half };
+            ut::expect(current(Subsystem::Framebuffer) == before + image.bytes());
+        }
+        ut::expect(current(Subsystem::Framebuffer) == before);
+    };
+
+    "scene"_test = [&] {
+        auto objects   = current(Subsystem::Objects);
+        auto materials = current(Subsystem::Materials);
+        {
+            rtr::HittableList list;
+            for (int i = 0; i < 100; ++i) {
+                list.emplace<rtr::Sphere>(rtr::Vec3<double>{ double(i), 0.0, 0.0 }, 0.5).setMaterial<rtr::Metal>(
+                    rtr::Color<>{ 0.5, 0.5, 0.5 }, 0.0
+                );
+            }
+            list.build();
+
+            ut::expect(current(Subsystem::Objects) >= objects + 100 * sizeof(rtr::Sphere));
+            // the list is an object too, with the default material
+            ut::expect(current(Subsystem::Materials) == materials + 100 * sizeof(rtr::Metal) + sizeof(rtr::Lambertian));
+            ut::expect(current(Subsystem::Bvh) > 0u);
+        }
+        ut::expect(current(Subsystem::Objects) == objects);
+        ut::expect(current(Subsystem::Materials) == materials);
+        ut::expect(current(Subsystem::Bvh) == 0u);
+    };
+
+    "budget"_test = [&] {
+        accounting.setBudget(accounting.total().m_current + 64 * 1024);
+
+        // scene objects fail once over the budget, and what they held is released
+        auto                             objects = current(Subsystem::Objects);
+        std::optional<rtr::HittableList> list{ std::in_place };
+        ut::expect(ut::throws<rtr::memory::BudgetExceeded>([&] {
+            for (int i = 0; i < 10'000; ++i) {
+                list->emplace<rtr::Sphere>(rtr::Vec3<double>{ double(i), 0.0, 0.0 }, 0.5);
+            }
+        }));
+        list.reset();
+        ut::expect(current(Subsystem::Objects) == objects);
+
+        // the framebuffer is only recorded, a render is checked before it starts
+        ut::expect(ut::nothrow([] { rtr::Image image{ 256, 256 }; }));
+        ut::expect(ut::throws<rtr::memory::BudgetExceeded>([&] {
+            accounting.checkBudget(Subsystem::Framebuffer, 256 * 256 * sizeof(rtr::PixelF32));
+        }));
+
+        accounting.setBudget(0);
+    };
+}
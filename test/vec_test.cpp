@@ -128,6 +128,38 @@ int main()
         ut::expect(temp == Vf3{ -1.0f, 2.0f, -1.0f }) << rtr::vecfn::toString(temp);
     };
 
+    "double"_test = [] {
+        using Vd3 = Vec3<double>;
+
+        Vd3 v{ 1.0, 2.0, 3.0 };
+        Vd3 w{ 4.0, 5.0, 6.0 };
+
+        ut::expect(rtr::vecfn::dot(v, w) == 32.0_d);
+        ut::expect(rtr::vecfn::lengthSquared(v) == 14.0_d);
+        ut::expect(rtr::vecfn::cross(v, w) == Vd3{ -3.0, 6.0, -3.0 }) << rtr::vecfn::toString(rtr::vecfn::cross(v, w));
+        ut::expect(rtr::vecfn::normalized(Vd3{ 0.0, 3.0, 4.0 }) == Vd3{ 0.0, 0.6, 0.8 });
+        ut::expect(-v == Vd3{ -1.0, -2.0, -3.0 });
+        ut::expect(v * w == Vd3{ 4.0, 10.0, 18.0 });
+        ut::expect(w - v == Vd3{ 3.0, 3.0, 3.0 });
+        ut::expect(rtr::vecfn::toString(v) == "[1, 2, 3]") << rtr::vecfn::toString(v);
+
+        // operations that would write garbage into padding lanes must still compare equal afterwards
+        ut::expect(v / w * w == v);
+        ut::expect(v + 1.0 - 1.0 == v);
+        ut::expect(v / 0.5 == v * 2);
+        ut::expect(rtr::vecfn::dot(v + 1.0, Vd3{ 1.0, 1.0, 1.0 }) == 9.0_d);
+
+        Vd3 temp = v;
+        temp    /= w;
+        temp    *= w;
+        temp    += 2;
+        temp    /= 2.0;
+        ut::expect(temp == Vd3{ 1.5, 2.0, 2.5 }) << rtr::vecfn::toString(temp);
+
+        const auto& [x, y, z] = v.tie();
+        ut::expect(x == 1.0_d && y == 2.0_d && z == 3.0_d);
+    };
+
     "custom types"_test = [] {
         struct CustomType
         {